@@ -0,0 +1,355 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+// Microbenchmarks of the sinks, encoders and ZIP record writers on the hot
+// paths of WriteAppx.
+//
+// Each benchmark prints one JSON object per line to standard output:
+//
+//   {"name": "CRC32Sink/64K", "iterations": 512, "ns_per_op": 81234.5,
+//    "bytes_per_op": 1048576, "mb_per_s": 12908.1}
+//
+// mb_per_s (10^6 bytes per second) is null for benchmarks which do not
+// process a buffer.
+
+#include <APPX/BlockDigest.h>
+#include <APPX/CRC32.h>
+#include <APPX/Deflate.h>
+#include <APPX/Hash.h>
+#include <APPX/Sink.h>
+#include <APPX/XML.h>
+#include <APPX/ZIP.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <getopt.h>
+#include <random>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+using namespace osinside::appx;
+
+namespace {
+// Keeps the compiler from optimizing away the computation of value.
+template <typename T>
+void DoNotOptimize(const T &value)
+{
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+// Data which compresses about as well as typical package contents: runs of
+// words, interleaved with random bytes.
+std::vector<std::uint8_t> MakeInput(std::size_t size)
+{
+    static const char *kWords[] = {"Assets", "Logo", "Square", "150x150",
+                                   "scale", "200", "png", "<File", "Name=",
+                                   "Size=", "\r\n", "    ", "0000"};
+    std::mt19937 random(42);
+    std::vector<std::uint8_t> data;
+    data.reserve(size);
+    while (data.size() < size) {
+        if (random() % 4 == 0) {
+            data.push_back(static_cast<std::uint8_t>(random()));
+        } else {
+            const char *word = kWords[random() % (sizeof(kWords) /
+                                                  sizeof(kWords[0]))];
+            data.insert(data.end(), word, word + std::strlen(word));
+        }
+    }
+    data.resize(size);
+    return data;
+}
+
+// Entries as a package of fileCount files of four blocks each would have.
+std::vector<ZIPFileEntry> MakeEntries(std::size_t fileCount)
+{
+    static const char *kExtensions[] = {"png", "dll", "xml", "winmd",
+                                        "pri", "dat"};
+    std::mt19937 random(42);
+    std::vector<ZIPFileEntry> entries;
+    off_t offset = 0;
+    for (std::size_t i = 0; i < fileCount; ++i) {
+        std::uint8_t hash[32];
+        std::vector<ZIPBlock> blocks;
+        for (int j = 0; j < 4; ++j) {
+            for (std::uint8_t &byte : hash) {
+                byte = static_cast<std::uint8_t>(random());
+            }
+            blocks.push_back(ZIPBlock(SHA256Hash(hash), 30000 + j));
+        }
+        std::string name = "Assets/Directory " + std::to_string(i % 50) +
+                           "/File" + std::to_string(i) + "." +
+                           kExtensions[i % (sizeof(kExtensions) /
+                                            sizeof(kExtensions[0]))];
+        entries.push_back(ZIPFileEntry(name, 4 * 30000, 4 * 65536,
+                                       ZIPCompressionType::Deflate, offset,
+                                       static_cast<std::uint32_t>(random()),
+                                       blocks, SHA256Hash()));
+        offset += entries.back().FileRecordSize();
+    }
+    return entries;
+}
+
+// Writes size bytes of data to sink writeSize bytes at a time.
+template <typename TSink>
+void WriteInPieces(TSink &sink, const std::vector<std::uint8_t> &data,
+                   std::size_t writeSize)
+{
+    for (std::size_t offset = 0; offset < data.size(); offset += writeSize) {
+        sink.Write(std::min(writeSize, data.size() - offset),
+                   data.data() + offset);
+    }
+}
+
+class Runner
+{
+public:
+    Runner(std::string filter, double minSeconds)
+        : filter(std::move(filter)), minSeconds(minSeconds)
+    {
+    }
+
+    // Runs body repeatedly for at least minSeconds, and reports the time
+    // per call. bytesPerOp is how much data one call processes, or 0.
+    void Run(const std::string &name, std::size_t bytesPerOp,
+             const std::function<void()> &body)
+    {
+        if (name.find(this->filter) == std::string::npos) {
+            return;
+        }
+        // Warm up caches and thread-local state.
+        body();
+        std::uint64_t iterations = 1;
+        double seconds;
+        for (;;) {
+            auto start = std::chrono::steady_clock::now();
+            for (std::uint64_t i = 0; i < iterations; ++i) {
+                body();
+            }
+            seconds = std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+            if (seconds >= this->minSeconds) {
+                break;
+            }
+            // Aim for a little over minSeconds next time.
+            double scale = seconds > 0 ? 1.4 * this->minSeconds / seconds
+                                       : 100.0;
+            iterations = static_cast<std::uint64_t>(
+                static_cast<double>(iterations) *
+                std::min(std::max(scale, 2.0), 100.0));
+        }
+        double nsPerOp = seconds * 1e9 / static_cast<double>(iterations);
+        std::printf(
+            "{\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.1f, "
+            "\"bytes_per_op\": %zu, \"mb_per_s\": ",
+            name.c_str(), static_cast<unsigned long long>(iterations),
+            nsPerOp, bytesPerOp);
+        if (bytesPerOp > 0) {
+            std::printf("%.1f}\n", static_cast<double>(bytesPerOp) * 1e3 /
+                                       nsPerOp);
+        } else {
+            std::printf("null}\n");
+        }
+        std::fflush(stdout);
+    }
+
+private:
+    std::string filter;
+    double minSeconds;
+};
+
+void RunBenchmarks(Runner &runner)
+{
+    const std::vector<std::uint8_t> input = MakeInput(1 << 20);
+    const std::size_t size = input.size();
+
+    runner.Run("SHA256Sink/64K", size, [&]() {
+        SHA256Sink sink;
+        WriteInPieces(sink, input, 65536);
+        DoNotOptimize(sink.SHA256());
+    });
+    runner.Run("SHA256Sink/4K", size, [&]() {
+        SHA256Sink sink;
+        WriteInPieces(sink, input, 4096);
+        DoNotOptimize(sink.SHA256());
+    });
+    runner.Run("CRC32Sink/64K", size, [&]() {
+        CRC32Sink sink;
+        WriteInPieces(sink, input, 65536);
+        DoNotOptimize(sink.CRC32());
+    });
+    runner.Run("CRC32Sink/4K", size, [&]() {
+        CRC32Sink sink;
+        WriteInPieces(sink, input, 4096);
+        DoNotOptimize(sink.CRC32());
+    });
+    runner.Run("CRC32Combine", 0, [&]() {
+        DoNotOptimize(CRC32Combine(0x12345678, 0x9abcdef0, 65536));
+    });
+    runner.Run("DigestBlocks/64K", size, [&]() {
+        BlockDigest digests[16];
+        DigestBlocks(size, input.data(), 65536, digests);
+        DoNotOptimize(digests);
+    });
+    runner.Run("BlockDigestSink/64K", size, [&]() {
+        OffsetSink offsetSink;
+        BlockDigestSink<OffsetSink> sink(65536, offsetSink);
+        WriteInPieces(sink, input, 65536);
+        sink.Close();
+        DoNotOptimize(sink.CRC32());
+    });
+    runner.Run("ChunkSink/SHA256Sink/64K", size, [&]() {
+        auto sink = MakeChunkSink(65536, []() { return SHA256Sink(); });
+        WriteInPieces(sink, input, 4096);
+        sink.Close();
+        DoNotOptimize(sink.Chunks().back().SHA256());
+    });
+    for (int level = 1; level <= 9; ++level) {
+        runner.Run("DeflateSink/level=" + std::to_string(level), size, [&]() {
+            OffsetSink offsetSink;
+            auto sink = MakeDeflateSink(level, offsetSink);
+            WriteInPieces(sink, input, 65536);
+            sink.Close();
+            DoNotOptimize(offsetSink.Offset());
+        });
+    }
+    for (int level : {1, 6, 9}) {
+        runner.Run("DeflateBlock/level=" + std::to_string(level), size,
+                   [&]() {
+                       std::vector<std::uint8_t> out;
+                       for (std::size_t offset = 0; offset < size;
+                            offset += 65536) {
+                           DeflateBlock(level, Z_DEFAULT_STRATEGY, 65536,
+                                        input.data() + offset, out);
+                       }
+                       DoNotOptimize(out.data());
+                   });
+    }
+    runner.Run("Base64Sink/32B", 32, [&]() {
+        Base64Sink sink;
+        sink.Write(32, input.data());
+        sink.Close();
+        DoNotOptimize(sink.Base64());
+    });
+    runner.Run("Base64Sink/64K", 65536, [&]() {
+        Base64Sink sink;
+        sink.Write(65536, input.data());
+        sink.Close();
+        DoNotOptimize(sink.Base64());
+    });
+
+    const std::string text =
+        "Assets/Images & Icons/<Square150x150> \"Logo\".scale-200.png";
+    runner.Run("XMLEncodeString", text.size(),
+               [&]() { DoNotOptimize(XMLEncodeString(text)); });
+    runner.Run("SanitizedFileName", text.size(), [&]() {
+        DoNotOptimize(ZIPFileEntry::SanitizedFileName(text));
+    });
+
+    for (std::size_t fileCount : {100, 10000}) {
+        std::vector<ZIPFileEntry> entries = MakeEntries(fileCount);
+        std::string suffix = "/files=" + std::to_string(fileCount);
+        runner.Run("BlockMap" + suffix, 0, [&]() {
+            OffsetSink sink;
+            DoNotOptimize(
+                WriteAppxBlockMapZIPFileEntry(sink, 0, entries, false));
+        });
+        runner.Run("ContentTypes" + suffix, 0, [&]() {
+            OffsetSink sink;
+            DoNotOptimize(
+                WriteContentTypesZIPFileEntry(sink, 0, false, entries));
+        });
+        std::vector<std::uint8_t> directory;
+        runner.Run("CentralDirectory" + suffix, 0, [&]() {
+            directory.clear();
+            VectorSink sink(directory);
+            for (const ZIPFileEntry &entry : entries) {
+                entry.WriteDirectoryEntry(sink);
+            }
+            WriteZIPEndOfCentralDirectoryRecord(sink, directory.size(),
+                                                entries);
+            DoNotOptimize(directory.data());
+        });
+    }
+}
+
+void PrintUsage(const char *programName)
+{
+    std::fprintf(
+        stderr,
+        "Usage: %s [--filter SUBSTRING] [--min-time SECONDS]\n"
+        "Runs microbenchmarks of appx's hot paths, printing a JSON object\n"
+        "per benchmark (one per line) to standard output.\n"
+        "\n"
+        "Options:\n"
+        "  --filter SUBSTRING\n"
+        "                  only run benchmarks whose name contains SUBSTRING\n"
+        "  --min-time SECONDS\n"
+        "                  run each benchmark for at least SECONDS\n"
+        "                  (default: 0.5)\n"
+        "  -h              show this usage text and exit\n",
+        programName);
+}
+}
+
+int main(int argc, char **argv) try {
+    std::string filter;
+    double minSeconds = 0.5;
+    enum
+    {
+        kFilterOption = 256,
+        kMinTimeOption,
+    };
+    static const struct option longOptions[] = {
+        {"filter", required_argument, nullptr, kFilterOption},
+        {"min-time", required_argument, nullptr, kMinTimeOption},
+        {nullptr, 0, nullptr, 0},
+    };
+    while (int c = getopt_long(argc, argv, "h", longOptions, nullptr)) {
+        if (c == -1) {
+            break;
+        }
+        switch (c) {
+            case kFilterOption:
+                filter = optarg;
+                break;
+            case kMinTimeOption: {
+                char *end;
+                minSeconds = std::strtod(optarg, &end);
+                if (end == optarg || *end != '\0' || minSeconds < 0) {
+                    std::fprintf(stderr, "Invalid --min-time: %s\n", optarg);
+                    PrintUsage(argv[0]);
+                    return 1;
+                }
+                break;
+            }
+            case 'h':
+                PrintUsage(argv[0]);
+                return 0;
+            default:
+                PrintUsage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    Runner runner(filter, minSeconds);
+    RunBenchmarks(runner);
+    return 0;
+} catch (std::exception &e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+}
@@ -0,0 +1,198 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2016-present, Facebook, Inc.
+# Copyright (c) 2021, Neal Gompa
+# All rights reserved.
+#
+# This source code is licensed under the Mozilla Public License, version 2.0.
+# For details, see the LICENSE file in the root directory of this source tree.
+# Portions of this code was previously licensed under a BSD-style license.
+# See the LICENSE-BSD file in the root directory of this source tree for details.
+
+'''
+Packages a synthetic tree (see GenerateCorpus.py) with appx at -0, -1 and
+-9, unsigned, signed and as a bundle, and records the wall time, CPU time,
+peak RSS and output size of each run as JSON.
+
+With --baseline, exits with status 1 if any run's throughput (input bytes
+per wall-clock second) is more than --max-regression below the same run in
+the baseline, a JSON file previously written by --output.
+'''
+
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+import GenerateCorpus
+
+KEY_PATH = os.path.join(os.path.dirname(os.path.dirname(
+    os.path.realpath(__file__))), 'Tests', 'App_TemporaryKey.pfx')
+LEVELS = ['0', '1', '9']
+
+def tree_size(root):
+    return sum(os.path.getsize(os.path.join(directory, name))
+               for directory, _, files in os.walk(root) for name in files)
+
+def measure(command):
+    '''
+    Runs command, returning its wall and CPU times in seconds and its peak
+    RSS in bytes.
+    '''
+    start = time.monotonic()
+    process = subprocess.Popen(command)
+    _, status, usage = os.wait4(process.pid, 0)
+    wall = time.monotonic() - start
+    process.returncode = os.waitstatus_to_exitcode(status)
+    if process.returncode != 0:
+        raise subprocess.CalledProcessError(process.returncode, command)
+    return {
+        'wall_seconds': wall,
+        'user_seconds': usage.ru_utime,
+        'system_seconds': usage.ru_stime,
+        'cpu_seconds': usage.ru_utime + usage.ru_stime,
+        # ru_maxrss is in KiB on Linux.
+        'peak_rss_bytes': usage.ru_maxrss * 1024,
+    }
+
+def prepare_bundle(appx, corpus, work_dir):
+    '''
+    Packages parts of the corpus as APPX files, and returns the inputs
+    of a bundle containing them.
+    '''
+    bundle = os.path.join(work_dir, 'bundle')
+    os.makedirs(os.path.join(bundle, 'AppxMetadata'))
+    packages = []
+    for name in ['huge', 'media', 'text', 'tiny']:
+        package = '{}.appx'.format(name)
+        subprocess.check_call([appx, '-0', '-o',
+                               os.path.join(bundle, package),
+                               os.path.join(corpus, name)])
+        packages.append(package)
+    manifest = ['<?xml version="1.0" encoding="UTF-8"?>',
+                '<Bundle><Packages>']
+    for package in packages:
+        manifest.append('<Package FileName="{0}" Offset="{0}-offset"/>'
+                        .format(package))
+    manifest.append('</Packages></Bundle>')
+    with open(os.path.join(bundle, 'AppxMetadata', 'AppxBundleManifest.xml'),
+              'w') as f:
+        f.write('\n'.join(manifest))
+    return bundle
+
+def run_benchmarks(appx, corpus, work_dir, repeat, extra_args):
+    bundle = prepare_bundle(appx, corpus, work_dir)
+    configurations = []
+    for level in LEVELS:
+        configurations.append(('unsigned-{}'.format(level), [], corpus))
+        configurations.append(('signed-{}'.format(level),
+                               ['-c', KEY_PATH], corpus))
+        configurations.append(('bundle-{}'.format(level), ['-b'], bundle))
+
+    results = []
+    output = os.path.join(work_dir, 'output.appx')
+    for name, args, inputs in configurations:
+        level = name.rsplit('-', 1)[1]
+        command = ([appx, '-' + level, '-o', output] + args + extra_args +
+                   [inputs])
+        # Keep the fastest run; slower ones measure interference.
+        best = None
+        for _ in range(repeat):
+            result = measure(command)
+            if best is None or result['wall_seconds'] < best['wall_seconds']:
+                best = result
+        input_bytes = tree_size(inputs)
+        best.update({
+            'name': name,
+            'arguments': command[1:],
+            'input_bytes': input_bytes,
+            'output_bytes': os.path.getsize(output),
+            'mb_per_s': input_bytes / 1e6 / best['wall_seconds'],
+        })
+        results.append(best)
+        print('{:12} {:8.3f} s wall {:8.3f} s CPU {:7.1f} MB/s '
+              '{:6.0f} MiB RSS'.format(name, best['wall_seconds'],
+                                       best['cpu_seconds'], best['mb_per_s'],
+                                       best['peak_rss_bytes'] / 2**20),
+              file=sys.stderr)
+    return results
+
+def find_regressions(results, baseline, max_regression):
+    baseline_results = {result['name']: result
+                        for result in baseline['results']}
+    regressions = []
+    for result in results:
+        old = baseline_results.get(result['name'])
+        if old is None:
+            continue
+        if result['mb_per_s'] < old['mb_per_s'] * (1 - max_regression):
+            regressions.append('{}: {:.1f} MB/s, was {:.1f} MB/s'.format(
+                result['name'], result['mb_per_s'], old['mb_per_s']))
+    return regressions
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip(),
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--appx', default=os.getenv('APPX_EXE_PATH'),
+                        help='appx binary (default: $APPX_EXE_PATH)')
+    parser.add_argument('--corpus',
+                        help='existing tree to package, instead of '
+                             'generating one')
+    parser.add_argument('--scale', type=float, default=1.0,
+                        help='size of the generated tree (default: 1, '
+                             'about 400 MB)')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--repeat', type=int, default=3,
+                        help='runs of each configuration; the fastest counts')
+    parser.add_argument('--jobs', '-j', help='passed to appx -j')
+    parser.add_argument('--output', help='write results as JSON to OUTPUT')
+    parser.add_argument('--baseline', help='JSON results to compare against')
+    parser.add_argument('--max-regression', type=float, default=0.3,
+                        help='allowed throughput loss against the baseline, '
+                             'as a fraction (default: 0.3)')
+    args = parser.parse_args()
+    if args.appx is None:
+        parser.error('--appx or APPX_EXE_PATH is required')
+
+    extra_args = ['-j', args.jobs] if args.jobs is not None else []
+    work_dir = tempfile.mkdtemp()
+    try:
+        corpus = args.corpus
+        if corpus is None:
+            corpus = os.path.join(work_dir, 'corpus')
+            GenerateCorpus.generate(corpus, args.scale, args.seed)
+        results = run_benchmarks(args.appx, corpus, work_dir, args.repeat,
+                                 extra_args)
+    finally:
+        shutil.rmtree(work_dir)
+
+    report = {
+        'corpus': {
+            'path': args.corpus,
+            'scale': args.scale,
+            'seed': args.seed,
+        },
+        'results': results,
+    }
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(report, f, indent=2)
+    else:
+        json.dump(report, sys.stdout, indent=2)
+        print()
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        regressions = find_regressions(results, baseline, args.max_regression)
+        for regression in regressions:
+            print('Throughput regressed: ' + regression, file=sys.stderr)
+        if regressions:
+            sys.exit(1)
+
+if __name__ == '__main__':
+    main()
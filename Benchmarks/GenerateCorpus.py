@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2016-present, Facebook, Inc.
+# Copyright (c) 2021, Neal Gompa
+# All rights reserved.
+#
+# This source code is licensed under the Mozilla Public License, version 2.0.
+# For details, see the LICENSE file in the root directory of this source tree.
+# Portions of this code was previously licensed under a BSD-style license.
+# See the LICENSE-BSD file in the root directory of this source tree for details.
+
+'''
+Generates a synthetic package tree for benchmarking appx.
+
+The tree is the same for the same seed and scale. At scale 1 it holds about
+400 MB:
+
+  tiny/    many small text and binary files in a few hundred directories
+  huge/    a few huge files, part text and part random
+  media/   incompressible files named like images and audio
+  text/    highly compressible XML-like text
+  deep/    a chain of deeply nested directories
+  sparse/  sparse files which are mostly holes
+'''
+
+import argparse
+import os
+import random
+
+WORDS = [b'<File', b'Name=', b'"Assets\\\\Logo.png"', b'Size=', b'65536',
+         b'<Block', b'Hash=', b'/>', b'\r\n', b'    ', b'Windows',
+         b'Microsoft', b'Application', b'Identity', b'Version="1.0.0.0"']
+
+def random_bytes(rng, size):
+    '''
+    Returns size random bytes. Unlike rng.randbytes, this works on Python
+    before 3.9.
+    '''
+    if size == 0:
+        return b''
+    return rng.getrandbits(8 * size).to_bytes(size, 'little')
+
+def text_bytes(rng, size):
+    chunks = []
+    total = 0
+    while total < size:
+        word = rng.choice(WORDS)
+        chunks.append(word)
+        total += len(word)
+    return b''.join(chunks)[:size]
+
+def mixed_bytes(rng, size):
+    '''
+    Alternates 64 KiB of text with 64 KiB of random bytes, so about half of
+    the blocks compress.
+    '''
+    chunks = []
+    total = 0
+    while total < size:
+        length = min(65536, size - total)
+        if len(chunks) % 2 == 0:
+            chunks.append(text_bytes(rng, length))
+        else:
+            chunks.append(random_bytes(rng, length))
+        total += length
+    return b''.join(chunks)
+
+def write_file(path, data):
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    with open(path, 'wb') as f:
+        f.write(data)
+
+def scaled(value, scale):
+    return max(1, int(value * scale))
+
+def generate(root, scale=1.0, seed=1):
+    '''
+    Generates the tree in root, which must not exist. Returns the number of
+    files and their total size.
+    '''
+    rng = random.Random(seed)
+    os.makedirs(root)
+
+    for i in range(scaled(5000, scale)):
+        directory = os.path.join(root, 'tiny', 'd{}'.format(i % 250))
+        size = rng.randrange(0, 2048)
+        if i % 3 == 0:
+            data = random_bytes(rng, size)
+        else:
+            data = text_bytes(rng, size)
+        write_file(os.path.join(directory, 'f{}.dat'.format(i)), data)
+
+    for i in range(2):
+        write_file(os.path.join(root, 'huge', 'h{}.bin'.format(i)),
+                   mixed_bytes(rng, scaled(96 << 20, scale)))
+
+    for i in range(scaled(40, scale)):
+        extension = ['png', 'ogg', 'jpg', 'zip'][i % 4]
+        write_file(os.path.join(root, 'media', 'm{}.{}'.format(i, extension)),
+                   random_bytes(rng, scaled(2 << 20, scale)))
+
+    for i in range(scaled(100, scale)):
+        write_file(os.path.join(root, 'text', 't{}.xml'.format(i)),
+                   text_bytes(rng, scaled(512 << 10, scale)))
+
+    directory = os.path.join(root, 'deep')
+    for i in range(40):
+        directory = os.path.join(directory, 'level{}'.format(i))
+        write_file(os.path.join(directory, 'file.txt'),
+                   text_bytes(rng, rng.randrange(1, 4096)))
+
+    for i in range(2):
+        path = os.path.join(root, 'sparse', 's{}.img'.format(i))
+        size = scaled(64 << 20, scale)
+        write_file(path, b'')
+        with open(path, 'r+b') as f:
+            # A few extents of data between the holes.
+            for offset in range(0, size, max(1, size // 4)):
+                f.seek(offset)
+                f.write(mixed_bytes(rng, min(65536, size - offset)))
+            f.truncate(size)
+
+    file_count = 0
+    total_size = 0
+    for directory, _, files in os.walk(root):
+        for name in files:
+            file_count += 1
+            total_size += os.path.getsize(os.path.join(directory, name))
+    return file_count, total_size
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip(),
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('root', help='directory to create')
+    parser.add_argument('--scale', type=float, default=1.0,
+                        help='multiply file counts and sizes (default: 1)')
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+    file_count, total_size = generate(args.root, args.scale, args.seed)
+    print('{} files, {} bytes'.format(file_count, total_size))
+
+if __name__ == '__main__':
+    main()
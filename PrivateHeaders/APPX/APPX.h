@@ -10,27 +10,108 @@
 
 #pragma once
 
+#include <APPX/BasePackage.h>
+#include <APPX/BlockCache.h>
+#include <APPX/Compression.h>
 #include <APPX/File.h>
+#include <APPX/OutputFile.h>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <zlib.h>
 
 namespace osinside {
 namespace appx {
+    // The order in which files are written into an APPX. Every order is
+    // deterministic: the same inputs always produce the same APPX.
+    enum class EntryOrder
+    {
+        // By archive name, compared byte by byte.
+        Name,
+        // Directory by directory: the files of a directory (by name), then
+        // its subdirectories, so each directory is read in one go.
+        Directory,
+        // By where each file's data starts on disk, falling back to inode
+        // numbers where the file system does not report it, so a spinning
+        // disk reads the files sequentially. The APPX then depends on how
+        // the files are laid out, not only on their names and contents.
+        Physical,
+    };
+
+    // A file to archive.
+    struct LocalFile
+    {
+        explicit LocalFile(std::string path)
+            : path(std::move(path)),
+              hasStatus(false),
+              status(),
+              hasCompressionPolicy(false),
+              compressionPolicy(CompressionPolicy::Store())
+        {
+        }
+
+        LocalFile(std::string path, const FileStatus &status)
+            : LocalFile(std::move(path))
+        {
+            this->hasStatus = true;
+            this->status = status;
+        }
+
+        std::string path;
+        // If true, status is the file's status from when it was listed, and
+        // the file is not looked up again.
+        bool hasStatus;
+        FileStatus status;
+        // If true, the file is compressed with compressionPolicy, whatever
+        // the policy for its archive name (e.g. it was given in a mapping
+        // file).
+        bool hasCompressionPolicy;
+        CompressionPolicy compressionPolicy;
+    };
+
+    // Parses name, directory, or physical. Throws std::invalid_argument
+    // otherwise.
+    EntryOrder ParseEntryOrder(const std::string &name);
+
     // Creates and optionally signs an APPX file.
     //
-    // fileNames maps APPX archive names to local filesystem paths.
+    // If zip is seekable, large files are streamed into it and their headers
+    // are patched afterwards; otherwise, each file is compressed into memory
+    // first. The caller must Close zip afterwards.
+    //
+    // fileNames maps APPX archive names to local files. Files are written in
+    // the given order, whatever the order of fileNames.
     //
     // certPath, if specified, causes the APPX to be signed. certPath points to
     // the path to the PKCS12 certificate file containing the private signing
     // key.
     //
-    // compressionLevel indicates how much to compress individual files.
-    // Z_DEFAULT_COMPRESSION and any value between Z_NO_COMPRESSION and
-    // Z_BEST_COMPRESSION are accepted.
+    // compressionPolicies chooses how each file is compressed, by archive
+    // name, unless its LocalFile has a compression policy.
+    //
+    // jobs is the number of threads used to compress files. If jobs is greater
+    // than 1, files are compressed concurrently; the resulting APPX is
+    // byte-for-byte identical to the one produced with a single job.
+    //
+    // blockCache, if not null, holds compressed blocks from previous runs.
+    // Cached blocks are not compressed again. The APPX does not depend on
+    // the contents of the cache.
+    //
+    // base, if not null, is a previous version of the APPX. Files whose
+    // blocks match the base's block map, and which would be compressed the
+    // same way (stored or deflated), have their compressed data copied from
+    // the base instead of being compressed again, whatever level the base
+    // was compressed with.
+    //
+    // Input files are read ahead into the page cache while earlier files are
+    // compressed. If dropInputCache is true, each input file is dropped from
+    // the page cache once it is archived.
     void WriteAppx(
-        const FilePtr &zip,
-        const std::unordered_map<std::string, std::string> &fileNames,
-        const std::string *certPath, int compressionLevel, bool bundle);
+        OutputFile &zip,
+        const std::unordered_map<std::string, LocalFile> &fileNames,
+        const std::string *certPath,
+        const CompressionPolicies &compressionPolicies, unsigned jobs,
+        BlockCache *blockCache, const BasePackage *base, bool bundle,
+        EntryOrder order, bool dropInputCache);
 }
 }
@@ -0,0 +1,74 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#pragma once
+
+#include <APPX/File.h>
+#include <APPX/ZIP.h>
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+namespace osinside {
+namespace appx {
+    // A file in a previously built package.
+    struct BaseEntry
+    {
+        ZIPCompressionType compressionType;
+        std::uint32_t crc32;
+        off_t compressedSize;
+        off_t uncompressedSize;
+        // Where the compressed data starts in the package.
+        off_t dataOffset;
+        // From AppxBlockMap.xml.
+        std::vector<ZIPBlock> blocks;
+
+        // Returns an entry for the same data, to be written at a new offset.
+        ZIPFileEntry ToZIPFileEntry(const std::string &archiveFileName) const;
+    };
+
+    // A previously built APPX whose compressed files can be copied into a
+    // new APPX without compressing them again.
+    //
+    // Only files listed in the package's AppxBlockMap.xml are available, so
+    // files can be compared block by block before they are reused.
+    class BasePackage
+    {
+    public:
+        // Throws if the package cannot be read or is not a valid APPX.
+        explicit BasePackage(const std::string &path);
+
+        // Returns null if the package has no file with the given archive
+        // name.
+        const BaseEntry *Find(const std::string &archiveFileName) const;
+
+        // Returns true if path names the package's file, e.g. through
+        // another link. Writing there would destroy the data to be reused.
+        bool IsSameFile(const std::string &path) const;
+
+        const FilePtr &File() const
+        {
+            return this->file;
+        }
+
+    private:
+        std::string path;
+        FilePtr file;
+        std::unordered_map<std::string, BaseEntry> entries;
+    };
+
+    // Returns true if the file at inputFileName has exactly the blocks of
+    // entry, so entry's compressed data can be used for it.
+    bool MatchesBaseEntry(const BaseEntry &entry,
+                          const std::string &inputFileName);
+}
+}
@@ -0,0 +1,63 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#pragma once
+
+#include <APPX/Hash.h>
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+namespace osinside {
+namespace appx {
+    // An on-disk cache of compressed blocks, shared between runs.
+    //
+    // A block compressed by DeflateBlock depends only on its contents, the
+    // compression level and strategy, and the DEFLATE backend and its
+    // version (see DeflateBackendVersion), so it is keyed by the SHA256
+    // digest of its contents (which the block map needs anyway) and those
+    // settings.
+    //
+    // The cache is best-effort: entries which cannot be read, are corrupt,
+    // or cannot be written are treated as misses. Several processes may
+    // share a cache directory. Methods may be called from any thread.
+    class BlockCache
+    {
+    public:
+        // The directory is created if it does not exist. maxSize is the size
+        // in bytes Trim shrinks the cache to. Reads the process's umask, so
+        // it must be created before other threads create files.
+        BlockCache(std::string directory, off_t maxSize);
+
+        // If the compressed form of a block is cached, appends it to out and
+        // returns true. Otherwise, returns false.
+        bool Find(const SHA256Hash &sha256, int compressionLevel,
+                  int strategy, std::vector<std::uint8_t> &out);
+
+        void Insert(const SHA256Hash &sha256, int compressionLevel,
+                    int strategy, std::size_t size,
+                    const std::uint8_t *compressedBytes);
+
+        // Deletes the least recently used entries until the cache is no
+        // bigger than maxSize.
+        void Trim();
+
+    private:
+        std::string EntryPath(const SHA256Hash &sha256, int compressionLevel,
+                              int strategy) const;
+
+        std::string directory;
+        off_t maxSize;
+        // The mode new entries get, as if created with open.
+        mode_t entryMode;
+    };
+}
+}
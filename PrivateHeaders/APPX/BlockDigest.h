@@ -0,0 +1,131 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#pragma once
+
+#include <APPX/CRC32.h>
+#include <APPX/Hash.h>
+#include <APPX/Trace.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+#include <vector>
+
+namespace osinside {
+namespace appx {
+    // The digests of one block of a file.
+    struct BlockDigest
+    {
+        std::uint32_t crc32;
+        SHA256Hash sha256;
+    };
+
+    // Computes the CRC32 and SHA256 digests of each blockSize bytes of bytes
+    // (the last block may be shorter) into digests, which must have room for
+    // ceil(size / blockSize) digests. Each block is hashed, then
+    // checksummed, so the CRC32 pass reads it from the CPU cache.
+    void DigestBlocks(std::size_t size, const std::uint8_t *bytes,
+                      std::size_t blockSize, BlockDigest *digests);
+
+    // A sink which digests each blockSize bytes with DigestBlocks, then
+    // writes them to another sink, while they are still in the CPU cache.
+    // Close must be called after writing data.
+    //
+    // Data is gathered into a buffer until there is a whole block to
+    // digest, unless Write is given whole blocks while nothing is buffered.
+    template <typename TSink>
+    class BlockDigestSink
+    {
+    public:
+        BlockDigestSink(std::size_t blockSize, TSink &sink)
+            : blockSize(blockSize), sink(&sink)
+        {
+            this->buffer.reserve(blockSize);
+        }
+
+        BlockDigestSink(const BlockDigestSink &) = delete;
+
+        BlockDigestSink &operator=(const BlockDigestSink &) = delete;
+
+        void Write(std::size_t size, const std::uint8_t *bytes)
+        {
+            while (size > 0) {
+                if (this->buffer.empty() && size >= this->blockSize) {
+                    this->ProcessBlock(this->blockSize, bytes);
+                    bytes += this->blockSize;
+                    size -= this->blockSize;
+                    continue;
+                }
+                std::size_t toCopy =
+                    std::min(size, this->blockSize - this->buffer.size());
+                this->buffer.insert(this->buffer.end(), bytes, bytes + toCopy);
+                bytes += toCopy;
+                size -= toCopy;
+                if (this->buffer.size() == this->blockSize) {
+                    this->ProcessBuffer();
+                }
+            }
+        }
+
+        void Close()
+        {
+            this->ProcessBuffer();
+        }
+
+        const std::vector<BlockDigest> &Blocks() const
+        {
+            return this->blocks;
+        }
+
+        // The CRC32 of all data.
+        std::uint32_t CRC32() const
+        {
+            return this->crc;
+        }
+
+        off_t Size() const
+        {
+            return this->size;
+        }
+
+    private:
+        void ProcessBuffer()
+        {
+            if (!this->buffer.empty()) {
+                this->ProcessBlock(this->buffer.size(), this->buffer.data());
+                this->buffer.clear();
+            }
+        }
+
+        void ProcessBlock(std::size_t size, const std::uint8_t *bytes)
+        {
+            BlockDigest block;
+            {
+                TraceSpan span("digest", "DigestBlocks");
+                DigestBlocks(size, bytes, size, &block);
+                span.SetBytes(static_cast<std::int64_t>(size), 0);
+            }
+            this->sink->Write(size, bytes);
+            this->blocks.push_back(block);
+            this->crc = CRC32Combine(this->crc, block.crc32,
+                                     static_cast<off_t>(size));
+            this->size += size;
+        }
+
+        std::size_t blockSize;
+        TSink *sink;
+        std::vector<std::uint8_t> buffer;
+        std::vector<BlockDigest> blocks;
+        std::uint32_t crc = 0;
+        off_t size = 0;
+    };
+}
+}
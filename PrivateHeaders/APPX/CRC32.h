@@ -0,0 +1,41 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+namespace osinside {
+namespace appx {
+    // Continues the CRC32 (as used by ZIP, and computed by zlib's crc32) crc
+    // over bytes. The CRC32 of no bytes is 0.
+    //
+    // The implementation is chosen at run time: carry-less multiplication
+    // (PCLMULQDQ) folding on x86, the CRC32 instructions on ARMv8, or zlib.
+    std::uint32_t CRC32Update(std::uint32_t crc, std::size_t size,
+                              const std::uint8_t *bytes);
+
+    inline std::uint32_t CRC32(std::size_t size, const std::uint8_t *bytes)
+    {
+        return CRC32Update(0, size, bytes);
+    }
+
+    // Returns the CRC32 of A followed by B, given the CRC32 of A, the CRC32
+    // of B, and the size of B. Like zlib's crc32_combine, this lets parts of
+    // a file be checksummed independently (e.g. on different threads).
+    std::uint32_t CRC32Combine(std::uint32_t crcA, std::uint32_t crcB,
+                               off_t sizeB);
+
+    // The name of the implementation CRC32Update uses on this CPU.
+    const char *CRC32Implementation();
+}
+}
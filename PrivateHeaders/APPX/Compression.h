@@ -0,0 +1,117 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#pragma once
+
+#include <string>
+#include <sys/types.h>
+#include <vector>
+#include <zlib.h>
+
+namespace osinside {
+namespace appx {
+    // How a file is compressed in the ZIP archive.
+    struct CompressionPolicy
+    {
+        enum class Method
+        {
+            Store,
+            Deflate,
+            // Deflate, unless a sample of the file barely compresses, in
+            // which case Store. See ResolveAutoCompression.
+            Auto,
+        };
+
+        Method method;
+        // zlib compression level and strategy. Ignored for Store.
+        int level;
+        int strategy;
+
+        static CompressionPolicy Store()
+        {
+            return CompressionPolicy{Method::Store, Z_NO_COMPRESSION,
+                                     Z_DEFAULT_STRATEGY};
+        }
+
+        static CompressionPolicy Deflate(int level,
+                                         int strategy = Z_DEFAULT_STRATEGY)
+        {
+            return CompressionPolicy{Method::Deflate, level, strategy};
+        }
+
+        // The policy for a level given on the command line: Store for
+        // Z_NO_COMPRESSION, otherwise Deflate.
+        static CompressionPolicy FromLevel(int level)
+        {
+            return level == Z_NO_COMPRESSION ? Store() : Deflate(level);
+        }
+    };
+
+    // Parses a policy specification:
+    //
+    //   store            do not compress
+    //   deflate[:LEVEL]  compress with the default strategy
+    //   filtered[:LEVEL] compress with Z_FILTERED (for binaries)
+    //   huffman          compress with Z_HUFFMAN_ONLY
+    //   rle              compress with Z_RLE
+    //   auto[:LEVEL]     compress, or store if the file is incompressible
+    //
+    // defaultLevel is used if LEVEL is omitted. Throws std::invalid_argument
+    // if spec is malformed.
+    CompressionPolicy ParseCompressionPolicy(const std::string &spec,
+                                             int defaultLevel);
+
+    // Chooses the policy for each file in the archive from a list of rules.
+    class CompressionPolicies
+    {
+    public:
+        explicit CompressionPolicies(CompressionPolicy defaultPolicy);
+
+        // Adds a rule which applies policy to files matching patterns, a
+        // comma-separated list. A pattern starting with a dot (e.g. ".png")
+        // matches files with that extension, ignoring case. Any other pattern
+        // is a shell wildcard pattern (see fnmatch) matched against the whole
+        // archive name; '*' matches '/'.
+        //
+        // Rules are tried in the order they were added; the first matching
+        // rule wins.
+        void Add(const std::string &patterns, CompressionPolicy policy);
+
+        const CompressionPolicy &ForArchiveName(
+            const std::string &archiveName) const;
+
+    private:
+        struct Rule
+        {
+            // Lower-case, without the leading dot.
+            std::vector<std::string> extensions;
+            std::vector<std::string> wildcards;
+            CompressionPolicy policy;
+        };
+
+        CompressionPolicy defaultPolicy;
+        std::vector<Rule> rules;
+    };
+
+    // If policy is Auto, deflates a few blocks sampled from the file and
+    // returns Store if they shrink by less than a few percent, or Deflate
+    // otherwise. Other policies are returned unchanged.
+    //
+    // Files which cannot be sampled without consuming them (e.g. pipes) are
+    // deflated.
+    CompressionPolicy ResolveAutoCompression(const CompressionPolicy &policy,
+                                             const std::string &inputFileName);
+
+    // Returns true if a sample of sampledSize bytes which DeflateBlock
+    // compressed to compressedSize bytes shrank too little to be worth
+    // deflating. This is how ResolveAutoCompression decides on Store.
+    bool IsIncompressibleSample(off_t sampledSize, off_t compressedSize);
+}
+}
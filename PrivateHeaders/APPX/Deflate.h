@@ -0,0 +1,353 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#pragma once
+
+#include <APPX/BlockCache.h>
+#include <APPX/BlockDigest.h>
+#include <APPX/CRC32.h>
+#include <APPX/Hash.h>
+#include <APPX/Memory.h>
+#include <APPX/ThreadPool.h>
+#include <APPX/Trace.h>
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+#include <zlib.h>
+
+namespace osinside {
+namespace appx {
+    // A library which implements DeflateBlock and DeflateFinish. Each
+    // produces valid raw DEFLATE data with the same block boundaries, but
+    // different backends compress the same bytes differently.
+    enum class DeflateBackend
+    {
+        Zlib,
+        // zlib-ng's native API. Faster than zlib at every level.
+        ZlibNG,
+        // Intel's ISA-L (igzip). Much faster than zlib, but only has four
+        // levels: 1 to 3 map to ISA-L level 1, 4 to 6 to level 2, and 7 to 9
+        // to level 3. The strategy is ignored.
+        ISAL,
+    };
+
+    // Parses "zlib", "zlib-ng" or "isal". Throws std::invalid_argument for
+    // any other name.
+    DeflateBackend ParseDeflateBackend(const std::string &name);
+
+    const char *DeflateBackendName(DeflateBackend backend);
+
+    // Whether the backend was compiled in.
+    bool IsDeflateBackendAvailable(DeflateBackend backend);
+
+    // Selects the backend used by DeflateBlock and DeflateFinish. Must be
+    // called before any compression starts. Throws std::invalid_argument if
+    // the backend is not available. The default is chosen when building (see
+    // APPX_DEFAULT_DEFLATE_BACKEND).
+    void SetDeflateBackend(DeflateBackend backend);
+
+    DeflateBackend GetDeflateBackend();
+
+    // Identifies the selected backend and its version. Compressed data
+    // depends only on this, the compression level and strategy, and the
+    // input.
+    std::string DeflateBackendVersion();
+
+    // Compresses bytes as raw DEFLATE data ending with a full flush, appending
+    // the compressed data to out. strategy is a zlib strategy such as
+    // Z_DEFAULT_STRATEGY or Z_FILTERED.
+    //
+    // Compressing consecutive blocks with DeflateBlock and concatenating the
+    // results produces the same bytes as a DeflateSink which is flushed after
+    // every block.
+    void DeflateBlock(int compressionLevel, int strategy, std::size_t size,
+                      const std::uint8_t *bytes, std::vector<std::uint8_t> &out);
+
+    // Appends the end of a raw DEFLATE stream to out. This is what
+    // DeflateSink::Close writes after a Flush.
+    void DeflateFinish(int compressionLevel, int strategy,
+                       std::vector<std::uint8_t> &out);
+
+    // A block compressed by a BlockDeflateSink.
+    struct DeflatedBlock
+    {
+        // Hash of the uncompressed data.
+        SHA256Hash sha256;
+        off_t compressedSize;
+    };
+
+    // A sink which compresses into another sink using the ZIP DEFLATE
+    // algorithm, compressing each block of blockSize bytes independently.
+    // Close must be called after writing data.
+    //
+    // Every block is compressed with a fresh compressor state and ends with a
+    // full flush, so the compressed data of a block depends only on its
+    // contents. This lets blocks be compressed out of order: if pool is not
+    // null, blocks are compressed concurrently on the pool's threads, and the
+    // output is the same as without a pool.
+    //
+    // The CRC32 and SHA256 digests of each block are computed alongside its
+    // compression; the block CRC32s are combined into the CRC32 of the whole
+    // input. At most a few blocks per thread are held in memory at a time.
+    //
+    // If blockCache is not null, blocks found in it are not compressed again,
+    // and newly compressed blocks are added to it.
+    template <typename TSink>
+    class BlockDeflateSink
+    {
+    public:
+        BlockDeflateSink(int compressionLevel, int strategy,
+                         std::size_t blockSize, ThreadPool *pool,
+                         BlockCache *blockCache, TSink &sink)
+            : compressionLevel(compressionLevel),
+              strategy(strategy),
+              blockSize(blockSize),
+              maxBlocksInFlight(pool ? 2 * pool->ThreadCount() + 2 : 0),
+              pool(pool),
+              blockCache(blockCache),
+              sink(&sink)
+        {
+        }
+
+        ~BlockDeflateSink()
+        {
+            // Tasks refer to this object, so wait for them even if an
+            // exception is propagating.
+            for (const std::shared_ptr<Block> &block : this->blocksInFlight) {
+                this->WaitForBlock(*block);
+            }
+        }
+
+        BlockDeflateSink(const BlockDeflateSink &) = delete;
+
+        BlockDeflateSink &operator=(const BlockDeflateSink &) = delete;
+
+        void Write(std::size_t size, const std::uint8_t *bytes)
+        {
+            while (size > 0) {
+                if (!this->currentBlock) {
+                    this->currentBlock = std::make_shared<Block>();
+                    this->currentBlock->input.reserve(this->blockSize);
+                    this->currentBlock->memory.Set(
+                        this->currentBlock->input.capacity());
+                }
+                std::vector<std::uint8_t> &input = this->currentBlock->input;
+                std::size_t toCopy =
+                    std::min(this->blockSize - input.size(), size);
+                input.insert(input.end(), bytes, bytes + toCopy);
+                bytes += toCopy;
+                size -= toCopy;
+                if (input.size() == this->blockSize) {
+                    this->EndCurrentBlock();
+                }
+            }
+        }
+
+        void Close()
+        {
+            if (this->currentBlock && !this->currentBlock->input.empty()) {
+                if (this->blocksInFlight.empty()) {
+                    // Nothing to wait for, so don't bother handing the last
+                    // block to another thread.
+                    this->CompressCurrentBlock();
+                } else {
+                    this->SubmitCurrentBlock();
+                }
+            }
+            while (!this->blocksInFlight.empty()) {
+                this->WriteOldestBlock();
+            }
+            std::vector<std::uint8_t> end;
+            DeflateFinish(this->compressionLevel, this->strategy, end);
+            this->sink->Write(end.size(), end.data());
+        }
+
+        const std::vector<DeflatedBlock> &Blocks() const
+        {
+            return this->blocks;
+        }
+
+        std::uint32_t CRC32() const
+        {
+            return this->crc;
+        }
+
+        off_t UncompressedSize() const
+        {
+            return this->uncompressedSize;
+        }
+
+    private:
+        struct Block
+        {
+            std::vector<std::uint8_t> input;
+            std::vector<std::uint8_t> output;
+            BlockDigest digest;
+            std::exception_ptr error;
+            bool done = false;
+            MemoryCharge memory{MemoryComponent::EntryBuffers};
+        };
+
+        static void CompressBlock(int compressionLevel, int strategy,
+                                  BlockCache *blockCache, Block &block)
+        {
+            std::int64_t inputSize =
+                static_cast<std::int64_t>(block.input.size());
+            // Digest the block just before compressing it, so DEFLATE reads
+            // it from the CPU cache.
+            {
+                TraceSpan span("digest", "DigestBlocks");
+                DigestBlocks(block.input.size(), block.input.data(),
+                             block.input.size(), &block.digest);
+                span.SetBytes(inputSize, 0);
+            }
+            if (!blockCache || !blockCache->Find(block.digest.sha256,
+                                                 compressionLevel, strategy,
+                                                 block.output)) {
+                {
+                    TraceSpan span("deflate", "DeflateBlock");
+                    DeflateBlock(compressionLevel, strategy,
+                                 block.input.size(), block.input.data(),
+                                 block.output);
+                    span.SetBytes(
+                        inputSize,
+                        static_cast<std::int64_t>(block.output.size()));
+                }
+                if (blockCache) {
+                    blockCache->Insert(block.digest.sha256, compressionLevel,
+                                       strategy, block.output.size(),
+                                       block.output.data());
+                }
+            }
+            block.memory.Set(block.input.capacity() +
+                             block.output.capacity());
+        }
+
+        void EndCurrentBlock()
+        {
+            if (this->pool) {
+                this->SubmitCurrentBlock();
+            } else {
+                this->CompressCurrentBlock();
+            }
+        }
+
+        void CompressCurrentBlock()
+        {
+            CompressBlock(this->compressionLevel, this->strategy,
+                          this->blockCache, *this->currentBlock);
+            this->WriteBlock(*this->currentBlock);
+            // Reuse the buffers for the next block.
+            this->currentBlock->input.clear();
+            this->currentBlock->output.clear();
+        }
+
+        void SubmitCurrentBlock()
+        {
+            std::shared_ptr<Block> block = std::move(this->currentBlock);
+            this->currentBlock.reset();
+            this->blocksInFlight.push_back(block);
+            int compressionLevel = this->compressionLevel;
+            int strategy = this->strategy;
+            BlockCache *blockCache = this->blockCache;
+            std::mutex *mutex = &this->mutex;
+            std::condition_variable *blockDone = &this->blockDone;
+            this->pool->Submit(
+                [compressionLevel, strategy, blockCache, block, mutex,
+                 blockDone]() {
+                    std::exception_ptr error;
+                    try {
+                        CompressBlock(compressionLevel, strategy, blockCache,
+                                      *block);
+                    } catch (...) {
+                        error = std::current_exception();
+                    }
+                    // Notify while holding the lock: once the waiter sees
+                    // done, it may destroy the condition variable.
+                    std::lock_guard<std::mutex> lock(*mutex);
+                    block->error = error;
+                    block->done = true;
+                    blockDone->notify_all();
+                },
+                ThreadPool::kHighestPriority);
+            if (this->blocksInFlight.size() >= this->maxBlocksInFlight) {
+                this->WriteOldestBlock();
+            }
+        }
+
+        void WaitForBlock(const Block &block)
+        {
+            for (;;) {
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    if (block.done) {
+                        return;
+                    }
+                }
+                // Help compress blocks instead of sleeping. If no block is
+                // queued, ours is being compressed by another thread.
+                if (!this->pool->RunQueuedTask(ThreadPool::kHighestPriority)) {
+                    std::unique_lock<std::mutex> lock(this->mutex);
+                    this->blockDone.wait(lock,
+                                         [&block]() { return block.done; });
+                    return;
+                }
+            }
+        }
+
+        void WriteOldestBlock()
+        {
+            std::shared_ptr<Block> block = this->blocksInFlight.front();
+            this->WaitForBlock(*block);
+            this->blocksInFlight.pop_front();
+            if (block->error) {
+                std::rethrow_exception(block->error);
+            }
+            this->WriteBlock(*block);
+        }
+
+        void WriteBlock(const Block &block)
+        {
+            this->sink->Write(block.output.size(), block.output.data());
+            this->blocks.push_back(DeflatedBlock{
+                block.digest.sha256,
+                static_cast<off_t>(block.output.size())});
+            this->crc = CRC32Combine(this->crc, block.digest.crc32,
+                                     static_cast<off_t>(block.input.size()));
+            this->uncompressedSize += block.input.size();
+        }
+
+        int compressionLevel;
+        int strategy;
+        std::size_t blockSize;
+        std::size_t maxBlocksInFlight;
+        ThreadPool *pool;
+        BlockCache *blockCache;
+        TSink *sink;
+
+        std::mutex mutex;
+        std::condition_variable blockDone;
+        std::shared_ptr<Block> currentBlock;
+        std::deque<std::shared_ptr<Block>> blocksInFlight;
+
+        std::vector<DeflatedBlock> blocks;
+        std::uint32_t crc = 0;
+        off_t uncompressedSize = 0;
+    };
+}
+}
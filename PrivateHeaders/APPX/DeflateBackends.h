@@ -0,0 +1,43 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The DEFLATE backends other than zlib. Each lives in its own source file,
+// which is only compiled if the library was found (see CMakeLists.txt), and
+// must not include zlib.h: zlib-ng's header conflicts with it.
+//
+// Each DeflateBlock function behaves like appx::DeflateBlock. DeflateFinish
+// is the same for every backend; see Deflate.cpp.
+
+namespace osinside {
+namespace appx {
+#if APPX_HAVE_ZLIB_NG
+    void DeflateBlockZlibNG(int compressionLevel, int strategy,
+                            std::size_t size, const std::uint8_t *bytes,
+                            std::vector<std::uint8_t> &out);
+
+    std::string ZlibNGVersion();
+#endif
+
+#if APPX_HAVE_ISAL
+    void DeflateBlockISAL(int compressionLevel, std::size_t size,
+                          const std::uint8_t *bytes,
+                          std::vector<std::uint8_t> &out);
+
+    std::string ISALVersion();
+#endif
+}
+}
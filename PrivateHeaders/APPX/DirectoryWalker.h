@@ -0,0 +1,46 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#pragma once
+
+#include <APPX/File.h>
+#include <string>
+#include <vector>
+
+namespace osinside {
+namespace appx {
+    struct WalkedFile
+    {
+        // The path relative to the directory which was walked, or the name
+        // of the file which was given if it is not a directory.
+        std::string archiveName;
+        std::string path;
+        // False if the file could not be looked up; opening it will report
+        // the error.
+        bool hasStatus;
+        FileStatus status;
+    };
+
+    // Lists the files under path, which may be a directory or any other file,
+    // and looks each one up with statx (fstatat before glibc 2.28). Symbolic
+    // links are listed as files, not followed. Files are listed in no
+    // particular order.
+    //
+    // Directories are read by several threads, each taking directories from
+    // its own queue and taking from the others' once its queue is empty. On
+    // network file systems, where every directory read is a round trip,
+    // walking a big tree then takes a fraction of the time. Threads are only
+    // started once there are directories for them, so walking a flat
+    // directory uses one.
+    //
+    // Throws ErrnoException if a directory cannot be read.
+    void WalkDirectory(const std::string &path, std::vector<WalkedFile> &files);
+}
+}
@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <APPX/Trace.h>
+#include <algorithm>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
@@ -17,6 +19,7 @@
 #include <memory>
 #include <string>
 #include <stdexcept>
+#include <sys/types.h>
 
 namespace osinside {
 namespace appx {
@@ -95,14 +98,142 @@ namespace appx {
         }
     }
 
+    // Reads bytes from a position in a file, like pread. The file's buffered
+    // data is flushed first. The file position is not changed. Returns fewer
+    // than size bytes only at the end of the file.
+    std::size_t ReadAt(const FilePtr &file, off_t offset, std::size_t size,
+                       void *bytes);
+
+    // Reads the whole file at path into bytes, which has room for capacity
+    // bytes, without a stdio buffer. Returns the size of the file, or
+    // capacity if the file has at least capacity bytes (in which case the
+    // rest is not read).
+    std::size_t ReadSmallFile(const std::string &path, std::size_t capacity,
+                              std::uint8_t *bytes);
+
+    // What is known about a file from when it was listed (see
+    // WalkDirectory), so it need not be looked up again. Symbolic links are
+    // followed, like stat.
+    struct FileStatus
+    {
+        mode_t mode;
+        off_t size;
+        dev_t device;
+        ino_t inode;
+    };
+
+    // Returns where the data of the file at path starts on its device, as
+    // reported by the FIEMAP ioctl. Returns false if the file system does
+    // not report it (e.g. NFS or tmpfs), or if the file is empty or stored
+    // inline.
+    bool GetPhysicalOffset(const std::string &path, std::uint64_t &offset);
+
+    // Copies size bytes starting at offset from a file into a sink.
+    template <typename TSink>
+    void CopyRange(const FilePtr &from, off_t offset, off_t size, TSink &to)
+    {
+        std::uint8_t buffer[65536];
+        while (size > 0) {
+            std::size_t toRead = static_cast<std::size_t>(
+                std::min(size, static_cast<off_t>(sizeof(buffer))));
+            std::size_t read = ReadAt(from, offset, toRead, buffer);
+            if (read == 0) {
+                throw std::runtime_error("Unexpected end of file");
+            }
+            to.Write(read, buffer);
+            offset += read;
+            size -= read;
+        }
+    }
+
+    // A read-only memory mapping of a whole file.
+    //
+    // The file must not be truncated while it is mapped; reading pages past
+    // the new end of the file raises SIGBUS.
+    class MappedFile
+    {
+    public:
+        // Maps the file if it is a non-empty regular file. Otherwise (e.g.
+        // for pipes), or if the file cannot be mapped, IsMapped returns false
+        // and the file should be read with Read instead.
+        //
+        // The kernel is told the mapping will be read sequentially, so it
+        // reads ahead aggressively.
+        explicit MappedFile(const FilePtr &file);
+
+        ~MappedFile();
+
+        MappedFile(const MappedFile &) = delete;
+
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        bool IsMapped() const
+        {
+            return this->data != nullptr;
+        }
+
+        const std::uint8_t *Data() const
+        {
+            return this->data;
+        }
+
+        std::size_t Size() const
+        {
+            return this->size;
+        }
+
+    private:
+        const std::uint8_t *data;
+        std::size_t size;
+    };
+
+    // Writes all bytes of a mapped file into a sink, 256 KiB at a time: a
+    // whole number of ZIP blocks, yet small enough to stay in the CPU cache
+    // while the sink reads it more than once.
+    template <typename TSink>
+    void WriteMapping(const MappedFile &mapping, TSink &to)
+    {
+        const std::size_t kSpanSize = 256 * 1024;
+        const std::uint8_t *data = mapping.Data();
+        std::size_t size = mapping.Size();
+        while (size > 0) {
+            std::size_t spanSize = std::min(size, kSpanSize);
+            to.Write(spanSize, data);
+            data += spanSize;
+            size -= spanSize;
+        }
+    }
+
+    // Copies all bytes of a file, which must be positioned at its start,
+    // into a sink.
+    //
+    // Regular files are mapped into memory and written to the sink straight
+    // from the mapping (see WriteMapping), so they are not copied through a
+    // read buffer first. Other files are read with Copy.
+    template <typename TSink>
+    void CopyFile(const FilePtr &from, TSink &to)
+    {
+        MappedFile mapping(from);
+        if (!mapping.IsMapped()) {
+            Copy(from, to);
+            return;
+        }
+        WriteMapping(mapping, to);
+    }
+
     // Copies all bytes (starting from the current position) from a file into a
     // sink.
     template <typename TSink>
     void Copy(const FilePtr &from, TSink &to)
     {
-        std::uint8_t buffer[4096];
+        std::uint8_t buffer[65536];
         for (;;) {
-            std::size_t read = Read(from, sizeof(buffer), buffer);
+            std::size_t read;
+            {
+                TraceSpan span("read", "Read");
+                read = Read(from, sizeof(buffer), buffer);
+                span.SetBytes(static_cast<std::int64_t>(read), 0);
+            }
             if (read == 0) {
                 break;
             }
@@ -0,0 +1,118 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+struct statx;
+
+namespace osinside {
+namespace appx {
+    // A minimal Linux io_uring instance, driven with the raw system calls so
+    // no liburing is needed.
+    //
+    // Operations are queued with Prepare*, handed to the kernel with Submit,
+    // and their results collected with PopCompletion. An IOUring must only
+    // be used by one thread at a time.
+    class IOUring
+    {
+    public:
+        enum class Operation
+        {
+            Read,
+            Write,
+            OpenAt,
+            Statx,
+            Close,
+        };
+
+        // entries is the maximum number of operations queued at once.
+        //
+        // Throws ErrnoException if io_uring is unavailable (e.g. ENOSYS on
+        // old kernels, or EPERM if it is disabled by the administrator).
+        explicit IOUring(unsigned entries);
+
+        ~IOUring();
+
+        IOUring(const IOUring &) = delete;
+
+        IOUring &operator=(const IOUring &) = delete;
+
+        // Returns true if io_uring support was compiled in. If false, the
+        // constructor always throws.
+        static bool IsCompiledIn();
+
+        // Returns true if the kernel supports operation. io_uring itself
+        // appeared in Linux 5.1, but these operations only in 5.6; queueing
+        // one the kernel lacks completes with -EINVAL.
+        bool Supports(Operation operation) const;
+
+        // Queue a pwrite or pread. Returns false if the queue is full; call
+        // Submit and try again.
+        bool PrepareWrite(int fd, const void *bytes, std::size_t size,
+                          off_t offset, std::uint64_t userData);
+        bool PrepareRead(int fd, void *bytes, std::size_t size, off_t offset,
+                         std::uint64_t userData);
+
+        // Queue an openat, statx or close. path and status must stay valid
+        // until the operation completes. An opened file descriptor is the
+        // operation's result.
+        bool PrepareOpenAt(int directoryFD, const char *path, int flags,
+                           std::uint64_t userData);
+        bool PrepareStatx(int directoryFD, const char *path, int flags,
+                          unsigned mask, struct statx *status,
+                          std::uint64_t userData);
+        bool PrepareClose(int fd, std::uint64_t userData);
+
+        // Submits the queued operations, then waits until at least
+        // waitCount operations have completed.
+        void Submit(unsigned waitCount);
+
+        // If an operation completed, sets userData and result (the return
+        // value of the equivalent system call, or a negated errno value) and
+        // returns true. Otherwise, returns false.
+        bool PopCompletion(std::uint64_t &userData, int &result);
+
+    private:
+        void Close();
+
+        // flags are the operation's flags (e.g. open_flags for openat).
+        bool Prepare(int opcode, int fd, std::uint64_t address,
+                     std::size_t size, std::uint64_t offset,
+                     std::uint32_t flags, std::uint64_t userData);
+
+        void ProbeOperations();
+
+        int fd;
+        // A bit for each supported Operation.
+        unsigned supportedOperations;
+        void *submissionRing;
+        std::size_t submissionRingSize;
+        void *completionRing;
+        std::size_t completionRingSize;
+        void *submissionEntries;
+        std::size_t submissionEntriesSize;
+
+        unsigned *submissionHead;
+        unsigned *submissionTail;
+        unsigned submissionMask;
+        unsigned *submissionArray;
+        unsigned *completionHead;
+        unsigned *completionTail;
+        unsigned completionMask;
+        void *completionEntries;
+        // Operations prepared but not yet submitted.
+        unsigned pendingCount;
+    };
+}
+}
@@ -0,0 +1,20 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#pragma once
+
+#include <string>
+
+namespace osinside {
+namespace appx {
+    // Returns s as a JSON string literal, including the quotes.
+    std::string JSONEncodeString(const std::string &s);
+}
+}
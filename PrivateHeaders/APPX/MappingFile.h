@@ -0,0 +1,73 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#pragma once
+
+#include <APPX/APPX.h>
+#include <cstddef>
+#include <exception>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+
+namespace osinside {
+namespace appx {
+    class MalformedMappingFileError : public std::exception
+    {
+    public:
+        // lineNumber is the 1-based line, or record of a binary mapping file,
+        // which is malformed.
+        explicit MalformedMappingFileError(off_t lineNumber);
+
+        const char *what() const noexcept override
+        {
+            return this->message.c_str();
+        }
+
+        void SetFileName(const char *fileName);
+
+    private:
+        std::string message;
+        off_t lineNumber;
+    };
+
+    // Adds the files listed in a mapping file to fileNames, which maps
+    // archive names to local files. A file which is already in fileNames is
+    // not replaced.
+    //
+    // A text mapping file has the following form:
+    //
+    //     [Files]
+    //     "/path/to/local/file.exe" "appx_file.exe"
+    //     "/path/to/local/image.png" "Assets/image.png" store
+    //
+    // A quote within a path is written twice. For compatibility, a line
+    // "a""b" with no other quotes is still the local path a and the archive
+    // name b. The optional POLICY after the archive name (see
+    // ParseCompressionPolicy, with defaultLevel) overrides the --policy rules
+    // for that file. Blank lines are ignored.
+    //
+    // A binary mapping file, which a build system can write and appx can load
+    // without parsing text, starts with the 8 bytes "APPXMAP1". Each file
+    // follows as three strings: its local path, its archive name, and its
+    // POLICY (empty for none). Each string is its length as 4 bytes (little
+    // endian), then its bytes.
+    //
+    // Throws MalformedMappingFileError if data is not a valid mapping file.
+    void ParseMappingFile(const char *data, std::size_t size,
+                          int defaultLevel,
+                          std::unordered_map<std::string, LocalFile> &fileNames);
+
+    // Maps the mapping file at path ("-" for the standard input) and parses
+    // it (see ParseMappingFile). Throws ErrnoException if it cannot be read.
+    void ReadMappingFile(const std::string &path, int defaultLevel,
+                         std::unordered_map<std::string, LocalFile> &fileNames);
+}
+}
@@ -0,0 +1,147 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <zlib.h>
+
+namespace osinside {
+namespace appx {
+    // The parts of the packager whose memory use is counted separately, for
+    // --stats.
+    enum class MemoryComponent
+    {
+        // Compressed entries waiting to be written, and blocks of streamed
+        // entries being compressed.
+        EntryBuffers,
+        // The ZIPFileEntry records kept for the block map and the central
+        // directory.
+        EntryMetadata,
+        // AppxBlockMap.xml, [Content_Types].xml and AppxBundleManifest.xml
+        // while they are generated.
+        XML,
+        // zlib's compressor and decompressor state.
+        Zlib,
+        // OpenSSL's allocations outside of signing (mostly SHA-256
+        // contexts).
+        Hashing,
+        // OpenSSL's allocations while signing.
+        Signing,
+    };
+
+    enum
+    {
+        kMemoryComponentCount = 6
+    };
+
+    const char *MemoryComponentName(MemoryComponent component);
+
+    struct MemoryUsage
+    {
+        std::size_t live;
+        // The most which was live at once.
+        std::size_t peak;
+    };
+
+    // Counters may be changed from any thread.
+    void AddMemoryUsage(MemoryComponent component, std::size_t size);
+    void RemoveMemoryUsage(MemoryComponent component, std::size_t size);
+
+    MemoryUsage GetMemoryUsage(MemoryComponent component);
+
+    // The sum of all components. Its peak is the most which was live at once,
+    // not the sum of the components' peaks.
+    MemoryUsage GetTotalMemoryUsage();
+
+    // Returns the peak total usage since the previous call, and starts
+    // measuring a new peak.
+    std::size_t ResetStagePeakMemoryUsage();
+
+    // Counts size bytes against a component until it is destroyed.
+    class MemoryCharge
+    {
+    public:
+        explicit MemoryCharge(MemoryComponent component, std::size_t size = 0)
+            : component(component), size(0)
+        {
+            this->Set(size);
+        }
+
+        ~MemoryCharge()
+        {
+            this->Set(0);
+        }
+
+        MemoryCharge(MemoryCharge &&other)
+            : component(other.component), size(other.size)
+        {
+            other.size = 0;
+        }
+
+        MemoryCharge &operator=(MemoryCharge &&other)
+        {
+            if (this != &other) {
+                this->Set(0);
+                this->component = other.component;
+                this->size = other.size;
+                other.size = 0;
+            }
+            return *this;
+        }
+
+        // Changes the number of bytes counted.
+        void Set(std::size_t size)
+        {
+            if (size > this->size) {
+                AddMemoryUsage(this->component, size - this->size);
+            } else if (size < this->size) {
+                RemoveMemoryUsage(this->component, this->size - size);
+            }
+            this->size = size;
+        }
+
+    private:
+        MemoryComponent component;
+        std::size_t size;
+    };
+
+    // Makes OpenSSL allocations made by this thread count against component
+    // rather than Hashing while the scope exists.
+    class MemoryScope
+    {
+    public:
+        explicit MemoryScope(MemoryComponent component);
+
+        ~MemoryScope();
+
+        MemoryScope(const MemoryScope &) = delete;
+
+        MemoryScope &operator=(const MemoryScope &) = delete;
+
+    private:
+        MemoryComponent previous;
+    };
+
+    // Makes zlib allocate the state of stream, which must not be initialized
+    // yet, with allocation functions which count against Zlib.
+    void CountZlibAllocations(z_stream &stream);
+
+    // Makes OpenSSL allocate with allocation functions which count against
+    // Hashing or Signing. OpenSSL only allows this before its first
+    // allocation; returns false if it is too late.
+    bool CountOpenSSLAllocations();
+
+    // Writes a table of the live and peak usage of each component, and the
+    // peak resident set size of the process.
+    void WriteMemorySummary(std::FILE *out);
+}
+}
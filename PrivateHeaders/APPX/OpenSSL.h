@@ -13,6 +13,7 @@
 #include <memory>
 #include <openssl/asn1.h>
 #include <openssl/bio.h>
+#include <openssl/evp.h>
 #include <openssl/pkcs12.h>
 #include <stdexcept>
 #include <string>
@@ -57,6 +58,7 @@ namespace appx {
     using ASN1_STRINGPtr = OpenSSLPtr<ASN1_STRING, ASN1_STRING_free>;
     using ASN1_TYPEPtr = OpenSSLPtr<ASN1_TYPE, ASN1_TYPE_free>;
     using BIOPtr = OpenSSLPtr<BIO, BIO_free_all>;
+    using EVP_MD_CTXPtr = OpenSSLPtr<EVP_MD_CTX, EVP_MD_CTX_free>;
     using PKCS12Ptr = OpenSSLPtr<PKCS12, PKCS12_free>;
 }
 }
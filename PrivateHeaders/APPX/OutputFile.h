@@ -0,0 +1,229 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#pragma once
+
+#include <APPX/File.h>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <vector>
+
+namespace osinside {
+namespace appx {
+    class IOUring;
+
+    struct OutputOptions
+    {
+        enum class Backend
+        {
+            // pwrite from a writer thread.
+            PWrite,
+            // io_uring, with all full buffers in flight at once. Falls back
+            // to PWrite if io_uring is unavailable.
+            IOUring,
+        };
+
+        enum class SyncPolicy
+        {
+            // Leave writeback to the kernel.
+            None,
+            // fdatasync once all data is written.
+            Close,
+            // Start writeback every syncInterval bytes, wait for the
+            // previous interval, and fdatasync once all data is written. This
+            // bounds how much dirty output the kernel holds.
+            Interval,
+        };
+
+        Backend backend = Backend::PWrite;
+        // Write full buffers with O_DIRECT, bypassing the page cache. Falls
+        // back to buffered writes if the file system does not support it.
+        bool direct = false;
+        // Drop written output from the page cache once it reached storage,
+        // so a huge package does not evict other files. Implies writeback
+        // every syncInterval bytes.
+        bool dropCache = false;
+        SyncPolicy syncPolicy = SyncPolicy::None;
+        off_t syncInterval = off_t(64) << 20;
+        // Must be a multiple of kDirectAlignment.
+        std::size_t bufferSize = std::size_t(4) << 20;
+        std::size_t bufferCount = 2;
+    };
+
+    // An output file written through large, aligned buffers.
+    //
+    // Write (the sink interface) only copies into the current buffer. Full
+    // buffers are written with positional writes on a writer thread while
+    // the next buffer fills, so the thread producing the output (and the
+    // compression threads it waits for) do not stall on I/O unless all
+    // buffers are in flight. WriteAt and ReadAt do not wait for the writer
+    // thread either.
+    //
+    // Output can also be a pipe or a terminal, in which case the file is
+    // written sequentially and WriteAt, ReadAt and CopyRange throw.
+    class OutputFile
+    {
+    public:
+        // O_DIRECT needs buffers, offsets and sizes aligned to the logical
+        // block size of the device. This is a multiple of all common ones.
+        enum : std::size_t
+        {
+            kDirectAlignment = 4096
+        };
+
+        // Creates or truncates the file at path. Throws ErrnoException on
+        // failure. Unsupported options are ignored; see UsesIOUring and
+        // IsDirect.
+        OutputFile(const std::string &path, const OutputOptions &options);
+
+        // Discards unwritten data if Close was not called.
+        ~OutputFile();
+
+        OutputFile(const OutputFile &) = delete;
+
+        OutputFile &operator=(const OutputFile &) = delete;
+
+        void Write(std::size_t size, const std::uint8_t *bytes);
+
+        // The size of the file, including buffered data.
+        off_t Offset() const
+        {
+            return this->current->offset + this->current->size;
+        }
+
+        bool IsSeekable() const
+        {
+            return this->isSeekable;
+        }
+
+        bool UsesIOUring() const
+        {
+            return this->ring != nullptr;
+        }
+
+        bool IsDirect() const
+        {
+            return this->directFD != -1;
+        }
+
+        // Overwrites bytes which were already written (e.g. to patch a
+        // header). offset + size must not exceed Offset(). Bytes which left
+        // the current buffer are patched by the writer thread once the
+        // buffers queued before are written.
+        void WriteAt(off_t offset, std::size_t size, const void *bytes);
+
+        // Reads bytes which were already written, including those still in
+        // buffers and pending patches.
+        void ReadAt(off_t offset, std::size_t size, void *bytes);
+
+        // Reads size bytes starting at offset into a sink.
+        template <typename TSink>
+        void CopyRange(off_t offset, off_t size, TSink &to)
+        {
+            std::uint8_t buffer[65536];
+            while (size > 0) {
+                std::size_t toRead = static_cast<std::size_t>(
+                    std::min(size, static_cast<off_t>(sizeof(buffer))));
+                this->ReadAt(offset, toRead, buffer);
+                to.Write(toRead, buffer);
+                offset += toRead;
+                size -= toRead;
+            }
+        }
+
+        // Appends size bytes starting at offset in from. If possible, the
+        // kernel copies the data (see copy_file_range and sendfile), which
+        // avoids copying it through user space and can share storage on
+        // file systems which support reflinks.
+        void CopyFrom(const FilePtr &from, off_t offset, off_t size);
+
+        // Writes all buffered data, syncs according to the sync policy, and
+        // closes the file. Throws if any write failed.
+        void Close();
+
+    private:
+        struct Buffer
+        {
+            std::uint8_t *data;
+            // Where data belongs in the file.
+            off_t offset;
+            std::size_t size;
+            // How much of data may be filled before the buffer is written.
+            // Keeps the buffers after a CopyFrom or a flush aligned.
+            std::size_t capacity;
+        };
+
+        // Bytes to be written at offset after the buffers which were queued
+        // when WriteAt was called.
+        struct Patch
+        {
+            off_t offset;
+            std::vector<std::uint8_t> bytes;
+        };
+
+        struct BufferDeleter
+        {
+            void operator()(std::uint8_t *data);
+        };
+
+        void StartBuffer(Buffer *buffer, off_t offset);
+        // Queues the current buffer for the writer thread and starts filling
+        // a free one.
+        void SubmitCurrentBuffer();
+        // Waits until every queued buffer and patch is written.
+        void Drain();
+        void ThrowIfFailed();
+        void Work();
+        void WriteBuffers(const std::vector<Buffer *> &batch);
+        void WriteBuffer(const Buffer &buffer);
+        void AfterWrite(off_t end);
+
+        OutputOptions options;
+        int fd;
+        // -1 unless options.direct is in effect.
+        int directFD;
+        bool isSeekable;
+        // Syncing and dropping the page cache only apply to regular files.
+        bool isRegular;
+        std::unique_ptr<IOUring> ring;
+
+        std::vector<std::unique_ptr<std::uint8_t, BufferDeleter>> storage;
+        std::vector<Buffer> buffers;
+        // Owned by the producing thread.
+        Buffer *current;
+
+        std::mutex mutex;
+        std::condition_variable changed;
+        // Buffers waiting for the writer thread, in file order.
+        std::deque<Buffer *> queued;
+        std::vector<Buffer *> freeBuffers;
+        // Buffers taken by the writer thread, in file order.
+        std::vector<Buffer *> writing;
+        // Stay here until they are written, so ReadAt can apply them.
+        std::deque<Patch> patches;
+        std::exception_ptr error;
+        bool stopping = false;
+
+        // Owned by the writer thread.
+        off_t syncedEnd = 0;
+        off_t previousSyncedEnd = 0;
+
+        std::thread writer;
+    };
+}
+}
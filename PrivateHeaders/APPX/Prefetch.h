@@ -0,0 +1,83 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <vector>
+
+namespace osinside {
+namespace appx {
+    // Asks the kernel to read input files ahead of the entry being archived
+    // (see POSIX_FADV_WILLNEED), so the next files are in the page cache by
+    // the time they are compressed. The kernel's own read-ahead stays within
+    // a file, so otherwise the first read of every file waits for the disk
+    // while the CPU idles.
+    //
+    // A background thread advises files up to windowSize bytes past the
+    // entry being archived (at most windowSize bytes of each file).
+    // Optionally, it also drops archived files from the page cache
+    // (POSIX_FADV_DONTNEED), so archiving a big tree does not evict
+    // everything else.
+    //
+    // Advice is best-effort: files which cannot be opened are skipped, and
+    // the error is reported when they are archived.
+    class InputPrefetcher
+    {
+    public:
+        struct Input
+        {
+            const std::string *path;
+            // Negative unless the file is a regular file.
+            off_t size;
+            // False if the file is read ahead some other way (e.g. by a
+            // SmallFileReader).
+            bool prefetch;
+        };
+
+        // The paths of inputs must outlive the prefetcher.
+        InputPrefetcher(std::vector<Input> inputs, off_t windowSize,
+                        bool dropArchived);
+
+        // Drops the files which were archived, if requested, then stops.
+        ~InputPrefetcher();
+
+        InputPrefetcher(const InputPrefetcher &) = delete;
+
+        InputPrefetcher &operator=(const InputPrefetcher &) = delete;
+
+        // Tells the prefetcher that the inputs before index were archived.
+        void Reached(std::size_t index);
+
+    private:
+        void Run();
+
+        std::vector<Input> inputs;
+        off_t windowSize;
+        bool dropArchived;
+        // The bytes of the inputs before each one which count towards the
+        // window.
+        std::vector<off_t> windowOffsets;
+
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::size_t reached = 0;
+        // The thread sleeps until reached is at least wakeIndex.
+        std::size_t wakeIndex = 0;
+        bool stopping = false;
+        std::thread thread;
+    };
+}
+}
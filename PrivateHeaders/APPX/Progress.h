@@ -0,0 +1,134 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+
+namespace osinside {
+namespace appx {
+    // Reports the progress of packaging for --progress, as newline-delimited
+    // JSON objects written to a file descriptor. Each object has an "event"
+    // member:
+    //
+    // * "begin": the number of entries and their total size are known.
+    // * "entry_start", "entry_finish": an entry started or finished being
+    //   compressed and written. Entries are compressed in parallel with -j,
+    //   so several may be started at once.
+    // * "progress": written every interval, even if nothing progressed (so a
+    //   stall can be noticed), and once at the end. Has the bytes read and
+    //   written so far, the current throughput, the compression ratio of the
+    //   finished entries, and the estimated time left.
+    //
+    // Counters are atomic, so the threads reading and compressing input only
+    // add to them. Writing an event takes a lock.
+    class Progress
+    {
+    public:
+        // fd is not closed. Errors writing to it are ignored.
+        Progress(int fd, std::chrono::milliseconds interval);
+
+        // Writes a final progress event.
+        ~Progress();
+
+        Progress(const Progress &) = delete;
+
+        Progress &operator=(const Progress &) = delete;
+
+        void Begin(std::size_t entryCount, off_t totalBytes);
+
+        void StartEntry(const std::string &archiveName, off_t size);
+
+        // outputOffset is the size of the output after the entry.
+        void FinishEntry(const std::string &archiveName,
+                         off_t uncompressedSize, off_t compressedSize,
+                         off_t outputOffset);
+
+        // Counts input bytes read for an entry.
+        void AddBytesRead(std::size_t size)
+        {
+            this->bytesRead.fetch_add(size, std::memory_order_relaxed);
+        }
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        void Run();
+        void WriteProgress();
+        void WriteEvent(const std::string &json);
+
+        int fd;
+        std::chrono::milliseconds interval;
+        Clock::time_point start;
+
+        std::atomic<std::uint64_t> entryCount;
+        std::atomic<std::uint64_t> totalBytes;
+        std::atomic<std::uint64_t> entriesDone;
+        std::atomic<std::uint64_t> bytesRead;
+        std::atomic<std::uint64_t> bytesWritten;
+        // Of finished entries, for the compression ratio.
+        std::atomic<std::uint64_t> uncompressedBytes;
+        std::atomic<std::uint64_t> compressedBytes;
+
+        // Owned by the reporting thread.
+        Clock::time_point lastReport;
+        std::uint64_t lastBytesRead;
+
+        std::mutex writeMutex;
+        std::mutex mutex;
+        std::condition_variable stopRequested;
+        bool stopping;
+        std::thread reporter;
+    };
+
+    // Makes progress be reported to progress, or not at all if progress is
+    // null (the default).
+    void SetProgress(Progress *progress);
+
+    Progress *GetProgress();
+
+    // Passes bytes on to a sink, counting them as read for progress.
+    template <typename TSink>
+    class ProgressSink
+    {
+    public:
+        ProgressSink(Progress *progress, TSink &sink)
+            : progress(progress), sink(sink)
+        {
+        }
+
+        void Write(std::size_t size, const std::uint8_t *bytes)
+        {
+            if (this->progress) {
+                this->progress->AddBytesRead(size);
+            }
+            this->sink.Write(size, bytes);
+        }
+
+    private:
+        Progress *progress;
+        TSink &sink;
+    };
+
+    template <typename TSink>
+    ProgressSink<TSink> MakeProgressSink(TSink &sink)
+    {
+        return ProgressSink<TSink>(GetProgress(), sink);
+    }
+}
+}
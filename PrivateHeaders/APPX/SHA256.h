@@ -0,0 +1,28 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#pragma once
+
+#include <APPX/Hash.h>
+#include <cstddef>
+#include <cstdint>
+#include <openssl/evp.h>
+
+namespace osinside {
+namespace appx {
+    // OpenSSL's SHA-256, fetched once so initializing a context does not look
+    // it up again. OpenSSL chooses SHA-NI or ARMv8 instructions at run time.
+    const EVP_MD *SHA256Digest();
+
+    // Hashes bytes with a context which is reused by the calling thread, so
+    // hashing each block of a file does not allocate one.
+    SHA256Hash DigestSHA256(std::size_t size, const std::uint8_t *bytes);
+}
+}
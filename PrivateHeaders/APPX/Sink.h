@@ -10,9 +10,12 @@
 
 #pragma once
 
+#include <APPX/CRC32.h>
 #include <APPX/File.h>
 #include <APPX/Hash.h>
+#include <APPX/Memory.h>
 #include <APPX/OpenSSL.h>
+#include <APPX/SHA256.h>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
@@ -51,26 +54,19 @@ namespace appx {
     class SHA256Sink
     {
     public:
-        SHA256Sink()
-        {
-            SHA256_Init(&this->context);
-        }
+        SHA256Sink();
 
         void Write(std::size_t size, const std::uint8_t *bytes)
         {
-            SHA256_Update(&this->context, bytes, size);
+            if (!EVP_DigestUpdate(this->context.get(), bytes, size)) {
+                throw OpenSSLException();
+            }
         }
 
-        SHA256Hash SHA256() const
-        {
-            SHA256_CTX context = this->context;
-            std::uint8_t hash[SHA256_DIGEST_LENGTH];
-            SHA256_Final(hash, &context);
-            return SHA256Hash(hash);
-        }
+        SHA256Hash SHA256() const;
 
     private:
-        SHA256_CTX context;
+        EVP_MD_CTXPtr context;
     };
 
     // A sink which encodes in base64.
@@ -261,9 +257,7 @@ namespace appx {
     public:
         DeflateSink(int compressionLevel, TSink &sink) : sink(&sink)
         {
-            this->stream.zalloc = nullptr;
-            this->stream.zfree = nullptr;
-            this->stream.opaque = nullptr;
+            CountZlibAllocations(this->stream);
             int rc =
                 deflateInit2(&this->stream, compressionLevel, Z_DEFLATED,
                              -MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY);
@@ -365,13 +359,7 @@ namespace appx {
     public:
         void Write(std::size_t size, const std::uint8_t *bytes)
         {
-            if (sizeof(size) > std::numeric_limits<unsigned int>::max()) {
-                // TODO(strager): Support larger inputs.
-                throw std::range_error(
-                    "Buffer is too big for zlib's crc32 function");
-            }
-            this->crc =
-                crc32(this->crc, bytes, static_cast<unsigned int>(size));
+            this->crc = CRC32Update(this->crc, size, bytes);
         }
 
         std::uint32_t CRC32() const
@@ -380,7 +368,7 @@ namespace appx {
         }
 
     private:
-        std::uint32_t crc = crc32(0, nullptr, 0);
+        std::uint32_t crc = 0;
     };
 
     // A linked list of sinks.
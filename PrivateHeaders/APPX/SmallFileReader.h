@@ -0,0 +1,152 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#pragma once
+
+#include <APPX/Memory.h>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace osinside {
+namespace appx {
+    class IOUring;
+
+    // Reads small files ahead of the threads which compress them, with many
+    // files in flight at once. The latency of opening and reading each file
+    // (a round trip per operation on network file systems) then overlaps
+    // with compression and with the other reads, instead of adding up.
+    //
+    // With io_uring, one thread queues an openat and a statx for each of up
+    // to a few hundred files, then a read and a close once both complete.
+    // Otherwise, a few threads each read one file at a time.
+    //
+    // Files are read in order, at most readAhead files past the first file
+    // which was not taken yet.
+    class SmallFileReader
+    {
+    public:
+        // paths must outlive the reader. Files bigger than maxSize are not
+        // read.
+        SmallFileReader(std::vector<const std::string *> paths,
+                        std::size_t maxSize, std::size_t readAhead);
+
+        // Waits for reads in flight. Files which were not taken are
+        // discarded.
+        ~SmallFileReader();
+
+        SmallFileReader(const SmallFileReader &) = delete;
+
+        SmallFileReader &operator=(const SmallFileReader &) = delete;
+
+        bool UsesIOUring() const
+        {
+            return this->ring != nullptr;
+        }
+
+        // Waits until the file at index in paths was read. If it is a
+        // regular file of at most maxSize bytes, moves its contents into data
+        // and returns true. Otherwise, returns false, and the caller should
+        // read the file some other way. Throws ErrnoException if the file
+        // could not be opened or read.
+        //
+        // Each file must be taken at most once.
+        bool Take(std::size_t index, std::vector<std::uint8_t> &data);
+
+    private:
+        enum class State
+        {
+            Reading,
+            Read,
+            // Not a regular file of at most maxSize bytes.
+            Unsuitable,
+            Failed,
+            Taken,
+        };
+
+        struct File
+        {
+            State state = State::Reading;
+            std::vector<std::uint8_t> data;
+            // errno if state is Failed.
+            int error = 0;
+            MemoryCharge memory{MemoryComponent::EntryBuffers};
+        };
+
+        // Must be called with mutex held.
+        bool CanStartFile() const
+        {
+            return this->nextFile < this->paths.size() &&
+                   this->nextFile - this->firstFile < this->readAhead;
+        }
+
+        // Whether a reader waiting for room should read again: once there
+        // is room for many files, so readers and takers do not wake each
+        // other for every file, or as soon as a taker waits for a file which
+        // was not started. Must be called with mutex held.
+        bool ShouldResume() const
+        {
+            return this->CanStartFile() &&
+                   (this->nextFile - this->firstFile <= this->readAhead / 2 ||
+                    this->nextFile <= this->wantedFile);
+        }
+
+        // A file in flight on io_uring.
+        struct RingSlot;
+
+        // Adds the next file to files, waiting until it may be read if wait
+        // is true. Returns false if there is nothing to read.
+        bool StartFile(std::unique_lock<std::mutex> &lock, bool wait,
+                       std::size_t &index, File *&file);
+        void FinishFile(File &file, State state, int error);
+
+        void RunRing();
+        // Hands the files in flight on the ring back to be read the normal
+        // way, and waits for the ring's operations in flight.
+        void AbandonRing(std::size_t inFlightCount);
+        void RunThread();
+
+        std::vector<const std::string *> paths;
+        std::size_t maxSize;
+        std::size_t readAhead;
+
+        std::mutex mutex;
+        // Only signalled if a thread waits, to save wakeups for every file.
+        std::condition_variable fileRead;
+        std::condition_variable canStartFile;
+        std::size_t takersWaiting = 0;
+        std::size_t readersWaiting = 0;
+        // The files from firstFile, the first file which was not taken, to
+        // nextFile, the next file to read.
+        std::deque<File> files;
+        std::size_t firstFile = 0;
+        std::size_t nextFile = 0;
+        // The last file a taker waited for.
+        std::size_t wantedFile = 0;
+        bool stopping = false;
+
+        // Used by RunRing. The buffers of files which AbandonRing could not
+        // wait for are kept here, as the kernel may still write to them.
+        std::unique_ptr<RingSlot[]> ringSlots;
+        std::vector<std::vector<std::uint8_t>> abandonedBuffers;
+
+        // Declared after files and the above, so reads in flight are
+        // cancelled before their buffers are freed.
+        std::unique_ptr<IOUring> ring;
+        std::vector<std::thread> threads;
+    };
+}
+}
@@ -0,0 +1,96 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace osinside {
+namespace appx {
+    // A fixed set of worker threads which run queued tasks.
+    //
+    // Tasks with a higher priority are started before tasks with a lower
+    // priority. Tasks with equal priority are started in submission order.
+    //
+    // Tasks must not throw. Callers should catch exceptions inside the task
+    // and hand them back to the submitting thread (e.g. with
+    // std::exception_ptr).
+    class ThreadPool
+    {
+    public:
+        enum : std::uint64_t
+        {
+            kHighestPriority = UINT64_MAX
+        };
+
+        // threadCount must be at least 1.
+        explicit ThreadPool(unsigned threadCount);
+
+        // Waits for running tasks to finish. Tasks which have not yet
+        // started are discarded.
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool &) = delete;
+
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        void Submit(std::function<void()> task, std::uint64_t priority = 0);
+
+        // If the highest-priority queued task has at least the given
+        // priority, runs it on the calling thread and returns true. Otherwise,
+        // returns false.
+        //
+        // Threads waiting for tasks they submitted should call this in a loop
+        // rather than block, so tasks submitted from inside a task cannot
+        // deadlock the pool.
+        bool RunQueuedTask(std::uint64_t minimumPriority);
+
+        unsigned ThreadCount() const
+        {
+            return static_cast<unsigned>(this->threads.size());
+        }
+
+    private:
+        struct Task
+        {
+            std::function<void()> function;
+            std::uint64_t priority;
+            std::uint64_t sequence;
+
+            bool operator<(const Task &other) const
+            {
+                if (this->priority != other.priority) {
+                    return this->priority < other.priority;
+                }
+                return this->sequence > other.sequence;
+            }
+        };
+
+        void Work();
+
+        std::mutex mutex;
+        std::condition_variable taskAvailable;
+        std::priority_queue<Task> tasks;
+        std::uint64_t nextSequence = 0;
+        bool stopping = false;
+        std::vector<std::thread> threads;
+    };
+
+    // Returns the number of jobs to use when the user asks for "as many as
+    // possible".
+    unsigned DefaultJobCount();
+}
+}
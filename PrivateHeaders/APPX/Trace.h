@@ -0,0 +1,134 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace osinside {
+namespace appx {
+    // Records spans of time spent in each phase of packaging and on each
+    // entry, for --trace and --stats. Methods may be called from any thread.
+    class Tracer
+    {
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        struct Span
+        {
+            const char *category;
+            std::string name;
+            Clock::time_point start;
+            Clock::time_point end;
+            // The kernel's ID of the thread which recorded the span.
+            long threadID;
+            // Already encoded as JSON values.
+            std::vector<std::pair<const char *, std::string>> arguments;
+            // Counted in the --stats summary.
+            std::int64_t inputBytes;
+            std::int64_t outputBytes;
+            // For phases, the most memory counted (see Memory.h) at once
+            // during the span. -1 for other spans.
+            std::int64_t peakMemory;
+        };
+
+        Tracer();
+
+        Tracer(const Tracer &) = delete;
+
+        Tracer &operator=(const Tracer &) = delete;
+
+        void Add(Span span);
+
+        // Writes the spans in the Chrome trace event format, which
+        // chrome://tracing and Perfetto display. Throws ErrnoException on
+        // failure.
+        void WriteChromeTrace(const std::string &path) const;
+
+        // Writes a table of the total time spent in each kind of span.
+        void WriteSummary(std::FILE *out) const;
+
+    private:
+        Clock::time_point start;
+        long mainThreadID;
+        mutable std::mutex mutex;
+        std::vector<Span> spans;
+    };
+
+    // Makes spans be recorded into tracer, or not at all if tracer is null
+    // (the default). Must be called while no spans are being recorded.
+    void SetTracer(Tracer *tracer);
+
+    Tracer *GetTracer();
+
+    // Records the time from construction to destruction as a span, if a
+    // tracer is set. Arguments annotate the span in the trace.
+    //
+    // Spans in the "phase" category must not overlap, and must be recorded
+    // on one thread; each records its peak memory use.
+    class TraceSpan
+    {
+    public:
+        TraceSpan(const char *category, const char *name)
+            : tracer(GetTracer())
+        {
+            if (this->tracer) {
+                this->Begin(category, name);
+            }
+        }
+
+        TraceSpan(const char *category, const std::string &name)
+            : TraceSpan(category, name.c_str())
+        {
+        }
+
+        ~TraceSpan()
+        {
+            if (this->tracer) {
+                this->End();
+            }
+        }
+
+        TraceSpan(const TraceSpan &) = delete;
+
+        TraceSpan &operator=(const TraceSpan &) = delete;
+
+        // False if no tracer is set. Check this before computing costly
+        // arguments.
+        bool IsEnabled() const
+        {
+            return this->tracer != nullptr;
+        }
+
+        void AddArgument(const char *key, const std::string &value);
+
+        void AddArgument(const char *key, std::int64_t value);
+
+        void AddArgument(const char *key, double value);
+
+        // Records how many bytes the span read and wrote. They are also
+        // added as arguments, and summed by --stats.
+        void SetBytes(std::int64_t inputBytes, std::int64_t outputBytes);
+
+    private:
+        void Begin(const char *category, const char *name);
+        void End();
+
+        Tracer *tracer;
+        Tracer::Span span;
+    };
+}
+}
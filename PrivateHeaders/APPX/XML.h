@@ -15,5 +15,9 @@
 namespace osinside {
 namespace appx {
     std::string XMLEncodeString(const std::string &);
+
+    // Reverses XMLEncodeString. Also decodes numeric character references.
+    // Malformed references are kept as they are.
+    std::string XMLDecodeString(const std::string &);
 }
 }
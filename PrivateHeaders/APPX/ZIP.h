@@ -10,10 +10,17 @@
 
 #pragma once
 
+#include <APPX/BlockCache.h>
+#include <APPX/BlockDigest.h>
+#include <APPX/Compression.h>
+#include <APPX/Deflate.h>
 #include <APPX/Encode.h>
 #include <APPX/File.h>
 #include <APPX/Hash.h>
+#include <APPX/Memory.h>
+#include <APPX/Progress.h>
 #include <APPX/Sink.h>
+#include <APPX/ThreadPool.h>
 #include <APPX/XML.h>
 #include <algorithm>
 #include <cassert>
@@ -48,6 +55,24 @@ namespace appx {
         kArchiveExtractVersion = 45,
     };
 
+    // ZIP fields for sizes and offsets are 32 bits. Bigger values are stored
+    // in a ZIP64 extended information extra field, and the 32-bit field is
+    // set to kZIP64Placeholder.
+    enum : std::uint32_t
+    {
+        kZIP64Placeholder = 0xFFFFFFFF,
+    };
+
+    enum
+    {
+        kZIP64ExtraFieldTag = 0x0001,
+    };
+
+    inline bool NeedsZIP64(off_t value)
+    {
+        return value >= static_cast<off_t>(kZIP64Placeholder);
+    }
+
     enum class ZIPCompressionType : std::uint16_t
     {
         Store = 0,
@@ -89,6 +114,11 @@ namespace appx {
         ZIPCompressionType compressionType;
         off_t fileRecordHeaderOffset;
         std::uint32_t crc32;
+        // If true, the file record header stores the sizes in a ZIP64 extra
+        // field. Set when either size needs 64 bits, and for records whose
+        // header is written before their sizes are known (see
+        // StreamZIPFileEntry).
+        bool hasZIP64FileRecordHeader;
 
         // For normal files.
         std::vector<ZIPBlock> blocks;
@@ -106,6 +136,8 @@ namespace appx {
               compressionType(compressionType),
               fileRecordHeaderOffset(fileRecordHeaderOffset),
               crc32(crc32),
+              hasZIP64FileRecordHeader(NeedsZIP64(compressedSize) ||
+                                       NeedsZIP64(uncompressedSize)),
               blocks(blocks),
               sha256(sha256)
         {
@@ -123,7 +155,8 @@ namespace appx {
 
         off_t FileRecordHeaderSize() const
         {
-            return 30 + this->sanitizedFileName.size();
+            return 30 + this->sanitizedFileName.size() +
+                   this->FileRecordHeaderExtraSize();
         }
 
         off_t FileRecordSize() const
@@ -134,54 +167,133 @@ namespace appx {
         template <typename TSink>
         void WriteFileRecordHeader(TSink &sink) const
         {
+            bool isZIP64 = this->hasZIP64FileRecordHeader;
             std::uint8_t data[] = {
                 APPXUTIL_BYTES_4_LE(0x04034B50),  // Signature.
-                APPXUTIL_BYTES_2_LE(kFileExtractVersion),
+                APPXUTIL_BYTES_2_LE(this->ExtractVersion()),
                 APPXUTIL_BYTES_2_LE(0),  // Flags.
                 APPXUTIL_BYTES_2_LE(
                     static_cast<std::uint16_t>(this->compressionType)),
                 APPXUTIL_BYTES_2_LE(kFileTime), APPXUTIL_BYTES_2_LE(kFileDate),
-                APPXUTIL_BYTES_4_LE(this->crc32), APPXUTIL_BYTES_4_LE(this->compressedSize),
-                APPXUTIL_BYTES_4_LE(this->uncompressedSize),
+                APPXUTIL_BYTES_4_LE(this->crc32),
+                APPXUTIL_BYTES_4_LE(
+                    isZIP64 ? static_cast<std::uint32_t>(kZIP64Placeholder)
+                            : static_cast<std::uint32_t>(
+                                  this->compressedSize)),
+                APPXUTIL_BYTES_4_LE(
+                    isZIP64 ? static_cast<std::uint32_t>(kZIP64Placeholder)
+                            : static_cast<std::uint32_t>(
+                                  this->uncompressedSize)),
                 APPXUTIL_BYTES_2_LE(this->sanitizedFileName.size()),
-                APPXUTIL_BYTES_2_LE(0),  // Extra field length.
+                APPXUTIL_BYTES_2_LE(this->FileRecordHeaderExtraSize()),
             };
             sink.Write(sizeof(data), data);
             sink.Write(this->sanitizedFileName.size(),
                        reinterpret_cast<const std::uint8_t *>(
                            this->sanitizedFileName.c_str()));
+            if (isZIP64) {
+                // The local header must hold both sizes, in this order.
+                std::uint8_t extra[] = {
+                    APPXUTIL_BYTES_2_LE(kZIP64ExtraFieldTag),
+                    APPXUTIL_BYTES_2_LE(16),  // Size of the data below.
+                    APPXUTIL_BYTES_8_LE(this->uncompressedSize),
+                    APPXUTIL_BYTES_8_LE(this->compressedSize),
+                };
+                sink.Write(sizeof(extra), extra);
+            }
         }
 
         off_t DirectoryEntrySize() const
         {
-            return 46 + this->sanitizedFileName.size();
+            return 46 + this->sanitizedFileName.size() +
+                   this->DirectoryEntryExtraSize();
         }
 
         template <typename TSink>
         void WriteDirectoryEntry(TSink &sink) const
         {
+            bool uncompressedSizeIsZIP64 = NeedsZIP64(this->uncompressedSize);
+            bool compressedSizeIsZIP64 = NeedsZIP64(this->compressedSize);
+            bool offsetIsZIP64 = NeedsZIP64(this->fileRecordHeaderOffset);
             std::uint8_t data[] = {
                 APPXUTIL_BYTES_4_LE(0x02014B50),  // Signature.
                 APPXUTIL_BYTES_2_LE(kArchiverVersion),
-                APPXUTIL_BYTES_2_LE(kFileExtractVersion),
+                APPXUTIL_BYTES_2_LE(this->ExtractVersion()),
                 APPXUTIL_BYTES_2_LE(0),  // Flags.
                 APPXUTIL_BYTES_2_LE(
                     static_cast<std::uint16_t>(this->compressionType)),
                 APPXUTIL_BYTES_2_LE(kFileTime), APPXUTIL_BYTES_2_LE(kFileDate),
-                APPXUTIL_BYTES_4_LE(this->crc32), APPXUTIL_BYTES_4_LE(this->compressedSize),
-                APPXUTIL_BYTES_4_LE(this->uncompressedSize),
+                APPXUTIL_BYTES_4_LE(this->crc32),
+                APPXUTIL_BYTES_4_LE(
+                    compressedSizeIsZIP64
+                        ? static_cast<std::uint32_t>(kZIP64Placeholder)
+                        : static_cast<std::uint32_t>(this->compressedSize)),
+                APPXUTIL_BYTES_4_LE(
+                    uncompressedSizeIsZIP64
+                        ? static_cast<std::uint32_t>(kZIP64Placeholder)
+                        : static_cast<std::uint32_t>(this->uncompressedSize)),
                 APPXUTIL_BYTES_2_LE(this->sanitizedFileName.size()),
-                APPXUTIL_BYTES_2_LE(0),  // Extra field length.
+                APPXUTIL_BYTES_2_LE(this->DirectoryEntryExtraSize()),
                 APPXUTIL_BYTES_2_LE(0),  // File comment length.
                 APPXUTIL_BYTES_2_LE(0),  // Disk number start.
                 APPXUTIL_BYTES_2_LE(0),  // Internal file attributes.
                 APPXUTIL_BYTES_4_LE(0),  // External file attributes.
-                APPXUTIL_BYTES_4_LE(this->fileRecordHeaderOffset),
+                APPXUTIL_BYTES_4_LE(
+                    offsetIsZIP64
+                        ? static_cast<std::uint32_t>(kZIP64Placeholder)
+                        : static_cast<std::uint32_t>(
+                              this->fileRecordHeaderOffset)),
             };
             sink.Write(sizeof(data), data);
             sink.Write(this->sanitizedFileName.size(),
                        reinterpret_cast<const std::uint8_t *>(
                            this->sanitizedFileName.c_str()));
+            off_t extraSize = this->DirectoryEntryExtraSize();
+            if (extraSize > 0) {
+                // Only the fields which overflowed are present, in this
+                // order.
+                std::uint8_t extraHeader[] = {
+                    APPXUTIL_BYTES_2_LE(kZIP64ExtraFieldTag),
+                    APPXUTIL_BYTES_2_LE(extraSize - 4),
+                };
+                sink.Write(sizeof(extraHeader), extraHeader);
+                if (uncompressedSizeIsZIP64) {
+                    std::uint8_t field[] = {
+                        APPXUTIL_BYTES_8_LE(this->uncompressedSize)};
+                    sink.Write(sizeof(field), field);
+                }
+                if (compressedSizeIsZIP64) {
+                    std::uint8_t field[] = {
+                        APPXUTIL_BYTES_8_LE(this->compressedSize)};
+                    sink.Write(sizeof(field), field);
+                }
+                if (offsetIsZIP64) {
+                    std::uint8_t field[] = {
+                        APPXUTIL_BYTES_8_LE(this->fileRecordHeaderOffset)};
+                    sink.Write(sizeof(field), field);
+                }
+            }
+        }
+
+    private:
+        off_t FileRecordHeaderExtraSize() const
+        {
+            return this->hasZIP64FileRecordHeader ? 4 + 8 + 8 : 0;
+        }
+
+        off_t DirectoryEntryExtraSize() const
+        {
+            int fieldCount = NeedsZIP64(this->uncompressedSize) +
+                             NeedsZIP64(this->compressedSize) +
+                             NeedsZIP64(this->fileRecordHeaderOffset);
+            return fieldCount == 0 ? 0 : 4 + 8 * fieldCount;
+        }
+
+        std::uint16_t ExtractVersion() const
+        {
+            bool isZIP64 = this->hasZIP64FileRecordHeader ||
+                           NeedsZIP64(this->fileRecordHeaderOffset);
+            return isZIP64 ? kArchiveExtractVersion : kFileExtractVersion;
         }
     };
 
@@ -231,17 +343,22 @@ namespace appx {
         return manifestText;
     }
 
+    // Write the end of the central directory. offset is the position just
+    // past the last directory entry.
+    //
+    // The ZIP64 records are always written, and every field of the classic
+    // record which has a ZIP64 counterpart is set to its placeholder, so
+    // readers always use the 64-bit values.
     template <typename TSink>
     void WriteZIPEndOfCentralDirectoryRecord(
         TSink &sink, off_t offset, const std::vector<ZIPFileEntry> &entries)
     {
         std::uint64_t directoryEntriesSize = 0;
-        std::uint64_t fileRecordsSize = 0;
         for (const ZIPFileEntry &entry : entries) {
             directoryEntriesSize += entry.DirectoryEntrySize();
-            fileRecordsSize += entry.FileRecordSize();
         }
         off_t centralDirectoryEndOffset = offset;
+        off_t centralDirectoryStartOffset = offset - directoryEntriesSize;
         std::uint8_t data[] = {
             // ZIP64 central directory end.
             APPXUTIL_BYTES_4_LE(0x06064B50),  // Signature.
@@ -253,7 +370,7 @@ namespace appx {
             APPXUTIL_BYTES_8_LE(entries.size()),  // Entries in this disk.
             APPXUTIL_BYTES_8_LE(entries.size()),  // Entries in central directory.
             APPXUTIL_BYTES_8_LE(directoryEntriesSize),
-            APPXUTIL_BYTES_8_LE(fileRecordsSize),  // Offset of directory start.
+            APPXUTIL_BYTES_8_LE(centralDirectoryStartOffset),
             // ZIP64 central directory locator.
             APPXUTIL_BYTES_4_LE(0x07064B50),  // Signature.
             APPXUTIL_BYTES_4_LE(0),  // Index of disk with central directory end.
@@ -263,9 +380,10 @@ namespace appx {
             APPXUTIL_BYTES_4_LE(0x06054B50),  // Signature.
             APPXUTIL_BYTES_2_LE(0),           // Index of this disk.
             APPXUTIL_BYTES_2_LE(0),  // Index of disk with central directory start.
-            APPXUTIL_BYTES_4_LE(0xFFFFFFFF),  // Entries in this disk.
-            APPXUTIL_BYTES_4_LE(0xFFFFFFFF),  // Entries in central directory.
-            APPXUTIL_BYTES_4_LE(0xFFFFFFFF),  // Central directory start offset.
+            APPXUTIL_BYTES_2_LE(0xFFFF),      // Entries in this disk.
+            APPXUTIL_BYTES_2_LE(0xFFFF),      // Entries in central directory.
+            APPXUTIL_BYTES_4_LE(kZIP64Placeholder),  // Central directory size.
+            APPXUTIL_BYTES_4_LE(kZIP64Placeholder),  // Central directory start offset.
             APPXUTIL_BYTES_2_LE(0),           // Comment length.
         };
         sink.Write(sizeof(data), data);
@@ -353,6 +471,8 @@ namespace appx {
         ss << "</Types>";
 
         const std::string xml(ss.str());
+        // The stream's buffer and its copy.
+        MemoryCharge xmlMemory(MemoryComponent::XML, 2 * xml.capacity());
         const std::uint8_t *xmlBytes =
             reinterpret_cast<const std::uint8_t *>(xml.c_str());
         std::size_t xmlSize = xml.size();
@@ -409,6 +529,8 @@ namespace appx {
         }
         ss << "</BlockMap>";
         std::string xml = ss.str();
+        // The stream's buffer and its copy.
+        MemoryCharge xmlMemory(MemoryComponent::XML, 2 * xml.capacity());
         std::size_t xmlSize = xml.size();
         const std::uint8_t *xmlBytes =
             reinterpret_cast<const std::uint8_t *>(xml.c_str());
@@ -437,6 +559,8 @@ namespace appx {
         {
             std::string manifestText = _ManifestContentsAfterPopulatingOffsets(
                 this->inputFileName, this->otherEntries);
+            MemoryCharge manifestMemory(MemoryComponent::XML,
+                                        manifestText.capacity());
             sink.Write(
                 manifestText.size(),
                 reinterpret_cast<const std::uint8_t *>(manifestText.c_str()));
@@ -446,116 +570,169 @@ namespace appx {
         const std::vector<ZIPFileEntry> &otherEntries;
     };
 
-    // Write the ZIP file record header and data to sink, reading the data using
-    // dataCallback.
+    // Compress the data of a ZIP file record into dataSink, reading the data
+    // using dataCallback. No header is written; see WriteZIPFileRecord and
+    // StreamZIPFileEntry.
     //
     // dataCallback is called as a function:
     // template <typename TSink> void dataCallback(TSink &);
     //
     // dataCallback is called at most once.
-    template <typename TSink, typename TSource>
-    ZIPFileEntry WriteZIPFileEntry(TSink &sink, off_t offset,
-                                   const std::string &archiveFileName,
-                                   int compressionLevel, TSource &&dataCallback)
+    //
+    // The returned entry's fileRecordHeaderOffset is 0. The caller must set it
+    // once the position of the record in the archive is known.
+    //
+    // If pool is not null, blocks of the file are compressed concurrently on
+    // the pool's threads. If blockCache is not null, compressed blocks are
+    // reused from it. The compressed data is the same either way.
+    //
+    // The data cannot be sampled before it is compressed, so an Auto policy
+    // deflates. Use ResolveAutoCompression first to choose between Store and
+    // Deflate.
+    template <typename TDataSink, typename TSource>
+    ZIPFileEntry CompressZIPFileEntryTo(
+        TDataSink &dataSink, const std::string &archiveFileName,
+        const CompressionPolicy &compressionPolicy, ThreadPool *pool,
+        BlockCache *blockCache, TSource &&dataCallback)
     {
         std::uint32_t crc32;
         off_t uncompressedFileSize;
         off_t compressedFileSize;
-        std::vector<uint8_t> data;
         std::vector<ZIPBlock> blocks;
         ZIPCompressionType compressionType;
         {
-            if (_IsAPPXFile(archiveFileName)) {
-                compressionLevel = Z_NO_COMPRESSION;
-            }
-
-            CRC32Sink crc32Sink;
-            VectorSink dataSink(data);
-            // TODO(strager): Instead of writing the data to memory, write the
-            // header after the data.
-            if (compressionLevel == Z_NO_COMPRESSION) {
-                OffsetSink offsetSink;
-                auto chunkSink = MakeChunkSink(ZIPBlock::kSize,
-                                               []() { return SHA256Sink(); });
-                auto sink =
-                    MakeMultiSink(crc32Sink, offsetSink, dataSink, chunkSink);
-                dataCallback(sink);
-                chunkSink.Close();
-                for (const SHA256Sink &chunk : chunkSink.Chunks()) {
-                    blocks.push_back(ZIPBlock(chunk.SHA256()));
+            bool isStored =
+                compressionPolicy.method == CompressionPolicy::Method::Store ||
+                _IsAPPXFile(archiveFileName);
+
+            if (isStored) {
+                BlockDigestSink<TDataSink> blockSink(ZIPBlock::kSize,
+                                                     dataSink);
+                dataCallback(blockSink);
+                blockSink.Close();
+                for (const BlockDigest &block : blockSink.Blocks()) {
+                    blocks.push_back(ZIPBlock(block.sha256));
                 }
-                uncompressedFileSize = offsetSink.Offset();
+                uncompressedFileSize = blockSink.Size();
                 compressedFileSize = uncompressedFileSize;
                 compressionType = ZIPCompressionType::Store;
+                crc32 = blockSink.CRC32();
             } else {
                 OffsetSink compressedOffsetSink;
                 auto targetSink = MakeMultiSink(dataSink, compressedOffsetSink);
-                struct Chunk
-                {
-                    Chunk(DeflateSink<decltype(targetSink)> &deflateSink,
-                          OffsetSink &deflateOffsetSink)
-                        : deflateSink(&deflateSink),
-                          deflateOffsetSink(&deflateOffsetSink)
-                    {
-                        this->startOffset = this->deflateOffsetSink->Offset();
-                    }
-
-                    void Write(std::size_t size, const std::uint8_t *bytes)
-                    {
-                        this->sha256Sink.Write(size, bytes);
-                        this->deflateSink->Write(size, bytes);
-                    }
-
-                    void Close()
-                    {
-                        this->deflateSink->Flush();
-                        this->endOffset = this->deflateOffsetSink->Offset();
-                    }
-
-                    off_t CompressedSize() const
-                    {
-                        return this->endOffset - this->startOffset;
-                    }
-
-                    SHA256Hash SHA256() const
-                    {
-                        return this->sha256Sink.SHA256();
-                    }
-
-                private:
-                    SHA256Sink sha256Sink;
-                    DeflateSink<decltype(targetSink)> *deflateSink;
-                    OffsetSink *deflateOffsetSink;
-                    off_t startOffset;
-                    off_t endOffset;
-                };
-                auto deflateSink =
-                    MakeDeflateSink(Z_BEST_COMPRESSION, targetSink);
-                auto chunkSink = MakeChunkSink(
-                    ZIPBlock::kSize, [&deflateSink, &compressedOffsetSink]() {
-                        return Chunk(deflateSink, compressedOffsetSink);
-                    });
-                OffsetSink uncompressedOffsetSink;
-                auto sink =
-                    MakeMultiSink(chunkSink, uncompressedOffsetSink, crc32Sink);
-                dataCallback(sink);
-                chunkSink.Close();
+                BlockDeflateSink<decltype(targetSink)> deflateSink(
+                    compressionPolicy.level, compressionPolicy.strategy,
+                    ZIPBlock::kSize, pool, blockCache, targetSink);
+                dataCallback(deflateSink);
                 deflateSink.Close();
-                for (const Chunk &chunk : chunkSink.Chunks()) {
+                for (const DeflatedBlock &block : deflateSink.Blocks()) {
                     blocks.push_back(
-                        ZIPBlock(chunk.SHA256(), chunk.CompressedSize()));
+                        ZIPBlock(block.sha256, block.compressedSize));
                 }
-                uncompressedFileSize = uncompressedOffsetSink.Offset();
+                uncompressedFileSize = deflateSink.UncompressedSize();
                 compressedFileSize = compressedOffsetSink.Offset();
                 compressionType = ZIPCompressionType::Deflate;
+                crc32 = deflateSink.CRC32();
             }
-            crc32 = crc32Sink.CRC32();
         }
-        ZIPFileEntry entry(archiveFileName, compressedFileSize,
-                           uncompressedFileSize, compressionType, offset, crc32,
-                           blocks, SHA256Hash());
+        return ZIPFileEntry(archiveFileName, compressedFileSize,
+                            uncompressedFileSize, compressionType, 0, crc32,
+                            blocks, SHA256Hash());
+    }
+
+    // Compress the data of a ZIP file record into memory. See
+    // CompressZIPFileEntryTo.
+    template <typename TSource>
+    ZIPFileEntry CompressZIPFileEntry(
+        std::vector<std::uint8_t> &data, const std::string &archiveFileName,
+        const CompressionPolicy &compressionPolicy, ThreadPool *pool,
+        BlockCache *blockCache, TSource &&dataCallback)
+    {
+        VectorSink dataSink(data);
+        return CompressZIPFileEntryTo(dataSink, archiveFileName,
+                                      compressionPolicy, pool, blockCache,
+                                      std::forward<TSource>(dataCallback));
+    }
+
+    // Write a ZIP file record header and data previously produced by
+    // CompressZIPFileEntry.
+    template <typename TSink>
+    void WriteZIPFileRecord(TSink &sink, const ZIPFileEntry &entry,
+                            const std::vector<std::uint8_t> &data)
+    {
         entry.WriteFileRecordHeader(sink);
         sink.Write(data.size(), data.data());
+    }
+
+    // Write the ZIP file record header and data to sink, reading the data using
+    // dataCallback.
+    //
+    // See CompressZIPFileEntry for details on dataCallback.
+    template <typename TSink, typename TSource>
+    ZIPFileEntry WriteZIPFileEntry(TSink &sink, off_t offset,
+                                   const std::string &archiveFileName,
+                                   const CompressionPolicy &compressionPolicy,
+                                   TSource &&dataCallback)
+    {
+        std::vector<std::uint8_t> data;
+        ZIPFileEntry entry = CompressZIPFileEntry(
+            data, archiveFileName, compressionPolicy, nullptr, nullptr,
+            std::forward<TSource>(dataCallback));
+        entry.fileRecordHeaderOffset = offset;
+        WriteZIPFileRecord(sink, entry, data);
+        return entry;
+    }
+
+    // Write the ZIP file record header and data to sink without holding the
+    // data in memory, reading the data using dataCallback.
+    //
+    // The CRC32 and sizes are not known until all data is compressed, so the
+    // header is first written with placeholder values. Once the data is
+    // written, the final header is handed to patchCallback to overwrite the
+    // placeholder:
+    //
+    // void patchCallback(off_t offset, std::size_t size,
+    //                    const std::uint8_t *bytes);
+    //
+    // The size of the header depends on whether it needs a ZIP64 extra field,
+    // so this is decided up front from sizeHint, the expected uncompressed
+    // size of the data. If sizeHint is negative, the size is unknown and a
+    // ZIP64 extra field is always written.
+    //
+    // See CompressZIPFileEntryTo for details on dataCallback.
+    template <typename TSink, typename TPatch, typename TSource>
+    ZIPFileEntry StreamZIPFileEntry(TSink &sink, TPatch &&patchCallback,
+                                    off_t offset,
+                                    const std::string &archiveFileName,
+                                    off_t sizeHint,
+                                    const CompressionPolicy &compressionPolicy,
+                                    ThreadPool *pool, BlockCache *blockCache,
+                                    TSource &&dataCallback)
+    {
+        ZIPFileEntry placeholder(archiveFileName, 0, offset, 0, {},
+                                 SHA256Hash());
+        // Leave room for DEFLATE's worst-case expansion of incompressible
+        // data.
+        placeholder.hasZIP64FileRecordHeader =
+            sizeHint < 0 || NeedsZIP64(sizeHint + sizeHint / 256 + 1024);
+        placeholder.WriteFileRecordHeader(sink);
+        ZIPFileEntry entry = CompressZIPFileEntryTo(
+            sink, archiveFileName, compressionPolicy, pool, blockCache,
+            std::forward<TSource>(dataCallback));
+        entry.fileRecordHeaderOffset = offset;
+        if (entry.hasZIP64FileRecordHeader &&
+            !placeholder.hasZIP64FileRecordHeader) {
+            throw std::runtime_error(archiveFileName +
+                                     ": file grew while it was archived");
+        }
+        entry.hasZIP64FileRecordHeader = placeholder.hasZIP64FileRecordHeader;
+
+        std::vector<std::uint8_t> header;
+        VectorSink headerSink(header);
+        entry.WriteFileRecordHeader(headerSink);
+        assert(header.size() ==
+               static_cast<std::size_t>(placeholder.FileRecordHeaderSize()));
+        patchCallback(offset, header.size(), header.data());
         return entry;
     }
 
@@ -566,23 +743,74 @@ namespace appx {
         void operator()(TSink &sink) const
         {
             FilePtr file = Open(this->inputFileName, "rb");
-            Copy(file, sink);
+            auto progressSink = MakeProgressSink(sink);
+            CopyFile(file, progressSink);
         }
 
         const std::string &inputFileName;
     };
 
+    // Compress the data of a ZIP file record, reading the data from a file.
+    // An Auto policy is resolved by sampling the file.
+    inline ZIPFileEntry CompressZIPFileEntry(
+        std::vector<std::uint8_t> &data, const std::string &inputFileName,
+        const std::string &archiveFileName,
+        const CompressionPolicy &compressionPolicy, ThreadPool *pool,
+        BlockCache *blockCache)
+    {
+        return CompressZIPFileEntry(
+            data, archiveFileName,
+            ResolveAutoCompression(compressionPolicy, inputFileName), pool,
+            blockCache, WriteZIPFileEntryFunc{inputFileName});
+    }
+
+    // Compress the data of a ZIP file record of at most ZIPBlock::kSize
+    // bytes which is already in memory. The result is the same as
+    // CompressZIPFileEntry's, but the data is digested and compressed as a
+    // single block, without setting up sinks for it. An Auto policy is
+    // resolved by sampling bytes, which is one whole sample.
+    ZIPFileEntry CompressSmallZIPFileEntry(
+        std::vector<std::uint8_t> &data, const std::string &archiveFileName,
+        const CompressionPolicy &compressionPolicy, BlockCache *blockCache,
+        std::size_t size, const std::uint8_t *bytes);
+
+    // Helper for HashStoredZIPFileEntry.
+    struct WriteMappingFunc
+    {
+        template <typename TSink>
+        void operator()(TSink &sink) const
+        {
+            auto progressSink = MakeProgressSink(sink);
+            WriteMapping(this->mapping, progressSink);
+        }
+
+        const MappedFile &mapping;
+    };
+
+    // Computes the entry of a stored ZIP file record from a mapping of the
+    // file, without copying the data anywhere. The caller writes the data,
+    // e.g. with CopyFileRange.
+    inline ZIPFileEntry HashStoredZIPFileEntry(
+        const std::string &archiveFileName, const MappedFile &mapping)
+    {
+        OffsetSink dataSink;
+        return CompressZIPFileEntryTo(dataSink, archiveFileName,
+                                      CompressionPolicy::Store(), nullptr,
+                                      nullptr, WriteMappingFunc{mapping});
+    }
+
     // Write the ZIP file record header and data to sink, reading the data from
     // a file.
     template <typename TSink>
     ZIPFileEntry WriteZIPFileEntry(TSink &sink, off_t offset,
                                    const std::string &inputFileName,
                                    const std::string &archiveFileName,
-                                   int compressionLevel)
+                                   const CompressionPolicy &compressionPolicy)
     {
-        return WriteZIPFileEntry(sink, offset, archiveFileName,
-                                 compressionLevel,
-                                 WriteZIPFileEntryFunc{inputFileName});
+        return WriteZIPFileEntry(
+            sink, offset, archiveFileName,
+            ResolveAutoCompression(compressionPolicy, inputFileName),
+            WriteZIPFileEntryFunc{inputFileName});
     }
 }
 }
@@ -8,13 +8,31 @@
 // Portions of this code was previously licensed under a BSD-style license.
 // See the LICENSE-BSD file in the root directory of this source tree for details.
 
+#include <APPX/APPX.h>
+#include <APPX/BasePackage.h>
+#include <APPX/Compression.h>
 #include <APPX/File.h>
+#include <APPX/Memory.h>
+#include <APPX/OutputFile.h>
+#include <APPX/Prefetch.h>
+#include <APPX/Progress.h>
 #include <APPX/Sign.h>
 #include <APPX/Sink.h>
+#include <APPX/SmallFileReader.h>
+#include <APPX/ThreadPool.h>
+#include <APPX/Trace.h>
 #include <APPX/ZIP.h>
+#include <algorithm>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
+#include <exception>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
 #include <unordered_map>
 #include <vector>
 
@@ -53,6 +71,7 @@ namespace appx {
             std::uint32_t crc32;
             off_t uncompressedSize;
             {
+                MemoryScope memoryScope(MemoryComponent::Signing);
                 OpenSSLPtr<PKCS7, PKCS7_free> signature =
                     Sign(certPath, digests);
                 std::vector<std::uint8_t> signatureData =
@@ -83,18 +102,781 @@ namespace appx {
                        compressedSignatureData.data());
             return entry;
         }
+
+        // A file to be stored in the ZIP, in the order it is written.
+        struct InputFile
+        {
+            const std::string *archiveName;
+            const std::string *fileName;
+            // Negative if the size is unknown (e.g. for a pipe).
+            off_t size;
+            // If true, the file's data is streamed into the archive rather
+            // than compressed into memory first.
+            bool isStreamed;
+            CompressionPolicy compressionPolicy;
+            // If not null, the file's entry in the base package. It is
+            // reused if the file did not change (see MatchesBaseEntry).
+            const BaseEntry *baseEntry;
+            // If not null, the file's status from when it was listed.
+            const FileStatus *status;
+        };
+
+        // Returns the base package's entry for a file, if the entry is
+        // compressed the way the file would be.
+        const BaseEntry *FindBaseEntry(
+            const BasePackage *base, const std::string &archiveName,
+            const CompressionPolicy &compressionPolicy)
+        {
+            const BaseEntry *baseEntry =
+                base ? base->Find(archiveName) : nullptr;
+            if (!baseEntry ||
+                compressionPolicy.method == CompressionPolicy::Method::Auto) {
+                return baseEntry;
+            }
+            bool isStored =
+                compressionPolicy.method == CompressionPolicy::Method::Store ||
+                _IsAPPXFile(archiveName);
+            bool baseIsStored =
+                baseEntry->compressionType == ZIPCompressionType::Store;
+            return isStored == baseIsStored ? baseEntry : nullptr;
+        }
+
+        // Returns true if the file can be copied from the base package.
+        bool CanReuseBaseEntry(const InputFile &input)
+        {
+            return input.baseEntry &&
+                   MatchesBaseEntry(*input.baseEntry, *input.fileName);
+        }
+
+        // Files at least this big are streamed into the archive, so memory
+        // use does not grow with the size of the input files.
+        enum : off_t
+        {
+            kStreamedEntryThreshold = 1 << 20
+        };
+
+        const CompressionPolicy &
+        GetCompressionPolicy(const std::string &archiveName,
+                             const LocalFile &localFile,
+                             const CompressionPolicies &compressionPolicies)
+        {
+            return localFile.hasCompressionPolicy
+                       ? localFile.compressionPolicy
+                       : compressionPolicies.ForArchiveName(archiveName);
+        }
+
+        InputFile MakeInputFile(const std::string &archiveName,
+                                const LocalFile &localFile, bool canStream,
+                                const CompressionPolicies &compressionPolicies,
+                                const BasePackage *base)
+        {
+            const std::string &fileName = localFile.path;
+            const FileStatus *status =
+                localFile.hasStatus ? &localFile.status : nullptr;
+            const CompressionPolicy &compressionPolicy = GetCompressionPolicy(
+                archiveName, localFile, compressionPolicies);
+            const BaseEntry *baseEntry =
+                FindBaseEntry(base, archiveName, compressionPolicy);
+            struct stat buffer;
+            mode_t mode;
+            off_t size;
+            if (status) {
+                mode = status->mode;
+                size = status->size;
+            } else if (stat(fileName.c_str(), &buffer) == 0) {
+                mode = buffer.st_mode;
+                size = buffer.st_size;
+            } else {
+                // Opening the file will report the error.
+                return InputFile{&archiveName, &fileName, 0, false,
+                                 compressionPolicy, baseEntry, nullptr};
+            }
+            // The size of pipes and devices is unknown, so assume they are
+            // big.
+            if (!S_ISREG(mode)) {
+                return InputFile{&archiveName, &fileName, -1, canStream,
+                                 compressionPolicy, nullptr, status};
+            }
+            bool isStreamed = canStream && size >= kStreamedEntryThreshold;
+            return InputFile{&archiveName, &fileName, size, isStreamed,
+                             compressionPolicy, baseEntry, status};
+        }
+
+        // Compares archive names directory by directory: a directory's files
+        // come before its subdirectories, and directories are in the order
+        // of a depth-first walk.
+        bool IsBeforeInDirectoryOrder(const std::string &a,
+                                      const std::string &b)
+        {
+            std::size_t aSlash = a.rfind('/');
+            std::size_t bSlash = b.rfind('/');
+            std::size_t aDirectorySize = aSlash == std::string::npos ? 0 : aSlash;
+            std::size_t bDirectorySize = bSlash == std::string::npos ? 0 : bSlash;
+            // '/' sorts before every other byte, so a directory's
+            // subdirectories come right after it (e.g. a/b before a-b).
+            auto isBefore = [](char x, char y) {
+                int xRank = x == '/' ? 0 : static_cast<unsigned char>(x) + 1;
+                int yRank = y == '/' ? 0 : static_cast<unsigned char>(y) + 1;
+                return xRank < yRank;
+            };
+            if (std::lexicographical_compare(
+                    a.begin(), a.begin() + aDirectorySize, b.begin(),
+                    b.begin() + bDirectorySize, isBefore)) {
+                return true;
+            }
+            if (std::lexicographical_compare(
+                    b.begin(), b.begin() + bDirectorySize, a.begin(),
+                    a.begin() + aDirectorySize, isBefore)) {
+                return false;
+            }
+            return a.compare(aDirectorySize, std::string::npos, b,
+                             bDirectorySize, std::string::npos) < 0;
+        }
+
+        // Where a file's data is on disk, for EntryOrder::Physical.
+        struct PhysicalLocation
+        {
+            dev_t device;
+            // Files whose offset is unknown come last, by inode.
+            bool hasOffset;
+            std::uint64_t offset;
+            ino_t inode;
+
+            explicit PhysicalLocation(const InputFile &input)
+                : device(0), hasOffset(false), offset(0), inode(0)
+            {
+                struct stat status;
+                if (input.status) {
+                    this->device = input.status->device;
+                    this->inode = input.status->inode;
+                } else if (stat(input.fileName->c_str(), &status) == 0) {
+                    this->device = status.st_dev;
+                    this->inode = status.st_ino;
+                }
+                this->hasOffset =
+                    GetPhysicalOffset(*input.fileName, this->offset);
+            }
+
+            bool operator<(const PhysicalLocation &other) const
+            {
+                if (this->device != other.device) {
+                    return this->device < other.device;
+                }
+                if (this->hasOffset != other.hasOffset) {
+                    return this->hasOffset;
+                }
+                if (this->offset != other.offset) {
+                    return this->offset < other.offset;
+                }
+                return this->inode < other.inode;
+            }
+        };
+
+        void SortInputFiles(std::vector<InputFile> &inputs, EntryOrder order)
+        {
+            auto isBeforeByName = [](const InputFile &a, const InputFile &b) {
+                return *a.archiveName < *b.archiveName;
+            };
+            switch (order) {
+                case EntryOrder::Name:
+                    std::sort(inputs.begin(), inputs.end(), isBeforeByName);
+                    break;
+                case EntryOrder::Directory:
+                    std::sort(inputs.begin(), inputs.end(),
+                              [](const InputFile &a, const InputFile &b) {
+                                  return IsBeforeInDirectoryOrder(
+                                      *a.archiveName, *b.archiveName);
+                              });
+                    break;
+                case EntryOrder::Physical: {
+                    // Ties (e.g. hard links) are broken by name.
+                    std::sort(inputs.begin(), inputs.end(), isBeforeByName);
+                    std::vector<std::pair<PhysicalLocation, InputFile>> located;
+                    located.reserve(inputs.size());
+                    for (const InputFile &input : inputs) {
+                        located.emplace_back(PhysicalLocation(input),
+                                             input);
+                    }
+                    std::stable_sort(
+                        located.begin(), located.end(),
+                        [](const std::pair<PhysicalLocation, InputFile> &a,
+                           const std::pair<PhysicalLocation, InputFile> &b) {
+                            return a.first < b.first;
+                        });
+                    for (std::size_t i = 0; i < inputs.size(); ++i) {
+                        inputs[i] = located[i].second;
+                    }
+                    break;
+                }
+            }
+        }
+
+        // A stored file whose data is copied into the archive by the kernel
+        // (see CopyFileRange). Its hashes are computed from a read-only
+        // mapping, so the data is never copied through a write buffer.
+        struct StoredInputFile
+        {
+            FilePtr file;
+            std::unique_ptr<MappedFile> mapping;
+            std::unique_ptr<ZIPFileEntry> entry;
+        };
+
+        // Returns null if the file is compressed or cannot be mapped; such
+        // files are written through the sinks instead.
+        std::unique_ptr<StoredInputFile> PrepareStoredInputFile(
+            const InputFile &input, const CompressionPolicy &compressionPolicy)
+        {
+            bool isStored =
+                compressionPolicy.method == CompressionPolicy::Method::Store ||
+                _IsAPPXFile(*input.archiveName);
+            // Pipes cannot be mapped, and must only be opened once.
+            if (!isStored || input.size <= 0) {
+                return nullptr;
+            }
+            std::unique_ptr<StoredInputFile> stored(new StoredInputFile());
+            stored->file = Open(*input.fileName, "rb");
+            stored->mapping.reset(new MappedFile(stored->file));
+            if (!stored->mapping->IsMapped()) {
+                return nullptr;
+            }
+            stored->entry.reset(new ZIPFileEntry(
+                HashStoredZIPFileEntry(*input.archiveName, *stored->mapping)));
+            return stored;
+        }
+
+        // Annotates an entry's trace span with the record which was written
+        // for it.
+        void AnnotateEntrySpan(TraceSpan &span, const InputFile &input,
+                               const ZIPFileEntry &entry)
+        {
+            if (!span.IsEnabled()) {
+                return;
+            }
+            span.AddArgument("path", *input.fileName);
+            span.AddArgument("archive_name", *input.archiveName);
+            span.AddArgument("method",
+                             entry.compressionType == ZIPCompressionType::Store
+                                 ? "store"
+                                 : "deflate");
+            span.SetBytes(entry.uncompressedSize, entry.compressedSize);
+            if (entry.uncompressedSize > 0) {
+                span.AddArgument(
+                    "ratio", static_cast<double>(entry.compressedSize) /
+                                 static_cast<double>(entry.uncompressedSize));
+            }
+        }
+
+        // An entry prepared for writing, possibly by a worker thread.
+        // Depending on how the entry is written, one of these is set:
+        // * isReused: the entry is copied from the base package.
+        // * stored: the entry is copied from the input file.
+        // * entry: the entry was compressed into data.
+        struct PendingZIPFileEntry
+        {
+            std::vector<std::uint8_t> data;
+            MemoryCharge dataMemory{MemoryComponent::EntryBuffers};
+            std::unique_ptr<ZIPFileEntry> entry;
+            std::unique_ptr<StoredInputFile> stored;
+            bool isReused = false;
+            std::exception_ptr error;
+            bool done = false;
+        };
+
+        // Files of at most one ZIP block, which are read and compressed in
+        // one go (see PrepareSmallZIPFileEntry).
+        bool IsSmallInputFile(const InputFile &input)
+        {
+            return !input.isStreamed && input.size >= 0 &&
+                   input.size <= ZIPBlock::kSize;
+        }
+
+        // Marks inputs in SmallFileReadAhead which are not read ahead.
+        const std::size_t kNotReadAhead = std::size_t(-1);
+
+        // Reads the small files among inputs ahead of the entries which
+        // need them (see SmallFileReader). Files which may be copied from
+        // the base package are left out, as they might not be read at all.
+        class SmallFileReadAhead
+        {
+        public:
+            // readAhead must cover every entry which may wait for its file at
+            // once, or they could wait for each other.
+            SmallFileReadAhead(const std::vector<InputFile> &inputs,
+                               std::size_t readAhead)
+                : readerIndexes(inputs.size(), kNotReadAhead)
+            {
+                std::vector<const std::string *> paths;
+                for (std::size_t i = 0; i < inputs.size(); ++i) {
+                    if (IsSmallInputFile(inputs[i]) && !inputs[i].baseEntry) {
+                        this->readerIndexes[i] = paths.size();
+                        paths.push_back(inputs[i].fileName);
+                    }
+                }
+                if (!paths.empty()) {
+                    this->reader.reset(new SmallFileReader(
+                        std::move(paths), ZIPBlock::kSize, readAhead));
+                }
+            }
+
+            bool IsReadAhead(std::size_t index) const
+            {
+                return this->readerIndexes[index] != kNotReadAhead;
+            }
+
+            // See SmallFileReader::Take.
+            bool Take(std::size_t index, std::vector<std::uint8_t> &data)
+            {
+                return this->reader->Take(this->readerIndexes[index], data);
+            }
+
+        private:
+            std::vector<std::size_t> readerIndexes;
+            std::unique_ptr<SmallFileReader> reader;
+        };
+
+        // How far past the entry being archived input files are read ahead
+        // into the page cache (see InputPrefetcher).
+        const off_t kPrefetchWindowSize = 64 << 20;
+
+        // Prefetches the inputs which SmallFileReadAhead does not read.
+        std::vector<InputPrefetcher::Input>
+        MakePrefetchInputs(const std::vector<InputFile> &inputs)
+        {
+            std::vector<InputPrefetcher::Input> prefetchInputs;
+            prefetchInputs.reserve(inputs.size());
+            for (const InputFile &input : inputs) {
+                bool isReadAhead =
+                    IsSmallInputFile(input) && !input.baseEntry;
+                prefetchInputs.push_back(
+                    {input.fileName, input.size, !isReadAhead});
+            }
+            return prefetchInputs;
+        }
+
+        // Prepares the entry of a small file without the per-file setup of
+        // the general path: the file is read at once, either ahead of time
+        // or with a single read into a buffer which the thread reuses, then
+        // digested and compressed as one block. Returns false if the file
+        // must be prepared the general way (e.g. it grew past one block
+        // since it was listed).
+        bool PrepareSmallZIPFileEntry(const InputFile &input, std::size_t index,
+                                      SmallFileReadAhead &readAhead,
+                                      BlockCache *blockCache,
+                                      PendingZIPFileEntry &result)
+        {
+            // One byte more than a block, to tell whether the file grew.
+            thread_local std::unique_ptr<std::uint8_t[]> buffer(
+                new std::uint8_t[ZIPBlock::kSize + 1]);
+            std::vector<std::uint8_t> readAheadData;
+            const std::uint8_t *bytes;
+            std::size_t size;
+            if (readAhead.IsReadAhead(index)) {
+                // Mostly waiting for SmallFileReader, if at all.
+                TraceSpan span("read", "SmallFileReader::Take");
+                if (!readAhead.Take(index, readAheadData)) {
+                    return false;
+                }
+                bytes = readAheadData.data();
+                size = readAheadData.size();
+                span.SetBytes(static_cast<std::int64_t>(size), 0);
+            } else {
+                TraceSpan span("read", "ReadSmallFile");
+                bytes = buffer.get();
+                size = ReadSmallFile(*input.fileName, ZIPBlock::kSize + 1,
+                                     buffer.get());
+                if (size > ZIPBlock::kSize) {
+                    return false;
+                }
+                span.SetBytes(static_cast<std::int64_t>(size), 0);
+            }
+            if (Progress *progress = GetProgress()) {
+                progress->AddBytesRead(size);
+            }
+            result.entry.reset(new ZIPFileEntry(CompressSmallZIPFileEntry(
+                result.data, *input.archiveName, input.compressionPolicy,
+                blockCache, size, bytes)));
+            result.dataMemory.Set(result.data.capacity());
+            return true;
+        }
+
+        // index is the index of input in the inputs given to readAhead.
+        void PrepareZIPFileEntry(const InputFile &input, std::size_t index,
+                                 SmallFileReadAhead &readAhead,
+                                 ThreadPool *pool, BlockCache *blockCache,
+                                 PendingZIPFileEntry &result)
+        {
+            if (Progress *progress = GetProgress()) {
+                progress->StartEntry(*input.archiveName, input.size);
+            }
+            if (CanReuseBaseEntry(input)) {
+                result.isReused = true;
+                return;
+            }
+            TraceSpan span("compress", *input.archiveName);
+            if (IsSmallInputFile(input) &&
+                PrepareSmallZIPFileEntry(input, index, readAhead, blockCache,
+                                         result)) {
+                AnnotateEntrySpan(span, input, *result.entry);
+                return;
+            }
+            CompressionPolicy compressionPolicy = ResolveAutoCompression(
+                input.compressionPolicy, *input.fileName);
+            result.stored = PrepareStoredInputFile(input, compressionPolicy);
+            if (result.stored) {
+                AnnotateEntrySpan(span, input, *result.stored->entry);
+                return;
+            }
+            result.entry.reset(new ZIPFileEntry(
+                CompressZIPFileEntry(result.data, *input.fileName,
+                                     *input.archiveName, compressionPolicy,
+                                     pool, blockCache)));
+            result.dataMemory.Set(result.data.capacity());
+            AnnotateEntrySpan(span, input, *result.entry);
+        }
+
+        // Writes ZIP file records to the archive, hashing them into axpcSink.
+        template <typename TZIPSink>
+        class ZIPRecordWriter
+        {
+        public:
+            ZIPRecordWriter(OutputFile &zip, TZIPSink &zipSink,
+                            OffsetSink &offsetSink, SHA256Sink &axpcSink,
+                            const BasePackage *base)
+                : zip(zip),
+                  zipSink(zipSink),
+                  offsetSink(offsetSink),
+                  axpcSink(axpcSink),
+                  base(base)
+            {
+            }
+
+            // Writes a record prepared with PrepareZIPFileEntry.
+            ZIPFileEntry Write(const InputFile &input,
+                               PendingZIPFileEntry &pending)
+            {
+                TraceSpan span("write", *input.archiveName);
+                ZIPFileEntry entry =
+                    pending.isReused
+                        ? this->Reuse(input)
+                        : pending.stored ? this->CopyStored(*pending.stored)
+                                         : this->WriteCompressed(pending);
+                AnnotateEntrySpan(span, input, entry);
+                this->ReportFinished(input, entry);
+                span.AddArgument("how", pending.isReused
+                                            ? "reused"
+                                            : pending.stored ? "copied"
+                                                             : "compressed");
+                return entry;
+            }
+
+            // Writes a record without holding its data in memory.
+            ZIPFileEntry Stream(const InputFile &input, ThreadPool *pool,
+                                BlockCache *blockCache)
+            {
+                TraceSpan span("write", *input.archiveName);
+                if (Progress *progress = GetProgress()) {
+                    progress->StartEntry(*input.archiveName, input.size);
+                }
+                ZIPFileEntry entry = this->StreamUntraced(input, pool,
+                                                          blockCache);
+                AnnotateEntrySpan(span, input, entry);
+                this->ReportFinished(input, entry);
+                span.AddArgument("how", "streamed");
+                return entry;
+            }
+
+        private:
+            void ReportFinished(const InputFile &input,
+                                const ZIPFileEntry &entry)
+            {
+                if (Progress *progress = GetProgress()) {
+                    progress->FinishEntry(
+                        *input.archiveName, entry.uncompressedSize,
+                        entry.compressedSize, this->offsetSink.Offset());
+                }
+            }
+
+            ZIPFileEntry StreamUntraced(const InputFile &input,
+                                        ThreadPool *pool,
+                                        BlockCache *blockCache)
+            {
+                if (CanReuseBaseEntry(input)) {
+                    return this->Reuse(input);
+                }
+                CompressionPolicy compressionPolicy = ResolveAutoCompression(
+                    input.compressionPolicy, *input.fileName);
+                std::unique_ptr<StoredInputFile> stored =
+                    PrepareStoredInputFile(input, compressionPolicy);
+                if (stored) {
+                    return this->CopyStored(*stored);
+                }
+
+                OutputFile &zip = this->zip;
+                off_t offset = this->offsetSink.Offset();
+                ZIPFileEntry entry = StreamZIPFileEntry(
+                    this->zipSink,
+                    [&zip](off_t headerOffset, std::size_t size,
+                           const std::uint8_t *bytes) {
+                        zip.WriteAt(headerOffset, size, bytes);
+                    },
+                    offset, *input.archiveName, input.size, compressionPolicy,
+                    pool, blockCache, WriteZIPFileEntryFunc{*input.fileName});
+                // The header was patched after the data was written, so read
+                // the record back to hash it in order.
+                zip.CopyRange(offset, entry.FileRecordSize(), this->axpcSink);
+                return entry;
+            }
+
+            // Writes a record compressed by PrepareZIPFileEntry.
+            ZIPFileEntry WriteCompressed(PendingZIPFileEntry &pending)
+            {
+                ZIPFileEntry entry = std::move(*pending.entry);
+                entry.fileRecordHeaderOffset = this->offsetSink.Offset();
+                auto sink = MakeMultiSink(this->zipSink, this->axpcSink);
+                WriteZIPFileRecord(sink, entry, pending.data);
+                return entry;
+            }
+
+            // Writes a record whose data is copied from the base package.
+            // See CanReuseBaseEntry.
+            ZIPFileEntry Reuse(const InputFile &input)
+            {
+                const BaseEntry &baseEntry = *input.baseEntry;
+                ZIPFileEntry entry =
+                    baseEntry.ToZIPFileEntry(*input.archiveName);
+                // The input was only compared with the base package, but
+                // counts as done.
+                if (Progress *progress = GetProgress()) {
+                    progress->AddBytesRead(entry.uncompressedSize);
+                }
+                entry.fileRecordHeaderOffset = this->offsetSink.Offset();
+                auto sink = MakeMultiSink(this->zipSink, this->axpcSink);
+                entry.WriteFileRecordHeader(sink);
+
+                CopyRange(this->base->File(), baseEntry.dataOffset,
+                          entry.compressedSize, this->axpcSink);
+                this->zip.CopyFrom(this->base->File(), baseEntry.dataOffset,
+                                   entry.compressedSize);
+                this->offsetSink = OffsetSink(this->offsetSink.Offset() +
+                                              entry.compressedSize);
+                return entry;
+            }
+
+            // Writes a record whose data is copied from the input file. See
+            // PrepareStoredInputFile.
+            ZIPFileEntry CopyStored(StoredInputFile &stored)
+            {
+                ZIPFileEntry entry = std::move(*stored.entry);
+                entry.fileRecordHeaderOffset = this->offsetSink.Offset();
+                auto sink = MakeMultiSink(this->zipSink, this->axpcSink);
+                entry.WriteFileRecordHeader(sink);
+
+                WriteMapping(*stored.mapping, this->axpcSink);
+                this->zip.CopyFrom(stored.file, 0, entry.compressedSize);
+                this->offsetSink = OffsetSink(this->offsetSink.Offset() +
+                                              entry.compressedSize);
+                return entry;
+            }
+
+            OutputFile &zip;
+            TZIPSink &zipSink;
+            OffsetSink &offsetSink;
+            SHA256Sink &axpcSink;
+            const BasePackage *base;
+        };
+
+        enum
+        {
+            // How many batches per job may be compressed ahead of the entry
+            // which is next to be written. Bounds the memory held by
+            // compressed entries waiting for their turn.
+            kReorderWindowPerJob = 4,
+            // Consecutive small files are prepared by one pool task, so the
+            // cost of a task is shared by many tiny entries. A batch is at
+            // most this many files and this many bytes.
+            kMaxBatchEntries = 64,
+            kMaxBatchSize = 1 << 20,
+            // How many small files may be read ahead of the entry which is
+            // next to be compressed, at least.
+            kMinReadAheadFiles = 512,
+        };
+
+        // Returns the end of the batch of entries which starts at begin:
+        // either a run of small files, or a single other file.
+        std::size_t EndOfBatch(const std::vector<InputFile> &inputs,
+                               std::size_t begin)
+        {
+            if (!IsSmallInputFile(inputs[begin])) {
+                return begin + 1;
+            }
+            std::size_t end = begin;
+            off_t batchSize = 0;
+            while (end < inputs.size() && end - begin < kMaxBatchEntries &&
+                   IsSmallInputFile(inputs[end]) &&
+                   batchSize + inputs[end].size <= kMaxBatchSize) {
+                batchSize += inputs[end].size;
+                ++end;
+            }
+            return end;
+        }
+
+        template <typename TZIPSink>
+        void WriteZIPFileEntriesSerially(
+            ZIPRecordWriter<TZIPSink> &writer,
+            const std::vector<InputFile> &inputs, BlockCache *blockCache,
+            InputPrefetcher &prefetcher,
+            std::vector<ZIPFileEntry> &zipFileEntries)
+        {
+            SmallFileReadAhead readAhead(inputs, kMinReadAheadFiles);
+            for (std::size_t i = 0; i < inputs.size(); ++i) {
+                prefetcher.Reached(i);
+                const InputFile &input = inputs[i];
+                if (input.isStreamed) {
+                    zipFileEntries.emplace_back(
+                        writer.Stream(input, nullptr, blockCache));
+                    continue;
+                }
+                PendingZIPFileEntry pending;
+                PrepareZIPFileEntry(input, i, readAhead, nullptr, blockCache,
+                                    pending);
+                zipFileEntries.emplace_back(writer.Write(input, pending));
+            }
+        }
+
+        // Compresses entries on a pool of worker threads and writes them in
+        // the order of inputs. The output is identical to
+        // WriteZIPFileEntriesSerially.
+        //
+        // Within the reorder window, the largest batches are compressed
+        // first. Streamed files are compressed block by block on the pool
+        // when their turn comes.
+        template <typename TZIPSink>
+        void WriteZIPFileEntriesInParallel(
+            ZIPRecordWriter<TZIPSink> &writer,
+            const std::vector<InputFile> &inputs, unsigned jobs,
+            BlockCache *blockCache, InputPrefetcher &prefetcher,
+            std::vector<ZIPFileEntry> &zipFileEntries)
+        {
+            std::vector<PendingZIPFileEntry> pending(inputs.size());
+            std::mutex mutex;
+            std::condition_variable entryDone;
+            const std::size_t windowSize =
+                static_cast<std::size_t>(jobs) * kReorderWindowPerJob;
+            // Every entry in the window may be waiting for its file.
+            SmallFileReadAhead readAhead(
+                inputs, std::max(std::size_t(kMinReadAheadFiles),
+                                 windowSize * kMaxBatchEntries));
+            // Declared last so running tasks are joined before the state they
+            // refer to is destroyed.
+            ThreadPool pool(jobs);
+
+            std::size_t nextSubmit = 0;
+            // The end of each batch which was submitted but not completely
+            // written, oldest first.
+            std::deque<std::size_t> batchEnds;
+            for (std::size_t nextWrite = 0; nextWrite < inputs.size();
+                 ++nextWrite) {
+                prefetcher.Reached(nextWrite);
+                while (!batchEnds.empty() && batchEnds.front() <= nextWrite) {
+                    batchEnds.pop_front();
+                }
+                while (nextSubmit < inputs.size() &&
+                       batchEnds.size() < windowSize) {
+                    std::size_t begin = nextSubmit;
+                    std::size_t end = EndOfBatch(inputs, begin);
+                    nextSubmit = end;
+                    batchEnds.push_back(end);
+                    if (inputs[begin].isStreamed) {
+                        continue;
+                    }
+                    off_t batchSize = 0;
+                    for (std::size_t i = begin; i < end; ++i) {
+                        batchSize += std::max(inputs[i].size, off_t(0));
+                    }
+                    auto task = [&mutex, &entryDone, &pool, &inputs, &pending,
+                                 &readAhead, blockCache, begin, end]() {
+                        for (std::size_t i = begin; i < end; ++i) {
+                            std::exception_ptr error;
+                            try {
+                                PrepareZIPFileEntry(inputs[i], i, readAhead,
+                                                    &pool, blockCache,
+                                                    pending[i]);
+                            } catch (...) {
+                                error = std::current_exception();
+                            }
+                            {
+                                std::lock_guard<std::mutex> lock(mutex);
+                                pending[i].error = error;
+                                pending[i].done = true;
+                            }
+                            entryDone.notify_all();
+                        }
+                    };
+                    pool.Submit(task, static_cast<std::uint64_t>(batchSize));
+                }
+
+                if (inputs[nextWrite].isStreamed) {
+                    zipFileEntries.emplace_back(
+                        writer.Stream(inputs[nextWrite], &pool, blockCache));
+                    continue;
+                }
+                PendingZIPFileEntry &result = pending[nextWrite];
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    entryDone.wait(lock, [&result]() { return result.done; });
+                }
+                if (result.error) {
+                    std::rethrow_exception(result.error);
+                }
+                zipFileEntries.emplace_back(
+                    writer.Write(inputs[nextWrite], result));
+                // Release the entry's memory and mapping.
+                result = PendingZIPFileEntry();
+            }
+        }
+
+        // Estimates the memory held by entries, for --stats.
+        std::size_t EntryMetadataSize(const std::vector<ZIPFileEntry> &entries)
+        {
+            std::size_t size = entries.capacity() * sizeof(ZIPFileEntry);
+            for (const ZIPFileEntry &entry : entries) {
+                size += entry.fileName.capacity() +
+                        entry.sanitizedFileName.capacity() +
+                        entry.blocks.capacity() * sizeof(ZIPBlock);
+            }
+            return size;
+        }
+    }
+
+    EntryOrder ParseEntryOrder(const std::string &name)
+    {
+        if (name == "name") {
+            return EntryOrder::Name;
+        }
+        if (name == "directory") {
+            return EntryOrder::Directory;
+        }
+        if (name == "physical") {
+            return EntryOrder::Physical;
+        }
+        throw std::invalid_argument("Unknown order: " + name);
     }
 
     void WriteAppx(
-        const FilePtr &zip,
-        const std::unordered_map<std::string, std::string> &fileNames,
-        const std::string *certPath, int compressionLevel, bool isBundle)
+        OutputFile &zip,
+        const std::unordered_map<std::string, LocalFile> &fileNames,
+        const std::string *certPath,
+        const CompressionPolicies &compressionPolicies, unsigned jobs,
+        BlockCache *blockCache, const BasePackage *base, bool isBundle,
+        EntryOrder order, bool dropInputCache)
     {
-        FileSink zipRawSink(zip.get());
         OffsetSink zipOffsetSink;
-        auto zipSink = MakeMultiSink(zipRawSink, zipOffsetSink);
+        auto zipSink = MakeMultiSink(zip, zipOffsetSink);
         std::vector<ZIPFileEntry> zipFileEntries;
-        std::pair<std::string, std::string> appxBundleManifest;
+        MemoryCharge zipFileEntriesMemory(MemoryComponent::EntryMetadata);
+        // Set if isBundle.
+        const std::pair<const std::string, LocalFile> *appxBundleManifest =
+            nullptr;
 
         APPXDigests digests;
 
@@ -102,49 +884,99 @@ namespace appx {
         {
             SHA256Sink axpcSink;
             auto sink = MakeMultiSink(zipSink, axpcSink);
+            ZIPRecordWriter<decltype(zipSink)> writer(
+                zip, zipSink, zipOffsetSink, axpcSink, base);
+            // Streamed records are patched in place, which needs a seekable
+            // output.
+            bool canStream = zip.IsSeekable();
+            std::vector<InputFile> inputs;
+            inputs.reserve(fileNames.size());
             for (const auto &fileNamePair : fileNames) {
                 const std::string &archiveName = fileNamePair.first;
-                const std::string &fileName = fileNamePair.second;
+                const LocalFile &localFile = fileNamePair.second;
 
                 const std::string suffix = "AppxBundleManifest.xml";
                 if (isBundle &&
                         suffix.size() < archiveName.size() &&
                         std::equal(suffix.rbegin(), suffix.rend(), archiveName.rbegin())) {
-                    appxBundleManifest = fileNamePair;
+                    appxBundleManifest = &fileNamePair;
                     continue;
                 }
 
-                zipFileEntries.emplace_back(
-                    WriteZIPFileEntry(sink, zipOffsetSink.Offset(), fileName,
-                                      archiveName, compressionLevel));
+                inputs.push_back(MakeInputFile(archiveName, localFile,
+                                               canStream, compressionPolicies,
+                                               base));
+            }
+            SortInputFiles(inputs, order);
+            if (Progress *progress = GetProgress()) {
+                off_t totalBytes = 0;
+                for (const InputFile &input : inputs) {
+                    totalBytes += std::max(input.size, off_t(0));
+                }
+                progress->Begin(inputs.size(), totalBytes);
+            }
+            {
+                TraceSpan span("phase", "entries");
+                span.AddArgument("count",
+                                 static_cast<std::int64_t>(inputs.size()));
+                span.AddArgument("jobs", static_cast<std::int64_t>(jobs));
+                InputPrefetcher prefetcher(MakePrefetchInputs(inputs),
+                                           kPrefetchWindowSize,
+                                           dropInputCache);
+                if (jobs > 1) {
+                    WriteZIPFileEntriesInParallel(writer, inputs, jobs,
+                                                  blockCache, prefetcher,
+                                                  zipFileEntries);
+                } else {
+                    WriteZIPFileEntriesSerially(writer, inputs, blockCache,
+                                                prefetcher, zipFileEntries);
+                }
+                prefetcher.Reached(inputs.size());
+                span.SetBytes(0, zipOffsetSink.Offset());
             }
+            zipFileEntriesMemory.Set(EntryMetadataSize(zipFileEntries));
 
-            if (isBundle) {
+            if (appxBundleManifest) {
+                TraceSpan span("phase", "bundle-manifest");
                 ZIPFileEntry appxBundleManifestEntry = WriteZIPFileEntry(
-                    sink, zipOffsetSink.Offset(), appxBundleManifest.first,
-                    compressionLevel,
-                    WriteAppxBundleManifestFunc{appxBundleManifest.second,
-                                                zipFileEntries});
+                    sink, zipOffsetSink.Offset(), appxBundleManifest->first,
+                    GetCompressionPolicy(appxBundleManifest->first,
+                                         appxBundleManifest->second,
+                                         compressionPolicies),
+                    WriteAppxBundleManifestFunc{
+                        appxBundleManifest->second.path, zipFileEntries});
                 zipFileEntries.emplace_back(std::move(appxBundleManifestEntry));
             }
 
             // this creates AppxBlockMap.xml file
-            ZIPFileEntry blockMap = WriteAppxBlockMapZIPFileEntry(
-                sink, zipOffsetSink.Offset(), zipFileEntries, isBundle);
-            digests.axbm = blockMap.sha256;
-            zipFileEntries.emplace_back(std::move(blockMap));
+            {
+                TraceSpan span("phase", "block-map");
+                ZIPFileEntry blockMap = WriteAppxBlockMapZIPFileEntry(
+                    sink, zipOffsetSink.Offset(), zipFileEntries, isBundle);
+                span.SetBytes(blockMap.uncompressedSize,
+                              blockMap.compressedSize);
+                digests.axbm = blockMap.sha256;
+                zipFileEntries.emplace_back(std::move(blockMap));
+            }
 
             // this creates [Content_Types].xml
-            ZIPFileEntry contentTypes = WriteContentTypesZIPFileEntry(
-                sink, zipOffsetSink.Offset(), isBundle, zipFileEntries);
-            digests.axct = contentTypes.sha256;
-            zipFileEntries.emplace_back(std::move(contentTypes));
+            {
+                TraceSpan span("phase", "content-types");
+                ZIPFileEntry contentTypes = WriteContentTypesZIPFileEntry(
+                    sink, zipOffsetSink.Offset(), isBundle, zipFileEntries);
+                span.SetBytes(contentTypes.uncompressedSize,
+                              contentTypes.compressedSize);
+                digests.axct = contentTypes.sha256;
+                zipFileEntries.emplace_back(std::move(contentTypes));
+            }
 
             digests.axpc = axpcSink.SHA256();
         }
+        zipFileEntriesMemory.Set(EntryMetadataSize(zipFileEntries));
 
         // Hash (but do not write) the directory, pre-signature.
         {
+            TraceSpan span("phase", "central-directory-hash");
             SHA256Sink axcdSink;
             OffsetSink tmpOffsetSink = zipOffsetSink;
             auto sink = MakeMultiSink(axcdSink, tmpOffsetSink);
@@ -158,16 +990,20 @@ namespace appx {
 
         // Sign and write the signature.
         if (certPath) {
+            TraceSpan span("phase", "sign");
             zipFileEntries.emplace_back(WriteSignature(
                 zipSink, *certPath, digests, zipOffsetSink.Offset()));
         }
 
         // Write the directory.
+        TraceSpan span("phase", "central-directory");
+        off_t directoryOffset = zipOffsetSink.Offset();
         for (const ZIPFileEntry &entry : zipFileEntries) {
             entry.WriteDirectoryEntry(zipSink);
         }
         WriteZIPEndOfCentralDirectoryRecord(zipSink, zipOffsetSink.Offset(),
                                             zipFileEntries);
+        span.SetBytes(0, zipOffsetSink.Offset() - directoryOffset);
     }
 }
 }
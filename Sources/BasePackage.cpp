@@ -0,0 +1,486 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#include <APPX/BasePackage.h>
+#include <APPX/Memory.h>
+#include <APPX/XML.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <openssl/evp.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <zlib.h>
+
+namespace osinside {
+namespace appx {
+    namespace {
+        enum : std::uint32_t
+        {
+            kFileRecordSignature = 0x04034B50,
+            kDirectoryEntrySignature = 0x02014B50,
+            kEndOfCentralDirectorySignature = 0x06054B50,
+            kZIP64EndOfCentralDirectorySignature = 0x06064B50,
+            kZIP64EndOfCentralDirectoryLocatorSignature = 0x07064B50,
+        };
+
+        enum
+        {
+            kEndOfCentralDirectorySize = 22,
+            kZIP64EndOfCentralDirectorySize = 56,
+            kZIP64EndOfCentralDirectoryLocatorSize = 20,
+        };
+
+        class MalformedPackageError : public std::runtime_error
+        {
+        public:
+            explicit MalformedPackageError(const std::string &path)
+                : std::runtime_error("Malformed base package: " + path)
+            {
+            }
+        };
+
+        std::uint64_t ReadLE(const std::uint8_t *bytes, int size)
+        {
+            std::uint64_t value = 0;
+            for (int i = size - 1; i >= 0; --i) {
+                value = (value << 8) | bytes[i];
+            }
+            return value;
+        }
+
+        // A directory entry from the ZIP central directory.
+        struct DirectoryEntry
+        {
+            std::uint16_t compressionType;
+            std::uint32_t crc32;
+            std::uint64_t compressedSize;
+            std::uint64_t uncompressedSize;
+            std::uint64_t fileRecordHeaderOffset;
+        };
+
+        std::string ReadBytes(const FilePtr &file, const std::string &path,
+                              off_t offset, std::uint64_t size)
+        {
+            if (size > std::numeric_limits<std::size_t>::max()) {
+                throw MalformedPackageError(path);
+            }
+            std::string bytes(size, '\0');
+            if (ReadAt(file, offset, size, &bytes[0]) != size) {
+                throw MalformedPackageError(path);
+            }
+            return bytes;
+        }
+
+        std::unordered_map<std::string, DirectoryEntry> ReadCentralDirectory(
+            const FilePtr &file, const std::string &path)
+        {
+            struct stat status;
+            if (fstat(fileno(file.get()), &status) != 0) {
+                throw ErrnoException(path);
+            }
+            // The end of central directory record is followed by a comment
+            // of up to 64 KiB.
+            off_t tailSize =
+                std::min(status.st_size, off_t(kEndOfCentralDirectorySize +
+                                               0xFFFF));
+            off_t tailOffset = status.st_size - tailSize;
+            std::string tail = ReadBytes(file, path, tailOffset, tailSize);
+            const std::uint8_t *tailBytes =
+                reinterpret_cast<const std::uint8_t *>(tail.data());
+            off_t eocd = tailSize - kEndOfCentralDirectorySize;
+            for (; eocd >= 0; --eocd) {
+                if (ReadLE(tailBytes + eocd, 4) ==
+                    kEndOfCentralDirectorySignature) {
+                    break;
+                }
+            }
+            if (eocd < 0) {
+                throw MalformedPackageError(path);
+            }
+            const std::uint8_t *record = tailBytes + eocd;
+            std::uint64_t entryCount = ReadLE(record + 10, 2);
+            std::uint64_t directorySize = ReadLE(record + 12, 4);
+            std::uint64_t directoryOffset = ReadLE(record + 16, 4);
+            if (entryCount == 0xFFFF || directorySize == kZIP64Placeholder ||
+                directoryOffset == kZIP64Placeholder) {
+                off_t locatorOffset =
+                    tailOffset + eocd - kZIP64EndOfCentralDirectoryLocatorSize;
+                if (locatorOffset < 0) {
+                    throw MalformedPackageError(path);
+                }
+                std::string locator =
+                    ReadBytes(file, path, locatorOffset,
+                              kZIP64EndOfCentralDirectoryLocatorSize);
+                const std::uint8_t *locatorBytes =
+                    reinterpret_cast<const std::uint8_t *>(locator.data());
+                if (ReadLE(locatorBytes, 4) !=
+                    kZIP64EndOfCentralDirectoryLocatorSignature) {
+                    throw MalformedPackageError(path);
+                }
+                std::string zip64Record =
+                    ReadBytes(file, path, ReadLE(locatorBytes + 8, 8),
+                              kZIP64EndOfCentralDirectorySize);
+                const std::uint8_t *zip64Bytes =
+                    reinterpret_cast<const std::uint8_t *>(zip64Record.data());
+                if (ReadLE(zip64Bytes, 4) !=
+                    kZIP64EndOfCentralDirectorySignature) {
+                    throw MalformedPackageError(path);
+                }
+                entryCount = ReadLE(zip64Bytes + 32, 8);
+                directorySize = ReadLE(zip64Bytes + 40, 8);
+                directoryOffset = ReadLE(zip64Bytes + 48, 8);
+            }
+
+            std::string directory =
+                ReadBytes(file, path, directoryOffset, directorySize);
+            const std::uint8_t *bytes =
+                reinterpret_cast<const std::uint8_t *>(directory.data());
+            const std::uint8_t *end = bytes + directory.size();
+            std::unordered_map<std::string, DirectoryEntry> entries;
+            for (std::uint64_t i = 0; i < entryCount; ++i) {
+                if (end - bytes < 46 ||
+                    ReadLE(bytes, 4) != kDirectoryEntrySignature) {
+                    throw MalformedPackageError(path);
+                }
+                DirectoryEntry entry;
+                entry.compressionType =
+                    static_cast<std::uint16_t>(ReadLE(bytes + 10, 2));
+                entry.crc32 = static_cast<std::uint32_t>(ReadLE(bytes + 16, 4));
+                entry.compressedSize = ReadLE(bytes + 20, 4);
+                entry.uncompressedSize = ReadLE(bytes + 24, 4);
+                std::size_t nameSize = ReadLE(bytes + 28, 2);
+                std::size_t extraSize = ReadLE(bytes + 30, 2);
+                std::size_t commentSize = ReadLE(bytes + 32, 2);
+                entry.fileRecordHeaderOffset = ReadLE(bytes + 42, 4);
+                if (static_cast<std::size_t>(end - bytes) <
+                    46 + nameSize + extraSize + commentSize) {
+                    throw MalformedPackageError(path);
+                }
+                std::string name(reinterpret_cast<const char *>(bytes + 46),
+                                 nameSize);
+
+                // Fields which overflowed are in the ZIP64 extra field, in
+                // this order.
+                std::uint64_t *zip64Fields[3];
+                int zip64FieldCount = 0;
+                if (entry.uncompressedSize == kZIP64Placeholder) {
+                    zip64Fields[zip64FieldCount++] = &entry.uncompressedSize;
+                }
+                if (entry.compressedSize == kZIP64Placeholder) {
+                    zip64Fields[zip64FieldCount++] = &entry.compressedSize;
+                }
+                if (entry.fileRecordHeaderOffset == kZIP64Placeholder) {
+                    zip64Fields[zip64FieldCount++] =
+                        &entry.fileRecordHeaderOffset;
+                }
+                const std::uint8_t *extra = bytes + 46 + nameSize;
+                const std::uint8_t *extraEnd = extra + extraSize;
+                while (zip64FieldCount > 0 && extraEnd - extra >= 4) {
+                    std::size_t fieldSize = ReadLE(extra + 2, 2);
+                    if (static_cast<std::size_t>(extraEnd - extra) <
+                        4 + fieldSize) {
+                        break;
+                    }
+                    if (ReadLE(extra, 2) == kZIP64ExtraFieldTag &&
+                        fieldSize >= 8 * std::size_t(zip64FieldCount)) {
+                        for (int j = 0; j < zip64FieldCount; ++j) {
+                            *zip64Fields[j] = ReadLE(extra + 4 + 8 * j, 8);
+                        }
+                        zip64FieldCount = 0;
+                    }
+                    extra += 4 + fieldSize;
+                }
+                if (zip64FieldCount > 0) {
+                    throw MalformedPackageError(path);
+                }
+                entries.emplace(std::move(name), entry);
+                bytes += 46 + nameSize + extraSize + commentSize;
+            }
+            return entries;
+        }
+
+        off_t ReadDataOffset(const FilePtr &file, const std::string &path,
+                             std::uint64_t fileRecordHeaderOffset)
+        {
+            std::string header =
+                ReadBytes(file, path, fileRecordHeaderOffset, 30);
+            const std::uint8_t *bytes =
+                reinterpret_cast<const std::uint8_t *>(header.data());
+            if (ReadLE(bytes, 4) != kFileRecordSignature) {
+                throw MalformedPackageError(path);
+            }
+            return fileRecordHeaderOffset + 30 + ReadLE(bytes + 26, 2) +
+                   ReadLE(bytes + 28, 2);
+        }
+
+        std::string ReadFileData(const FilePtr &file, const std::string &path,
+                                 const DirectoryEntry &entry)
+        {
+            std::string data =
+                ReadBytes(file, path,
+                          ReadDataOffset(file, path,
+                                         entry.fileRecordHeaderOffset),
+                          entry.compressedSize);
+            switch (static_cast<ZIPCompressionType>(entry.compressionType)) {
+                case ZIPCompressionType::Store:
+                    return data;
+                case ZIPCompressionType::Deflate:
+                    break;
+                default:
+                    throw MalformedPackageError(path);
+            }
+            if (entry.uncompressedSize > std::numeric_limits<uInt>::max() ||
+                data.size() > std::numeric_limits<uInt>::max()) {
+                throw MalformedPackageError(path);
+            }
+            std::string uncompressed(entry.uncompressedSize, '\0');
+            z_stream stream;
+            CountZlibAllocations(stream);
+            stream.next_in = nullptr;
+            stream.avail_in = 0;
+            if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+                throw std::runtime_error("inflateInit failed");
+            }
+            stream.next_in =
+                reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+            stream.avail_in = static_cast<uInt>(data.size());
+            stream.next_out = reinterpret_cast<Bytef *>(&uncompressed[0]);
+            stream.avail_out = static_cast<uInt>(uncompressed.size());
+            int rc = inflate(&stream, Z_FINISH);
+            inflateEnd(&stream);
+            if (rc != Z_STREAM_END || stream.avail_out != 0) {
+                throw MalformedPackageError(path);
+            }
+            return uncompressed;
+        }
+
+        // Returns the value of an attribute of an XML element, given the
+        // text of its start tag, or false if the attribute is missing.
+        bool GetXMLAttribute(const std::string &tag, const char *name,
+                             std::string &out)
+        {
+            std::string prefix = std::string(" ") + name + "=\"";
+            std::string::size_type start = tag.find(prefix);
+            if (start == std::string::npos) {
+                return false;
+            }
+            start += prefix.size();
+            std::string::size_type end = tag.find('"', start);
+            if (end == std::string::npos) {
+                return false;
+            }
+            out = XMLDecodeString(tag.substr(start, end - start));
+            return true;
+        }
+
+        bool DecodeSHA256Hash(const std::string &base64, SHA256Hash &out)
+        {
+            // EVP_DecodeBlock does not strip padding, so the single '=' of a
+            // SHA256 digest decodes to an extra zero byte.
+            std::uint8_t decoded[sizeof(out.bytes) + 1];
+            if (base64.size() != 44 ||
+                EVP_DecodeBlock(decoded,
+                                reinterpret_cast<const unsigned char *>(
+                                    base64.data()),
+                                base64.size()) != sizeof(decoded)) {
+                return false;
+            }
+            out = SHA256Hash(decoded);
+            return true;
+        }
+
+        off_t ParseOffT(const std::string &s)
+        {
+            char *end;
+            errno = 0;
+            long long value = std::strtoll(s.c_str(), &end, 10);
+            if (errno != 0 || s.empty() || *end != '\0' || value < 0) {
+                return -1;
+            }
+            return static_cast<off_t>(value);
+        }
+    }
+
+    ZIPFileEntry BaseEntry::ToZIPFileEntry(
+        const std::string &archiveFileName) const
+    {
+        return ZIPFileEntry(archiveFileName, this->compressedSize,
+                            this->uncompressedSize, this->compressionType, 0,
+                            this->crc32, this->blocks, SHA256Hash());
+    }
+
+    BasePackage::BasePackage(const std::string &path)
+        : path(path), file(Open(path, "rb"))
+    {
+        std::unordered_map<std::string, DirectoryEntry> directory =
+            ReadCentralDirectory(this->file, path);
+        auto blockMapIt = directory.find("AppxBlockMap.xml");
+        if (blockMapIt == directory.end()) {
+            throw MalformedPackageError(path);
+        }
+        std::string blockMap =
+            ReadFileData(this->file, path, blockMapIt->second);
+
+        // The block map is written by WriteAppxBlockMapZIPFileEntry (or by
+        // Microsoft's tools), so a simple scan is enough:
+        // <File Name="..." Size="..." ...><Block Hash="..." Size="..."/>...
+        std::string::size_type pos = 0;
+        for (;;) {
+            std::string::size_type fileStart = blockMap.find("<File ", pos);
+            if (fileStart == std::string::npos) {
+                break;
+            }
+            std::string::size_type fileTagEnd = blockMap.find('>', fileStart);
+            std::string::size_type fileEnd = blockMap.find("</File>", fileStart);
+            if (fileTagEnd == std::string::npos) {
+                throw MalformedPackageError(path);
+            }
+            pos = fileTagEnd + 1;
+            std::string fileTag =
+                blockMap.substr(fileStart, fileTagEnd - fileStart);
+            std::string name;
+            std::string size;
+            if (!GetXMLAttribute(fileTag, "Name", name) ||
+                !GetXMLAttribute(fileTag, "Size", size)) {
+                throw MalformedPackageError(path);
+            }
+            std::replace(name.begin(), name.end(), '\\', '/');
+
+            std::vector<ZIPBlock> blocks;
+            bool isSelfClosing = fileTag.back() == '/';
+            bool blocksAreValid = true;
+            while (!isSelfClosing && blocksAreValid) {
+                std::string::size_type blockStart =
+                    blockMap.find("<Block ", pos);
+                if (blockStart == std::string::npos || blockStart > fileEnd) {
+                    break;
+                }
+                std::string::size_type blockEnd = blockMap.find('>', blockStart);
+                if (blockEnd == std::string::npos) {
+                    throw MalformedPackageError(path);
+                }
+                std::string blockTag =
+                    blockMap.substr(blockStart, blockEnd - blockStart);
+                pos = blockEnd + 1;
+                std::string hash;
+                SHA256Hash sha256;
+                if (!GetXMLAttribute(blockTag, "Hash", hash) ||
+                    !DecodeSHA256Hash(hash, sha256)) {
+                    blocksAreValid = false;
+                    break;
+                }
+                std::string compressedSize;
+                if (GetXMLAttribute(blockTag, "Size", compressedSize)) {
+                    off_t parsedSize = ParseOffT(compressedSize);
+                    if (parsedSize < 0) {
+                        blocksAreValid = false;
+                        break;
+                    }
+                    blocks.emplace_back(sha256, parsedSize);
+                } else {
+                    blocks.emplace_back(sha256);
+                }
+            }
+            if (fileEnd != std::string::npos) {
+                pos = std::max(pos, fileEnd);
+            }
+
+            auto directoryIt =
+                directory.find(ZIPFileEntry::SanitizedFileName(name));
+            if (!blocksAreValid || directoryIt == directory.end()) {
+                continue;
+            }
+            const DirectoryEntry &directoryEntry = directoryIt->second;
+            ZIPCompressionType compressionType =
+                static_cast<ZIPCompressionType>(directoryEntry.compressionType);
+            bool isCompressed = compressionType == ZIPCompressionType::Deflate;
+            if (compressionType != ZIPCompressionType::Store &&
+                !isCompressed) {
+                continue;
+            }
+            // Only use entries whose block map describes them completely.
+            off_t uncompressedSize = ParseOffT(size);
+            off_t expectedBlockCount =
+                (uncompressedSize + ZIPBlock::kSize - 1) / ZIPBlock::kSize;
+            if (uncompressedSize < 0 ||
+                static_cast<std::uint64_t>(uncompressedSize) !=
+                    directoryEntry.uncompressedSize ||
+                static_cast<off_t>(blocks.size()) != expectedBlockCount) {
+                continue;
+            }
+            bool blockSizesAreKnown = std::all_of(
+                blocks.begin(), blocks.end(), [isCompressed](const ZIPBlock &b) {
+                    return (b.compressedSize != ZIPBlock::kNotCompressed) ==
+                           isCompressed;
+                });
+            if (!blockSizesAreKnown) {
+                continue;
+            }
+            this->entries.emplace(
+                name,
+                BaseEntry{compressionType, directoryEntry.crc32,
+                          static_cast<off_t>(directoryEntry.compressedSize),
+                          uncompressedSize,
+                          ReadDataOffset(this->file, path,
+                                         directoryEntry.fileRecordHeaderOffset),
+                          std::move(blocks)});
+        }
+    }
+
+    const BaseEntry *BasePackage::Find(const std::string &archiveFileName) const
+    {
+        auto it = this->entries.find(archiveFileName);
+        return it == this->entries.end() ? nullptr : &it->second;
+    }
+
+    bool BasePackage::IsSameFile(const std::string &path) const
+    {
+        struct stat packageStatus;
+        struct stat pathStatus;
+        if (fstat(fileno(this->file.get()), &packageStatus) != 0) {
+            throw ErrnoException(this->path);
+        }
+        if (stat(path.c_str(), &pathStatus) != 0) {
+            return false;
+        }
+        return packageStatus.st_dev == pathStatus.st_dev &&
+               packageStatus.st_ino == pathStatus.st_ino;
+    }
+
+    bool MatchesBaseEntry(const BaseEntry &entry,
+                          const std::string &inputFileName)
+    {
+        FilePtr file = Open(inputFileName, "rb");
+        struct stat status;
+        if (fstat(fileno(file.get()), &status) != 0) {
+            throw ErrnoException(inputFileName);
+        }
+        if (!S_ISREG(status.st_mode) ||
+            status.st_size != entry.uncompressedSize) {
+            return false;
+        }
+        std::vector<std::uint8_t> block(ZIPBlock::kSize);
+        for (const ZIPBlock &expected : entry.blocks) {
+            std::size_t read = Read(file, block.size(), block.data());
+            SHA256Hash actual = SHA256Hash::DigestFromBytes(read, block.data());
+            if (std::memcmp(actual.bytes, expected.sha256.bytes,
+                            sizeof(actual.bytes)) != 0) {
+                return false;
+            }
+        }
+        // The file may have grown since it was stat-ed.
+        std::uint8_t extra;
+        return Read(file, 1, &extra) == 0;
+    }
+}
+}
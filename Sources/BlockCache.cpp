@@ -0,0 +1,280 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#include <APPX/BlockCache.h>
+#include <APPX/CRC32.h>
+#include <APPX/Deflate.h>
+#include <APPX/Encode.h>
+#include <APPX/File.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <memory>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace osinside {
+namespace appx {
+    namespace {
+        // Each entry file holds kEntryMagic, the CRC32 of the compressed
+        // bytes (little endian), then the compressed bytes.
+        const char kEntryMagic[8] = {'A', 'P', 'P', 'X', 'B', 'L', 'K', '1'};
+
+        enum
+        {
+            kEntryHeaderSize = sizeof(kEntryMagic) + 4,
+            // Bigger than any compressed 64 KiB block.
+            kMaxEntrySize = 1 << 20,
+        };
+
+        class FD
+        {
+        public:
+            explicit FD(int fd) : fd(fd)
+            {
+            }
+
+            ~FD()
+            {
+                if (this->fd != -1) {
+                    close(this->fd);
+                }
+            }
+
+            FD(const FD &) = delete;
+
+            FD &operator=(const FD &) = delete;
+
+            int Get() const
+            {
+                return this->fd;
+            }
+
+        private:
+            int fd;
+        };
+
+        bool ReadAll(int fd, std::size_t size, std::uint8_t *bytes)
+        {
+            while (size > 0) {
+                ssize_t rc = read(fd, bytes, size);
+                if (rc < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (rc <= 0) {
+                    return false;
+                }
+                bytes += rc;
+                size -= rc;
+            }
+            return true;
+        }
+
+        bool WriteAll(int fd, std::size_t size, const std::uint8_t *bytes)
+        {
+            while (size > 0) {
+                ssize_t rc = write(fd, bytes, size);
+                if (rc < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (rc <= 0) {
+                    return false;
+                }
+                bytes += rc;
+                size -= rc;
+            }
+            return true;
+        }
+
+        struct DirDeleter
+        {
+            void operator()(DIR *dir)
+            {
+                if (dir) {
+                    closedir(dir);
+                }
+            }
+        };
+
+        typedef std::unique_ptr<DIR, DirDeleter> DirPtr;
+    }
+
+    BlockCache::BlockCache(std::string directory, off_t maxSize)
+        : directory(std::move(directory)), maxSize(maxSize)
+    {
+        if (mkdir(this->directory.c_str(), 0777) != 0 && errno != EEXIST) {
+            throw ErrnoException(this->directory);
+        }
+        // There is no way to read the umask without setting it.
+        mode_t mask = umask(0);
+        umask(mask);
+        this->entryMode = 0666 & ~mask;
+    }
+
+    std::string BlockCache::EntryPath(const SHA256Hash &sha256,
+                                      int compressionLevel, int strategy) const
+    {
+        // Hash everything the compressed bytes depend on into one key.
+        std::vector<std::uint8_t> keyData(sha256.bytes,
+                                          sha256.bytes + sizeof(sha256.bytes));
+        std::uint8_t settings[] = {
+            APPXUTIL_BYTES_4_LE(static_cast<std::uint32_t>(compressionLevel)),
+            APPXUTIL_BYTES_4_LE(static_cast<std::uint32_t>(strategy)),
+        };
+        keyData.insert(keyData.end(), settings, settings + sizeof(settings));
+        std::string version = DeflateBackendVersion();
+        keyData.insert(keyData.end(), version.begin(), version.end());
+        SHA256Hash key =
+            SHA256Hash::DigestFromBytes(keyData.size(), keyData.data());
+
+        static const char kHexDigits[] = "0123456789abcdef";
+        std::string hex;
+        for (std::uint8_t byte : key.bytes) {
+            hex += kHexDigits[byte >> 4];
+            hex += kHexDigits[byte & 0xF];
+        }
+        // Spread entries over subdirectories to keep directories small.
+        return this->directory + "/" + hex.substr(0, 2) + "/" + hex.substr(2);
+    }
+
+    bool BlockCache::Find(const SHA256Hash &sha256, int compressionLevel,
+                          int strategy, std::vector<std::uint8_t> &out)
+    {
+        std::string path = this->EntryPath(sha256, compressionLevel, strategy);
+        FD fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+        if (fd.Get() == -1) {
+            return false;
+        }
+        struct stat status;
+        if (fstat(fd.Get(), &status) != 0 ||
+            status.st_size < kEntryHeaderSize ||
+            status.st_size > kMaxEntrySize) {
+            return false;
+        }
+        std::vector<std::uint8_t> entry(status.st_size);
+        if (!ReadAll(fd.Get(), entry.size(), entry.data())) {
+            return false;
+        }
+        if (std::memcmp(entry.data(), kEntryMagic, sizeof(kEntryMagic)) != 0) {
+            return false;
+        }
+        const std::uint8_t *crcBytes = entry.data() + sizeof(kEntryMagic);
+        std::uint32_t expectedCRC =
+            crcBytes[0] | (crcBytes[1] << 8) | (crcBytes[2] << 16) |
+            (static_cast<std::uint32_t>(crcBytes[3]) << 24);
+        const std::uint8_t *compressed = entry.data() + kEntryHeaderSize;
+        std::size_t compressedSize = entry.size() - kEntryHeaderSize;
+        if (CRC32(compressedSize, compressed) != expectedCRC) {
+            return false;
+        }
+        // Mark the entry as recently used for Trim.
+        futimens(fd.Get(), nullptr);
+        out.insert(out.end(), compressed, compressed + compressedSize);
+        return true;
+    }
+
+    void BlockCache::Insert(const SHA256Hash &sha256, int compressionLevel,
+                            int strategy, std::size_t size,
+                            const std::uint8_t *compressedBytes)
+    {
+        if (size + kEntryHeaderSize > kMaxEntrySize) {
+            return;
+        }
+        std::string path = this->EntryPath(sha256, compressionLevel, strategy);
+        std::string subdirectory = path.substr(0, path.rfind('/'));
+        if (mkdir(subdirectory.c_str(), 0777) != 0 && errno != EEXIST) {
+            return;
+        }
+        // Write to a temporary file and rename it, so other processes never
+        // see a partial entry. mkostemp creates the file with mode 0600, so
+        // it is made readable to whoever the umask allows before the rename,
+        // as a shared cache needs.
+        std::string temporaryPath = path + ".tmpXXXXXX";
+        FD fd(mkostemp(&temporaryPath[0], O_CLOEXEC));
+        if (fd.Get() == -1) {
+            return;
+        }
+        std::uint8_t header[kEntryHeaderSize];
+        std::memcpy(header, kEntryMagic, sizeof(kEntryMagic));
+        std::uint8_t crc[] = {APPXUTIL_BYTES_4_LE(CRC32(size, compressedBytes))};
+        std::memcpy(header + sizeof(kEntryMagic), crc, sizeof(crc));
+        if (!WriteAll(fd.Get(), sizeof(header), header) ||
+            !WriteAll(fd.Get(), size, compressedBytes) ||
+            fchmod(fd.Get(), this->entryMode) != 0 ||
+            rename(temporaryPath.c_str(), path.c_str()) != 0) {
+            unlink(temporaryPath.c_str());
+        }
+    }
+
+    void BlockCache::Trim()
+    {
+        struct Entry
+        {
+            struct timespec lastUsed;
+            off_t size;
+            std::string path;
+        };
+        std::vector<Entry> entries;
+        off_t totalSize = 0;
+        DirPtr directory(opendir(this->directory.c_str()));
+        if (!directory) {
+            return;
+        }
+        while (struct dirent *subdirectoryEntry = readdir(directory.get())) {
+            if (subdirectoryEntry->d_name[0] == '.') {
+                continue;
+            }
+            std::string subdirectoryPath =
+                this->directory + "/" + subdirectoryEntry->d_name;
+            DirPtr subdirectory(opendir(subdirectoryPath.c_str()));
+            if (!subdirectory) {
+                continue;
+            }
+            while (struct dirent *fileEntry = readdir(subdirectory.get())) {
+                // Skip temporary files, which another process may still be
+                // writing (see Insert).
+                if (fileEntry->d_name[0] == '.' ||
+                    std::strstr(fileEntry->d_name, ".tmp") != nullptr) {
+                    continue;
+                }
+                std::string path = subdirectoryPath + "/" + fileEntry->d_name;
+                struct stat status;
+                if (stat(path.c_str(), &status) != 0 ||
+                    !S_ISREG(status.st_mode)) {
+                    continue;
+                }
+                entries.push_back(Entry{status.st_mtim, status.st_size, path});
+                totalSize += status.st_size;
+            }
+        }
+        if (totalSize <= this->maxSize) {
+            return;
+        }
+        std::sort(entries.begin(), entries.end(),
+                  [](const Entry &a, const Entry &b) {
+                      if (a.lastUsed.tv_sec != b.lastUsed.tv_sec) {
+                          return a.lastUsed.tv_sec < b.lastUsed.tv_sec;
+                      }
+                      return a.lastUsed.tv_nsec < b.lastUsed.tv_nsec;
+                  });
+        for (const Entry &entry : entries) {
+            if (totalSize <= this->maxSize) {
+                break;
+            }
+            if (unlink(entry.path.c_str()) == 0) {
+                totalSize -= entry.size;
+            }
+        }
+    }
+}
+}
@@ -0,0 +1,30 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#include <APPX/BlockDigest.h>
+#include <APPX/SHA256.h>
+#include <algorithm>
+
+namespace osinside {
+namespace appx {
+    void DigestBlocks(std::size_t size, const std::uint8_t *bytes,
+                      std::size_t blockSize, BlockDigest *digests)
+    {
+        while (size > 0) {
+            std::size_t blockBytes = std::min(size, blockSize);
+            digests->sha256 = DigestSHA256(blockBytes, bytes);
+            digests->crc32 = CRC32Update(0, blockBytes, bytes);
+            ++digests;
+            bytes += blockBytes;
+            size -= blockBytes;
+        }
+    }
+}
+}
@@ -0,0 +1,222 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#include <APPX/CRC32.h>
+#include <cstring>
+#include <zlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define APPX_HAVE_PCLMUL 1
+#elif defined(__aarch64__) && defined(__linux__)
+#include <arm_acle.h>
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#define APPX_HAVE_ARMV8_CRC 1
+#endif
+
+namespace osinside {
+namespace appx {
+    namespace {
+        typedef std::uint32_t (*CRC32Function)(std::uint32_t crc,
+                                               std::size_t size,
+                                               const std::uint8_t *bytes);
+
+        std::uint32_t CRC32Zlib(std::uint32_t crc, std::size_t size,
+                                const std::uint8_t *bytes)
+        {
+            return static_cast<std::uint32_t>(crc32_z(crc, bytes, size));
+        }
+
+#if APPX_HAVE_PCLMUL
+        enum
+        {
+            // The folding loop consumes 64 bytes at a time, then 16.
+            kFoldMinimumSize = 64,
+            kFoldGranularity = 16,
+        };
+
+        bool HasPCLMUL()
+        {
+            unsigned eax, ebx, ecx, edx;
+            return __get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+                   (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1);
+        }
+
+        // Folds size bytes, which must be at least kFoldMinimumSize and a
+        // multiple of kFoldGranularity, into the (inverted) CRC32 crc.
+        //
+        // This is the algorithm of Intel's "Fast CRC Computation for Generic
+        // Polynomials Using PCLMULQDQ Instruction", with the constants for
+        // the reflected ZIP polynomial: four 128-bit lanes are folded 64
+        // bytes at a time, then folded into one lane, then reduced to 32
+        // bits with a Barrett reduction.
+        __attribute__((target("pclmul,sse4.1"))) std::uint32_t FoldPCLMUL(
+            std::uint32_t crc, std::size_t size, const std::uint8_t *bytes)
+        {
+            alignas(16) static const std::uint64_t k1k2[] = {0x0154442bd4,
+                                                             0x01c6e41596};
+            alignas(16) static const std::uint64_t k3k4[] = {0x01751997d0,
+                                                             0x00ccaa009e};
+            alignas(16) static const std::uint64_t k5k0[] = {0x0163cd6124,
+                                                             0x0000000000};
+            alignas(16) static const std::uint64_t poly[] = {0x01db710641,
+                                                             0x01f7011641};
+            const __m128i *in = reinterpret_cast<const __m128i *>(bytes);
+
+            __m128i x1 = _mm_loadu_si128(in + 0);
+            __m128i x2 = _mm_loadu_si128(in + 1);
+            __m128i x3 = _mm_loadu_si128(in + 2);
+            __m128i x4 = _mm_loadu_si128(in + 3);
+            x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+            __m128i k = _mm_load_si128(reinterpret_cast<const __m128i *>(k1k2));
+            in += 4;
+            size -= 64;
+
+            // Fold 64 bytes at a time into the four lanes.
+            while (size >= 64) {
+                __m128i x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+                __m128i x6 = _mm_clmulepi64_si128(x2, k, 0x00);
+                __m128i x7 = _mm_clmulepi64_si128(x3, k, 0x00);
+                __m128i x8 = _mm_clmulepi64_si128(x4, k, 0x00);
+                x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+                x2 = _mm_clmulepi64_si128(x2, k, 0x11);
+                x3 = _mm_clmulepi64_si128(x3, k, 0x11);
+                x4 = _mm_clmulepi64_si128(x4, k, 0x11);
+                x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+                                   _mm_loadu_si128(in + 0));
+                x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+                                   _mm_loadu_si128(in + 1));
+                x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+                                   _mm_loadu_si128(in + 2));
+                x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+                                   _mm_loadu_si128(in + 3));
+                in += 4;
+                size -= 64;
+            }
+
+            // Fold the four lanes into one.
+            k = _mm_load_si128(reinterpret_cast<const __m128i *>(k3k4));
+            __m128i lanes[] = {x2, x3, x4};
+            for (__m128i lane : lanes) {
+                __m128i x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+                x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+                x1 = _mm_xor_si128(_mm_xor_si128(x1, lane), x5);
+            }
+
+            // Fold the remaining 16-byte blocks.
+            while (size >= 16) {
+                __m128i x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+                x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+                x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128(in)),
+                                   x5);
+                in += 1;
+                size -= 16;
+            }
+
+            // Fold 128 bits to 64 bits.
+            __m128i x2Fold = _mm_clmulepi64_si128(x1, k, 0x10);
+            __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+            x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2Fold);
+            k = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(k5k0));
+            __m128i high = _mm_srli_si128(x1, 4);
+            x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x00);
+            x1 = _mm_xor_si128(x1, high);
+
+            // Barrett reduction to 32 bits.
+            k = _mm_load_si128(reinterpret_cast<const __m128i *>(poly));
+            __m128i t = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x10);
+            t = _mm_clmulepi64_si128(_mm_and_si128(t, mask), k, 0x00);
+            x1 = _mm_xor_si128(x1, t);
+            return static_cast<std::uint32_t>(_mm_extract_epi32(x1, 1));
+        }
+
+        std::uint32_t CRC32PCLMUL(std::uint32_t crc, std::size_t size,
+                                  const std::uint8_t *bytes)
+        {
+            if (size >= kFoldMinimumSize) {
+                std::size_t foldSize =
+                    size & ~std::size_t(kFoldGranularity - 1);
+                crc = ~FoldPCLMUL(~crc, foldSize, bytes);
+                bytes += foldSize;
+                size -= foldSize;
+            }
+            return CRC32Zlib(crc, size, bytes);
+        }
+#endif
+
+#if APPX_HAVE_ARMV8_CRC
+        __attribute__((target("+crc"))) std::uint32_t CRC32ARMv8(
+            std::uint32_t crc, std::size_t size, const std::uint8_t *bytes)
+        {
+            crc = ~crc;
+            for (; size >= 8; size -= 8, bytes += 8) {
+                std::uint64_t word;
+                std::memcpy(&word, bytes, sizeof(word));
+                crc = __crc32d(crc, word);
+            }
+            for (; size > 0; --size, ++bytes) {
+                crc = __crc32b(crc, *bytes);
+            }
+            return ~crc;
+        }
+#endif
+
+        struct Implementation
+        {
+            CRC32Function function;
+            const char *name;
+        };
+
+        Implementation ChooseImplementation()
+        {
+#if APPX_HAVE_PCLMUL
+            if (HasPCLMUL()) {
+                return Implementation{CRC32PCLMUL, "pclmul"};
+            }
+#endif
+#if APPX_HAVE_ARMV8_CRC
+            if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+                return Implementation{CRC32ARMv8, "armv8"};
+            }
+#endif
+            return Implementation{CRC32Zlib, "zlib"};
+        }
+
+        const Implementation &GetImplementation()
+        {
+            static const Implementation implementation = ChooseImplementation();
+            return implementation;
+        }
+    }
+
+    std::uint32_t CRC32Update(std::uint32_t crc, std::size_t size,
+                              const std::uint8_t *bytes)
+    {
+        if (size == 0) {
+            return crc;
+        }
+        return GetImplementation().function(crc, size, bytes);
+    }
+
+    std::uint32_t CRC32Combine(std::uint32_t crcA, std::uint32_t crcB,
+                               off_t sizeB)
+    {
+        return static_cast<std::uint32_t>(
+            crc32_combine64(crcA, crcB, static_cast<z_off64_t>(sizeB)));
+    }
+
+    const char *CRC32Implementation()
+    {
+        return GetImplementation().name;
+    }
+}
+}
@@ -0,0 +1,197 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#include <APPX/Compression.h>
+#include <APPX/Deflate.h>
+#include <APPX/File.h>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <fnmatch.h>
+#include <stdexcept>
+#include <sys/stat.h>
+
+namespace osinside {
+namespace appx {
+    namespace {
+        // Sampling for CompressionPolicy::Method::Auto.
+        enum
+        {
+            kAutoSampleBlockSize = 65536,
+            kAutoSampleBlockCount = 4,
+            // A sample which compresses to at least this percentage of its
+            // size is considered incompressible.
+            kAutoStorePercent = 97,
+        };
+
+        std::string ToLower(std::string s)
+        {
+            for (char &c : s) {
+                c = static_cast<char>(
+                    std::tolower(static_cast<unsigned char>(c)));
+            }
+            return s;
+        }
+
+        int ParseLevel(const std::string &spec, const std::string &level)
+        {
+            char *end;
+            errno = 0;
+            long value = std::strtol(level.c_str(), &end, 10);
+            if (errno != 0 || level.empty() || *end != '\0' ||
+                value < Z_NO_COMPRESSION || value > Z_BEST_COMPRESSION) {
+                throw std::invalid_argument("Invalid compression level in " +
+                                            spec);
+            }
+            return static_cast<int>(value);
+        }
+    }
+
+    CompressionPolicy ParseCompressionPolicy(const std::string &spec,
+                                             int defaultLevel)
+    {
+        std::string name = spec;
+        int level = defaultLevel;
+        bool hasLevel = false;
+        std::string::size_type colon = spec.find(':');
+        if (colon != std::string::npos) {
+            name = spec.substr(0, colon);
+            level = ParseLevel(spec, spec.substr(colon + 1));
+            hasLevel = true;
+        }
+        if (name == "store" && !hasLevel) {
+            return CompressionPolicy::Store();
+        }
+        if (name == "deflate") {
+            return CompressionPolicy::Deflate(level);
+        }
+        if (name == "filtered") {
+            return CompressionPolicy::Deflate(level, Z_FILTERED);
+        }
+        // The level does not matter for these strategies.
+        if (name == "huffman" && !hasLevel) {
+            return CompressionPolicy::Deflate(level, Z_HUFFMAN_ONLY);
+        }
+        if (name == "rle" && !hasLevel) {
+            return CompressionPolicy::Deflate(level, Z_RLE);
+        }
+        if (name == "auto") {
+            return CompressionPolicy{CompressionPolicy::Method::Auto, level,
+                                     Z_DEFAULT_STRATEGY};
+        }
+        throw std::invalid_argument("Invalid compression policy: " + spec);
+    }
+
+    CompressionPolicies::CompressionPolicies(CompressionPolicy defaultPolicy)
+        : defaultPolicy(defaultPolicy)
+    {
+    }
+
+    void CompressionPolicies::Add(const std::string &patterns,
+                                  CompressionPolicy policy)
+    {
+        Rule rule{{}, {}, policy};
+        std::string::size_type start = 0;
+        for (;;) {
+            std::string::size_type comma = patterns.find(',', start);
+            std::string pattern = patterns.substr(
+                start,
+                comma == std::string::npos ? std::string::npos : comma - start);
+            if (pattern.empty()) {
+                throw std::invalid_argument("Empty pattern in " + patterns);
+            }
+            if (pattern[0] == '.') {
+                rule.extensions.push_back(ToLower(pattern.substr(1)));
+            } else {
+                rule.wildcards.push_back(pattern);
+            }
+            if (comma == std::string::npos) {
+                break;
+            }
+            start = comma + 1;
+        }
+        this->rules.push_back(std::move(rule));
+    }
+
+    const CompressionPolicy &CompressionPolicies::ForArchiveName(
+        const std::string &archiveName) const
+    {
+        // Extensions are matched like in [Content_Types].xml.
+        std::string extension;
+        std::string::size_type baseNamePos = archiveName.rfind('/') + 1;
+        std::string::size_type extensionPos = archiveName.rfind('.') + 1;
+        if (extensionPos > baseNamePos) {
+            extension = ToLower(archiveName.substr(extensionPos));
+        }
+        for (const Rule &rule : this->rules) {
+            for (const std::string &ruleExtension : rule.extensions) {
+                if (!extension.empty() && ruleExtension == extension) {
+                    return rule.policy;
+                }
+            }
+            for (const std::string &wildcard : rule.wildcards) {
+                if (fnmatch(wildcard.c_str(), archiveName.c_str(), 0) == 0) {
+                    return rule.policy;
+                }
+            }
+        }
+        return this->defaultPolicy;
+    }
+
+    CompressionPolicy ResolveAutoCompression(const CompressionPolicy &policy,
+                                             const std::string &inputFileName)
+    {
+        if (policy.method != CompressionPolicy::Method::Auto) {
+            return policy;
+        }
+        CompressionPolicy deflate =
+            CompressionPolicy::Deflate(policy.level, policy.strategy);
+        FilePtr file = Open(inputFileName, "rb");
+        struct stat status;
+        if (fstat(fileno(file.get()), &status) != 0) {
+            throw ErrnoException(inputFileName);
+        }
+        if (!S_ISREG(status.st_mode)) {
+            return deflate;
+        }
+
+        // Sample blocks spread evenly over the file, so a compressible
+        // header does not hide incompressible contents (or vice versa).
+        off_t blockCount =
+            (status.st_size + kAutoSampleBlockSize - 1) / kAutoSampleBlockSize;
+        off_t sampleCount = std::min(blockCount, off_t(kAutoSampleBlockCount));
+        std::vector<std::uint8_t> block(kAutoSampleBlockSize);
+        std::vector<std::uint8_t> compressed;
+        off_t sampledSize = 0;
+        for (off_t i = 0; i < sampleCount; ++i) {
+            off_t blockIndex =
+                sampleCount == 1 ? 0 : i * (blockCount - 1) / (sampleCount - 1);
+            std::size_t read =
+                ReadAt(file, blockIndex * kAutoSampleBlockSize, block.size(),
+                       block.data());
+            DeflateBlock(policy.level, policy.strategy, read, block.data(),
+                         compressed);
+            sampledSize += read;
+        }
+        if (IsIncompressibleSample(sampledSize,
+                                   static_cast<off_t>(compressed.size()))) {
+            return CompressionPolicy::Store();
+        }
+        return deflate;
+    }
+
+    bool IsIncompressibleSample(off_t sampledSize, off_t compressedSize)
+    {
+        return compressedSize * 100 >= sampledSize * kAutoStorePercent;
+    }
+}
+}
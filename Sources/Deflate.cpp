@@ -0,0 +1,234 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#include <APPX/Deflate.h>
+#include <APPX/DeflateBackends.h>
+#include <APPX/Memory.h>
+#include <atomic>
+#include <limits>
+#include <stdexcept>
+
+#ifndef APPX_DEFAULT_DEFLATE_BACKEND
+#define APPX_DEFAULT_DEFLATE_BACKEND "zlib"
+#endif
+
+namespace osinside {
+namespace appx {
+    namespace {
+        // A z_stream which lives as long as its thread. Resetting the stream
+        // for each block avoids deflateInit2 allocating the compressor state
+        // over and over.
+        class ThreadDeflateStream
+        {
+        public:
+            ~ThreadDeflateStream()
+            {
+                if (this->initialized) {
+                    deflateEnd(&this->stream);
+                }
+            }
+
+            z_stream &Get(int compressionLevel, int strategy)
+            {
+                if (this->initialized &&
+                    this->compressionLevel == compressionLevel &&
+                    this->strategy == strategy) {
+                    if (deflateReset(&this->stream) != Z_OK) {
+                        throw std::runtime_error("deflateReset failed");
+                    }
+                    return this->stream;
+                }
+                if (this->initialized) {
+                    deflateEnd(&this->stream);
+                    this->initialized = false;
+                }
+                CountZlibAllocations(this->stream);
+                int rc =
+                    deflateInit2(&this->stream, compressionLevel, Z_DEFLATED,
+                                 -MAX_WBITS, MAX_MEM_LEVEL, strategy);
+                if (rc != Z_OK) {
+                    throw std::runtime_error("deflateInit failed");
+                }
+                this->initialized = true;
+                this->compressionLevel = compressionLevel;
+                this->strategy = strategy;
+                return this->stream;
+            }
+
+        private:
+            z_stream stream;
+            int compressionLevel;
+            int strategy;
+            bool initialized = false;
+        };
+
+        thread_local ThreadDeflateStream threadDeflateStream;
+
+        // The end of a raw DEFLATE stream after a full flush: an empty final
+        // block with fixed Huffman codes. This is what zlib writes at every
+        // level but Z_NO_COMPRESSION, which ends with an empty stored block.
+        const std::uint8_t kFinalBlock[] = {0x03, 0x00};
+
+        std::atomic<DeflateBackend> &SelectedBackend()
+        {
+            static std::atomic<DeflateBackend> backend(
+                ParseDeflateBackend(APPX_DEFAULT_DEFLATE_BACKEND));
+            return backend;
+        }
+
+        void Deflate(z_stream &stream, int flushMode,
+                     std::vector<std::uint8_t> &out)
+        {
+            std::size_t used = out.size();
+            out.resize(used + deflateBound(&stream, stream.avail_in) + 16);
+            for (;;) {
+                std::size_t available = out.size() - used;
+                stream.next_out = out.data() + used;
+                stream.avail_out = static_cast<uInt>(available);
+                int rc = deflate(&stream, flushMode);
+                if (rc == Z_STREAM_ERROR) {
+                    throw std::runtime_error("deflate failed");
+                }
+                used += available - stream.avail_out;
+                if (stream.avail_out != 0) {
+                    break;
+                }
+                out.resize(out.size() * 2);
+            }
+            out.resize(used);
+        }
+    }
+
+    DeflateBackend ParseDeflateBackend(const std::string &name)
+    {
+        if (name == "zlib") {
+            return DeflateBackend::Zlib;
+        }
+        if (name == "zlib-ng") {
+            return DeflateBackend::ZlibNG;
+        }
+        if (name == "isal") {
+            return DeflateBackend::ISAL;
+        }
+        throw std::invalid_argument("Unknown DEFLATE backend: " + name);
+    }
+
+    const char *DeflateBackendName(DeflateBackend backend)
+    {
+        switch (backend) {
+            case DeflateBackend::Zlib:
+                return "zlib";
+            case DeflateBackend::ZlibNG:
+                return "zlib-ng";
+            case DeflateBackend::ISAL:
+                return "isal";
+        }
+        return "unknown";
+    }
+
+    bool IsDeflateBackendAvailable(DeflateBackend backend)
+    {
+        switch (backend) {
+            case DeflateBackend::Zlib:
+                return true;
+            case DeflateBackend::ZlibNG:
+#if APPX_HAVE_ZLIB_NG
+                return true;
+#else
+                return false;
+#endif
+            case DeflateBackend::ISAL:
+#if APPX_HAVE_ISAL
+                return true;
+#else
+                return false;
+#endif
+        }
+        return false;
+    }
+
+    void SetDeflateBackend(DeflateBackend backend)
+    {
+        if (!IsDeflateBackendAvailable(backend)) {
+            throw std::invalid_argument(
+                std::string("DEFLATE backend is not available: ") +
+                DeflateBackendName(backend));
+        }
+        SelectedBackend().store(backend, std::memory_order_relaxed);
+    }
+
+    DeflateBackend GetDeflateBackend()
+    {
+        return SelectedBackend().load(std::memory_order_relaxed);
+    }
+
+    std::string DeflateBackendVersion()
+    {
+        switch (GetDeflateBackend()) {
+#if APPX_HAVE_ZLIB_NG
+            case DeflateBackend::ZlibNG:
+                return ZlibNGVersion();
+#endif
+#if APPX_HAVE_ISAL
+            case DeflateBackend::ISAL:
+                return ISALVersion();
+#endif
+            default:
+                // Just the version, as block cache entries were keyed before
+                // there were other backends.
+                return zlibVersion();
+        }
+    }
+
+    void DeflateBlock(int compressionLevel, int strategy, std::size_t size,
+                      const std::uint8_t *bytes, std::vector<std::uint8_t> &out)
+    {
+        switch (GetDeflateBackend()) {
+#if APPX_HAVE_ZLIB_NG
+            case DeflateBackend::ZlibNG:
+                DeflateBlockZlibNG(compressionLevel, strategy, size, bytes,
+                                   out);
+                return;
+#endif
+#if APPX_HAVE_ISAL
+            case DeflateBackend::ISAL:
+                DeflateBlockISAL(compressionLevel, size, bytes, out);
+                return;
+#endif
+            default:
+                break;
+        }
+        if (size > std::numeric_limits<uInt>::max()) {
+            throw std::range_error("Block is too big for zlib's deflate");
+        }
+        z_stream &stream = threadDeflateStream.Get(compressionLevel, strategy);
+        stream.next_in = const_cast<std::uint8_t *>(bytes);
+        stream.avail_in = static_cast<uInt>(size);
+        Deflate(stream, Z_FULL_FLUSH, out);
+    }
+
+    void DeflateFinish(int compressionLevel, int strategy,
+                       std::vector<std::uint8_t> &out)
+    {
+        // Resetting zlib's stream just to finish it clears its hash table,
+        // which costs more than compressing a small file.
+        if (GetDeflateBackend() != DeflateBackend::Zlib ||
+            compressionLevel != Z_NO_COMPRESSION) {
+            out.insert(out.end(), kFinalBlock,
+                       kFinalBlock + sizeof(kFinalBlock));
+            return;
+        }
+        z_stream &stream = threadDeflateStream.Get(compressionLevel, strategy);
+        stream.next_in = nullptr;
+        stream.avail_in = 0;
+        Deflate(stream, Z_FINISH, out);
+    }
+}
+}
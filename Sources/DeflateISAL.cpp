@@ -0,0 +1,106 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#include <APPX/DeflateBackends.h>
+#include <algorithm>
+#include <isa-l.h>
+#include <limits>
+#include <stdexcept>
+
+namespace osinside {
+namespace appx {
+    namespace {
+        // Maps a zlib compression level (1 to 9) to an ISA-L level.
+        int ISALLevel(int compressionLevel)
+        {
+            int level =
+                compressionLevel <= 3 ? 1 : compressionLevel <= 6 ? 2 : 3;
+            return std::min(level, ISAL_DEF_MAX_LEVEL);
+        }
+
+        std::size_t LevelBufferSize(int level)
+        {
+            switch (level) {
+                case 1:
+                    return ISAL_DEF_LVL1_DEFAULT;
+                case 2:
+                    return ISAL_DEF_LVL2_DEFAULT;
+                case 3:
+                    return ISAL_DEF_LVL3_DEFAULT;
+                default:
+                    return 0;
+            }
+        }
+
+        // The compressor state and level buffer of this thread, allocated
+        // once rather than for every block.
+        class ThreadISALStream
+        {
+        public:
+            isal_zstream &Get(int compressionLevel)
+            {
+                int level = ISALLevel(compressionLevel);
+                this->levelBuffer.resize(LevelBufferSize(level));
+                isal_deflate_init(&this->stream);
+                this->stream.level = static_cast<std::uint32_t>(level);
+                this->stream.level_buf = this->levelBuffer.data();
+                this->stream.level_buf_size =
+                    static_cast<std::uint32_t>(this->levelBuffer.size());
+                this->stream.gzip_flag = IGZIP_DEFLATE;
+                this->stream.flush = FULL_FLUSH;
+                this->stream.end_of_stream = 0;
+                return this->stream;
+            }
+
+        private:
+            isal_zstream stream;
+            std::vector<std::uint8_t> levelBuffer;
+        };
+
+        thread_local ThreadISALStream threadISALStream;
+    }
+
+    void DeflateBlockISAL(int compressionLevel, std::size_t size,
+                          const std::uint8_t *bytes,
+                          std::vector<std::uint8_t> &out)
+    {
+        if (size > std::numeric_limits<std::uint32_t>::max()) {
+            throw std::range_error("Block is too big for ISA-L's deflate");
+        }
+        isal_zstream &stream = threadISALStream.Get(compressionLevel);
+        stream.next_in = const_cast<std::uint8_t *>(bytes);
+        stream.avail_in = static_cast<std::uint32_t>(size);
+        std::size_t used = out.size();
+        // Incompressible data grows by a few bytes per stored block.
+        out.resize(used + size + size / 16 + 64);
+        for (;;) {
+            std::size_t available = out.size() - used;
+            stream.next_out = out.data() + used;
+            stream.avail_out = static_cast<std::uint32_t>(available);
+            if (isal_deflate(&stream) != COMP_OK) {
+                throw std::runtime_error("isal_deflate failed");
+            }
+            used += available - stream.avail_out;
+            if (stream.avail_in == 0 && stream.avail_out != 0) {
+                break;
+            }
+            out.resize(out.size() * 2);
+        }
+        out.resize(used);
+    }
+
+    std::string ISALVersion()
+    {
+        return "isal " + std::to_string(ISAL_MAJOR_VERSION) + "." +
+               std::to_string(ISAL_MINOR_VERSION) + "." +
+               std::to_string(ISAL_PATCH_VERSION);
+    }
+}
+}
@@ -0,0 +1,104 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#include <APPX/DeflateBackends.h>
+#include <limits>
+#include <stdexcept>
+#include <zlib-ng.h>
+
+namespace osinside {
+namespace appx {
+    namespace {
+        // See ThreadDeflateStream in Deflate.cpp.
+        class ThreadZlibNGStream
+        {
+        public:
+            ~ThreadZlibNGStream()
+            {
+                if (this->initialized) {
+                    zng_deflateEnd(&this->stream);
+                }
+            }
+
+            zng_stream &Get(int compressionLevel, int strategy)
+            {
+                if (this->initialized &&
+                    this->compressionLevel == compressionLevel &&
+                    this->strategy == strategy) {
+                    if (zng_deflateReset(&this->stream) != Z_OK) {
+                        throw std::runtime_error("zng_deflateReset failed");
+                    }
+                    return this->stream;
+                }
+                if (this->initialized) {
+                    zng_deflateEnd(&this->stream);
+                    this->initialized = false;
+                }
+                this->stream.zalloc = nullptr;
+                this->stream.zfree = nullptr;
+                this->stream.opaque = nullptr;
+                int rc = zng_deflateInit2(&this->stream, compressionLevel,
+                                          Z_DEFLATED, -MAX_WBITS,
+                                          MAX_MEM_LEVEL, strategy);
+                if (rc != Z_OK) {
+                    throw std::runtime_error("zng_deflateInit2 failed");
+                }
+                this->initialized = true;
+                this->compressionLevel = compressionLevel;
+                this->strategy = strategy;
+                return this->stream;
+            }
+
+        private:
+            zng_stream stream;
+            int compressionLevel;
+            int strategy;
+            bool initialized = false;
+        };
+
+        thread_local ThreadZlibNGStream threadZlibNGStream;
+    }
+
+    void DeflateBlockZlibNG(int compressionLevel, int strategy,
+                            std::size_t size, const std::uint8_t *bytes,
+                            std::vector<std::uint8_t> &out)
+    {
+        if (size > std::numeric_limits<std::uint32_t>::max()) {
+            throw std::range_error("Block is too big for zlib-ng's deflate");
+        }
+        zng_stream &stream =
+            threadZlibNGStream.Get(compressionLevel, strategy);
+        stream.next_in = bytes;
+        stream.avail_in = static_cast<std::uint32_t>(size);
+        std::size_t used = out.size();
+        out.resize(used + zng_deflateBound(&stream, size) + 16);
+        for (;;) {
+            std::size_t available = out.size() - used;
+            stream.next_out = out.data() + used;
+            stream.avail_out = static_cast<std::uint32_t>(available);
+            int rc = zng_deflate(&stream, Z_FULL_FLUSH);
+            if (rc == Z_STREAM_ERROR) {
+                throw std::runtime_error("zng_deflate failed");
+            }
+            used += available - stream.avail_out;
+            if (stream.avail_out != 0) {
+                break;
+            }
+            out.resize(out.size() * 2);
+        }
+        out.resize(used);
+    }
+
+    std::string ZlibNGVersion()
+    {
+        return std::string("zlib-ng ") + zlibng_version();
+    }
+}
+}
@@ -0,0 +1,324 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#include <APPX/DirectoryWalker.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <dirent.h>
+#include <exception>
+#include <fcntl.h>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <thread>
+
+namespace osinside {
+namespace appx {
+    namespace {
+        enum
+        {
+            // Threads reading directories, per CPU and at most. Reading a
+            // directory mostly waits for the file system, so there are more
+            // threads than CPUs.
+            kThreadsPerCPU = 2,
+            kMaxThreadCount = 8,
+        };
+
+        struct DirectoryDeleter
+        {
+            void operator()(DIR *directory)
+            {
+                closedir(directory);
+            }
+        };
+
+        struct Directory
+        {
+            std::string path;
+            // Empty for the directory which is walked.
+            std::string archiveName;
+        };
+
+        // Appends name to a directory's path. Like fts, does not double a
+        // trailing slash (e.g. of "/").
+        std::string JoinPath(const std::string &directory, const char *name)
+        {
+            std::string path = directory;
+            if (path.empty() || path.back() != '/') {
+                path += '/';
+            }
+            path += name;
+            return path;
+        }
+
+        bool GetStatus(int directoryFD, const char *path, FileStatus &status)
+        {
+#if APPX_HAVE_STATX
+            // Asks only for what FileStatus holds, which saves work on
+            // network file systems.
+            struct statx buffer;
+            if (statx(directoryFD, path, AT_STATX_SYNC_AS_STAT,
+                      STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_INO,
+                      &buffer) != 0) {
+                return false;
+            }
+            status.mode = buffer.stx_mode;
+            status.size = static_cast<off_t>(buffer.stx_size);
+            status.device = makedev(buffer.stx_dev_major, buffer.stx_dev_minor);
+            status.inode = buffer.stx_ino;
+#else
+            struct stat buffer;
+            if (fstatat(directoryFD, path, &buffer, 0) != 0) {
+                return false;
+            }
+            status.mode = buffer.st_mode;
+            status.size = buffer.st_size;
+            status.device = buffer.st_dev;
+            status.inode = buffer.st_ino;
+#endif
+            return true;
+        }
+
+        class Walker
+        {
+        public:
+            // Uses at most maxThreadCount threads.
+            explicit Walker(std::size_t maxThreadCount)
+                : queues(maxThreadCount), files(maxThreadCount)
+            {
+            }
+
+            void Run(Directory root, std::vector<WalkedFile> &files)
+            {
+                this->queues[0].directories.push_back(std::move(root));
+                this->queuedCount = 1;
+                this->pendingCount = 1;
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    this->StartThreads(1);
+                }
+                // Threads are only started by running threads, so once
+                // every thread started so far has finished, none are left.
+                for (std::size_t i = 0;; ++i) {
+                    std::thread thread;
+                    {
+                        std::lock_guard<std::mutex> lock(this->mutex);
+                        if (i == this->threads.size()) {
+                            break;
+                        }
+                        thread = std::move(this->threads[i]);
+                    }
+                    thread.join();
+                }
+                if (this->error) {
+                    std::rethrow_exception(this->error);
+                }
+                for (std::vector<WalkedFile> &threadFiles : this->files) {
+                    files.insert(files.end(),
+                                 std::make_move_iterator(threadFiles.begin()),
+                                 std::make_move_iterator(threadFiles.end()));
+                }
+            }
+
+        private:
+            struct Queue
+            {
+                std::mutex mutex;
+                std::deque<Directory> directories;
+            };
+
+            // Starts up to count more threads. Must be called with mutex
+            // held.
+            void StartThreads(std::size_t count)
+            {
+                while (count > 0 &&
+                       this->threads.size() < this->queues.size()) {
+                    this->threads.emplace_back(&Walker::RunThread, this,
+                                               this->threads.size());
+                    --count;
+                }
+            }
+
+            void RunThread(std::size_t index)
+            {
+                Directory directory;
+                while (this->TakeDirectory(index, directory)) {
+                    try {
+                        this->ReadDirectory(index, directory);
+                    } catch (...) {
+                        std::lock_guard<std::mutex> lock(this->mutex);
+                        if (!this->error) {
+                            this->error = std::current_exception();
+                        }
+                        this->stopping = true;
+                        this->workQueued.notify_all();
+                        return;
+                    }
+                    if (--this->pendingCount == 0) {
+                        std::lock_guard<std::mutex> lock(this->mutex);
+                        this->workQueued.notify_all();
+                    }
+                }
+            }
+
+            // Takes the newest directory from the thread's own queue, so
+            // threads walk depth first, or else the oldest directory from
+            // another thread's queue, which likely has the most left under
+            // it. Returns false once every directory was read.
+            bool TakeDirectory(std::size_t index, Directory &directory)
+            {
+                while (!this->stopping) {
+                    for (std::size_t i = 0; i < this->queues.size(); ++i) {
+                        Queue &queue =
+                            this->queues[(index + i) % this->queues.size()];
+                        std::lock_guard<std::mutex> lock(queue.mutex);
+                        if (queue.directories.empty()) {
+                            continue;
+                        }
+                        if (i == 0) {
+                            directory = std::move(queue.directories.back());
+                            queue.directories.pop_back();
+                        } else {
+                            directory = std::move(queue.directories.front());
+                            queue.directories.pop_front();
+                        }
+                        --this->queuedCount;
+                        return true;
+                    }
+                    std::unique_lock<std::mutex> lock(this->mutex);
+                    ++this->idleCount;
+                    this->workQueued.wait(lock, [this]() {
+                        return this->stopping || this->pendingCount == 0 ||
+                               this->queuedCount > 0;
+                    });
+                    --this->idleCount;
+                    if (this->pendingCount == 0) {
+                        return false;
+                    }
+                }
+                return false;
+            }
+
+            void ReadDirectory(std::size_t index, const Directory &directory)
+            {
+                std::unique_ptr<DIR, DirectoryDeleter> stream(
+                    opendir(directory.path.c_str()));
+                if (!stream) {
+                    throw ErrnoException(directory.path);
+                }
+                int fd = dirfd(stream.get());
+                std::vector<WalkedFile> &files = this->files[index];
+                std::vector<Directory> subdirectories;
+                for (;;) {
+                    errno = 0;
+                    struct dirent *entry = readdir(stream.get());
+                    if (!entry) {
+                        if (errno != 0) {
+                            throw ErrnoException(directory.path);
+                        }
+                        break;
+                    }
+                    const char *name = entry->d_name;
+                    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+                        continue;
+                    }
+                    bool isDirectory = entry->d_type == DT_DIR;
+                    if (entry->d_type == DT_UNKNOWN) {
+                        struct stat status;
+                        isDirectory = fstatat(fd, name, &status,
+                                              AT_SYMLINK_NOFOLLOW) == 0 &&
+                                      S_ISDIR(status.st_mode);
+                    }
+                    std::string path = JoinPath(directory.path, name);
+                    std::string archiveName =
+                        directory.archiveName.empty()
+                            ? std::string(name)
+                            : directory.archiveName + "/" + name;
+                    if (isDirectory) {
+                        subdirectories.push_back(
+                            Directory{std::move(path), std::move(archiveName)});
+                        continue;
+                    }
+                    WalkedFile file{std::move(archiveName), std::move(path),
+                                    false, FileStatus()};
+                    file.hasStatus = GetStatus(fd, name, file.status);
+                    files.push_back(std::move(file));
+                }
+
+                if (subdirectories.empty()) {
+                    return;
+                }
+                this->pendingCount += subdirectories.size();
+                {
+                    Queue &queue = this->queues[index];
+                    std::lock_guard<std::mutex> lock(queue.mutex);
+                    for (Directory &subdirectory : subdirectories) {
+                        queue.directories.push_back(std::move(subdirectory));
+                    }
+                }
+                this->queuedCount += subdirectories.size();
+                std::lock_guard<std::mutex> lock(this->mutex);
+                if (this->idleCount > 0) {
+                    this->workQueued.notify_all();
+                }
+                // This thread takes one of the subdirectories itself.
+                if (subdirectories.size() > this->idleCount + 1) {
+                    this->StartThreads(subdirectories.size() -
+                                       this->idleCount - 1);
+                }
+            }
+
+            std::vector<Queue> queues;
+            // Found by each thread.
+            std::vector<std::vector<WalkedFile>> files;
+            // Directories in queues.
+            std::atomic<std::size_t> queuedCount{0};
+            // Directories in queues or being read.
+            std::atomic<std::size_t> pendingCount{0};
+
+            std::mutex mutex;
+            std::condition_variable workQueued;
+            // Started as directories are queued for them; see StartThreads.
+            std::vector<std::thread> threads;
+            std::size_t idleCount = 0;
+            // Set once a directory cannot be read.
+            std::atomic<bool> stopping{false};
+            std::exception_ptr error;
+        };
+    }
+
+    void WalkDirectory(const std::string &path, std::vector<WalkedFile> &files)
+    {
+        // Like fts without FTS_COMFOLLOW, a symbolic link to a directory is
+        // a file, and a path which cannot be looked up is left for opening
+        // to report.
+        struct stat status;
+        if (lstat(path.c_str(), &status) != 0 || !S_ISDIR(status.st_mode)) {
+            std::string::size_type slash = path.rfind('/');
+            WalkedFile file{slash == std::string::npos
+                                ? path
+                                : path.substr(slash + 1),
+                            path, false, FileStatus()};
+            file.hasStatus = GetStatus(AT_FDCWD, path.c_str(), file.status);
+            files.push_back(std::move(file));
+            return;
+        }
+        std::size_t threadCount = std::min(
+            std::max(std::thread::hardware_concurrency(), 1U) * kThreadsPerCPU,
+            unsigned(kMaxThreadCount));
+        Walker(threadCount).Run(Directory{path, std::string()}, files);
+    }
+}
+}
@@ -9,6 +9,14 @@
 // See the LICENSE-BSD file in the root directory of this source tree for details.
 
 #include <APPX/File.h>
+#include <fcntl.h>
+#include <limits>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace osinside {
 namespace appx {
@@ -35,5 +43,115 @@ namespace appx {
           error(error)
     {
     }
+
+    std::size_t ReadAt(const FilePtr &file, off_t offset, std::size_t size,
+                       void *bytes)
+    {
+        if (std::fflush(file.get()) != 0) {
+            throw ErrnoException();
+        }
+        int fd = fileno(file.get());
+        char *data = static_cast<char *>(bytes);
+        std::size_t total = 0;
+        while (total < size) {
+            ssize_t read = pread(fd, data + total, size - total, offset + total);
+            if (read < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw ErrnoException();
+            }
+            if (read == 0) {
+                break;
+            }
+            total += read;
+        }
+        return total;
+    }
+
+    std::size_t ReadSmallFile(const std::string &path, std::size_t capacity,
+                              std::uint8_t *bytes)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            throw ErrnoException(path);
+        }
+        std::size_t total = 0;
+        while (total < capacity) {
+            ssize_t read = ::read(fd, bytes + total, capacity - total);
+            if (read < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                int error = errno;
+                close(fd);
+                throw ErrnoException(path, error);
+            }
+            if (read == 0) {
+                break;
+            }
+            total += read;
+        }
+        close(fd);
+        return total;
+    }
+
+    MappedFile::MappedFile(const FilePtr &file) : data(nullptr), size(0)
+    {
+        int fd = fileno(file.get());
+        struct stat status;
+        if (fstat(fd, &status) != 0) {
+            throw ErrnoException();
+        }
+        if (!S_ISREG(status.st_mode) || status.st_size == 0 ||
+            static_cast<std::uint64_t>(status.st_size) >
+                std::numeric_limits<std::size_t>::max()) {
+            return;
+        }
+        std::size_t size = static_cast<std::size_t>(status.st_size);
+        void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            // E.g. the address space is limited. The file can still be
+            // read.
+            return;
+        }
+        // Only a hint, so failure does not matter.
+        madvise(data, size, MADV_SEQUENTIAL);
+        this->data = static_cast<const std::uint8_t *>(data);
+        this->size = size;
+    }
+
+    MappedFile::~MappedFile()
+    {
+        if (this->data) {
+            munmap(const_cast<std::uint8_t *>(this->data), this->size);
+        }
+    }
+
+    bool GetPhysicalOffset(const std::string &path, std::uint64_t &offset)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return false;
+        }
+        // Room for the first extent only.
+        alignas(struct fiemap) std::uint8_t
+            buffer[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+        std::memset(buffer, 0, sizeof(buffer));
+        struct fiemap *map = reinterpret_cast<struct fiemap *>(buffer);
+        map->fm_start = 0;
+        map->fm_length = FIEMAP_MAX_OFFSET;
+        map->fm_extent_count = 1;
+        int rc = ioctl(fd, FS_IOC_FIEMAP, map);
+        close(fd);
+        const struct fiemap_extent &extent = map->fm_extents[0];
+        if (rc != 0 || map->fm_mapped_extents == 0 ||
+            (extent.fe_flags &
+             (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DATA_INLINE))) {
+            return false;
+        }
+        offset = extent.fe_physical;
+        return true;
+    }
 }
 }
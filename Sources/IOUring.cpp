@@ -0,0 +1,356 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#include <APPX/File.h>
+#include <APPX/IOUring.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#if APPX_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace osinside {
+namespace appx {
+#if APPX_HAVE_IO_URING
+    namespace {
+        void *MapRing(int fd, std::size_t size, off_t offset)
+        {
+            void *ring = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, fd, offset);
+            if (ring == MAP_FAILED) {
+                throw ErrnoException("io_uring");
+            }
+            return ring;
+        }
+
+        template <typename T>
+        T *RingField(void *ring, std::uint32_t offset)
+        {
+            return reinterpret_cast<T *>(static_cast<char *>(ring) + offset);
+        }
+
+        int Opcode(IOUring::Operation operation)
+        {
+            switch (operation) {
+                case IOUring::Operation::Read:
+                    return IORING_OP_READ;
+                case IOUring::Operation::Write:
+                    return IORING_OP_WRITE;
+                case IOUring::Operation::OpenAt:
+                    return IORING_OP_OPENAT;
+                case IOUring::Operation::Statx:
+                    return IORING_OP_STATX;
+                case IOUring::Operation::Close:
+                    return IORING_OP_CLOSE;
+            }
+            return -1;
+        }
+
+        unsigned OperationBit(IOUring::Operation operation)
+        {
+            return 1u << static_cast<unsigned>(operation);
+        }
+    }
+
+    IOUring::IOUring(unsigned entries)
+        : fd(-1),
+          supportedOperations(0),
+          submissionRing(nullptr),
+          completionRing(nullptr),
+          submissionEntries(nullptr),
+          pendingCount(0)
+    {
+        struct io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        this->fd = static_cast<int>(
+            syscall(__NR_io_uring_setup, entries, &params));
+        if (this->fd == -1) {
+            throw ErrnoException("io_uring");
+        }
+        try {
+            this->submissionRingSize =
+                params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            this->completionRingSize =
+                params.cq_off.cqes +
+                params.cq_entries * sizeof(struct io_uring_cqe);
+            // Newer kernels map both rings at once.
+            bool isSingleMapping = params.features & IORING_FEAT_SINGLE_MMAP;
+            if (isSingleMapping) {
+                this->submissionRingSize = this->completionRingSize =
+                    std::max(this->submissionRingSize,
+                             this->completionRingSize);
+            }
+            this->submissionRing = MapRing(
+                this->fd, this->submissionRingSize, IORING_OFF_SQ_RING);
+            this->completionRing =
+                isSingleMapping
+                    ? this->submissionRing
+                    : MapRing(this->fd, this->completionRingSize,
+                              IORING_OFF_CQ_RING);
+            this->submissionEntriesSize =
+                params.sq_entries * sizeof(struct io_uring_sqe);
+            this->submissionEntries = MapRing(
+                this->fd, this->submissionEntriesSize, IORING_OFF_SQES);
+        } catch (...) {
+            this->Close();
+            throw;
+        }
+
+        void *sq = this->submissionRing;
+        this->submissionHead = RingField<unsigned>(sq, params.sq_off.head);
+        this->submissionTail = RingField<unsigned>(sq, params.sq_off.tail);
+        this->submissionMask =
+            *RingField<unsigned>(sq, params.sq_off.ring_mask);
+        this->submissionArray = RingField<unsigned>(sq, params.sq_off.array);
+        void *cq = this->completionRing;
+        this->completionHead = RingField<unsigned>(cq, params.cq_off.head);
+        this->completionTail = RingField<unsigned>(cq, params.cq_off.tail);
+        this->completionMask =
+            *RingField<unsigned>(cq, params.cq_off.ring_mask);
+        this->completionEntries =
+            RingField<struct io_uring_cqe>(cq, params.cq_off.cqes);
+        this->ProbeOperations();
+    }
+
+    void IOUring::ProbeOperations()
+    {
+        // IORING_REGISTER_PROBE came in the same release as the operations,
+        // so if it fails, none of them are supported.
+        const unsigned kProbeCount = 256;
+        std::vector<std::uint8_t> buffer(
+            sizeof(struct io_uring_probe) +
+            kProbeCount * sizeof(struct io_uring_probe_op));
+        struct io_uring_probe *probe =
+            reinterpret_cast<struct io_uring_probe *>(buffer.data());
+        if (syscall(__NR_io_uring_register, this->fd, IORING_REGISTER_PROBE,
+                    probe, kProbeCount) != 0) {
+            return;
+        }
+        for (Operation operation :
+             {Operation::Read, Operation::Write, Operation::OpenAt,
+              Operation::Statx, Operation::Close}) {
+            int opcode = Opcode(operation);
+            if (opcode < probe->ops_len &&
+                (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED)) {
+                this->supportedOperations |= OperationBit(operation);
+            }
+        }
+    }
+
+    bool IOUring::Supports(Operation operation) const
+    {
+        return (this->supportedOperations & OperationBit(operation)) != 0;
+    }
+
+    IOUring::~IOUring()
+    {
+        this->Close();
+    }
+
+    void IOUring::Close()
+    {
+        if (this->submissionEntries) {
+            munmap(this->submissionEntries, this->submissionEntriesSize);
+        }
+        if (this->completionRing &&
+            this->completionRing != this->submissionRing) {
+            munmap(this->completionRing, this->completionRingSize);
+        }
+        if (this->submissionRing) {
+            munmap(this->submissionRing, this->submissionRingSize);
+        }
+        if (this->fd != -1) {
+            close(this->fd);
+        }
+        this->submissionEntries = nullptr;
+        this->completionRing = this->submissionRing = nullptr;
+        this->fd = -1;
+    }
+
+    bool IOUring::IsCompiledIn()
+    {
+        return true;
+    }
+
+    bool IOUring::Prepare(int opcode, int fd, std::uint64_t address,
+                          std::size_t size, std::uint64_t offset,
+                          std::uint32_t flags, std::uint64_t userData)
+    {
+        // Only this thread moves the tail, but the kernel moves the head.
+        unsigned tail = *this->submissionTail;
+        unsigned head = __atomic_load_n(this->submissionHead, __ATOMIC_ACQUIRE);
+        if (tail - head > this->submissionMask) {
+            return false;
+        }
+        unsigned index = tail & this->submissionMask;
+        struct io_uring_sqe *entry =
+            static_cast<struct io_uring_sqe *>(this->submissionEntries) +
+            index;
+        std::memset(entry, 0, sizeof(*entry));
+        entry->opcode = static_cast<std::uint8_t>(opcode);
+        entry->fd = fd;
+        entry->addr = address;
+        entry->len = static_cast<std::uint32_t>(size);
+        entry->off = offset;
+        entry->rw_flags = flags;
+        entry->user_data = userData;
+        this->submissionArray[index] = index;
+        __atomic_store_n(this->submissionTail, tail + 1, __ATOMIC_RELEASE);
+        ++this->pendingCount;
+        return true;
+    }
+
+    bool IOUring::PrepareWrite(int fd, const void *bytes, std::size_t size,
+                               off_t offset, std::uint64_t userData)
+    {
+        return this->Prepare(IORING_OP_WRITE, fd,
+                             reinterpret_cast<std::uintptr_t>(bytes), size,
+                             static_cast<std::uint64_t>(offset), 0, userData);
+    }
+
+    bool IOUring::PrepareRead(int fd, void *bytes, std::size_t size,
+                              off_t offset, std::uint64_t userData)
+    {
+        return this->Prepare(IORING_OP_READ, fd,
+                             reinterpret_cast<std::uintptr_t>(bytes), size,
+                             static_cast<std::uint64_t>(offset), 0, userData);
+    }
+
+    bool IOUring::PrepareOpenAt(int directoryFD, const char *path, int flags,
+                                std::uint64_t userData)
+    {
+        // len is the mode of a created file.
+        return this->Prepare(IORING_OP_OPENAT, directoryFD,
+                             reinterpret_cast<std::uintptr_t>(path), 0, 0,
+                             static_cast<std::uint32_t>(flags), userData);
+    }
+
+    bool IOUring::PrepareStatx(int directoryFD, const char *path, int flags,
+                               unsigned mask, struct statx *status,
+                               std::uint64_t userData)
+    {
+        // off is where the result is stored; len is the mask.
+        return this->Prepare(IORING_OP_STATX, directoryFD,
+                             reinterpret_cast<std::uintptr_t>(path), mask,
+                             reinterpret_cast<std::uintptr_t>(status),
+                             static_cast<std::uint32_t>(flags), userData);
+    }
+
+    bool IOUring::PrepareClose(int fd, std::uint64_t userData)
+    {
+        return this->Prepare(IORING_OP_CLOSE, fd, 0, 0, 0, 0, userData);
+    }
+
+    void IOUring::Submit(unsigned waitCount)
+    {
+        unsigned flags = waitCount > 0 ? IORING_ENTER_GETEVENTS : 0;
+        for (;;) {
+            long rc = syscall(__NR_io_uring_enter, this->fd,
+                              this->pendingCount, waitCount, flags, nullptr,
+                              0);
+            // The kernel may have consumed some entries even if it failed.
+            this->pendingCount =
+                *this->submissionTail -
+                __atomic_load_n(this->submissionHead, __ATOMIC_ACQUIRE);
+            if (rc < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw ErrnoException("io_uring");
+            }
+            if (this->pendingCount == 0) {
+                return;
+            }
+        }
+    }
+
+    bool IOUring::PopCompletion(std::uint64_t &userData, int &result)
+    {
+        unsigned head = *this->completionHead;
+        unsigned tail = __atomic_load_n(this->completionTail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            return false;
+        }
+        const struct io_uring_cqe *entry =
+            static_cast<const struct io_uring_cqe *>(this->completionEntries) +
+            (head & this->completionMask);
+        userData = entry->user_data;
+        result = entry->res;
+        __atomic_store_n(this->completionHead, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+#else
+    IOUring::IOUring(unsigned)
+    {
+        throw ErrnoException("io_uring", ENOSYS);
+    }
+
+    IOUring::~IOUring()
+    {
+    }
+
+    void IOUring::Close()
+    {
+    }
+
+    bool IOUring::IsCompiledIn()
+    {
+        return false;
+    }
+
+    bool IOUring::Supports(Operation) const
+    {
+        return false;
+    }
+
+    bool IOUring::PrepareWrite(int, const void *, std::size_t, off_t,
+                               std::uint64_t)
+    {
+        return false;
+    }
+
+    bool IOUring::PrepareRead(int, void *, std::size_t, off_t, std::uint64_t)
+    {
+        return false;
+    }
+
+    bool IOUring::PrepareOpenAt(int, const char *, int, std::uint64_t)
+    {
+        return false;
+    }
+
+    bool IOUring::PrepareStatx(int, const char *, int, unsigned,
+                               struct statx *, std::uint64_t)
+    {
+        return false;
+    }
+
+    bool IOUring::PrepareClose(int, std::uint64_t)
+    {
+        return false;
+    }
+
+    void IOUring::Submit(unsigned)
+    {
+    }
+
+    bool IOUring::PopCompletion(std::uint64_t &, int &)
+    {
+        return false;
+    }
+#endif
+}
+}
@@ -0,0 +1,106 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#include <APPX/JSON.h>
+#include <cstddef>
+#include <cstdio>
+
+namespace osinside {
+namespace appx {
+    namespace {
+        // Returns the length of the well-formed UTF-8 sequence (see
+        // Unicode's table 3-7) starting at s[i], whose first byte is at least
+        // 0x80, or 0 if it is malformed or cut off.
+        std::size_t UTF8SequenceLength(const std::string &s, std::size_t i)
+        {
+            unsigned char lead = static_cast<unsigned char>(s[i]);
+            std::size_t length;
+            unsigned char min = 0x80;
+            unsigned char max = 0xbf;
+            if (lead >= 0xc2 && lead <= 0xdf) {
+                length = 2;
+            } else if (lead >= 0xe0 && lead <= 0xef) {
+                length = 3;
+                if (lead == 0xe0) {
+                    // Overlong.
+                    min = 0xa0;
+                } else if (lead == 0xed) {
+                    // Surrogates.
+                    max = 0x9f;
+                }
+            } else if (lead >= 0xf0 && lead <= 0xf4) {
+                length = 4;
+                if (lead == 0xf0) {
+                    // Overlong.
+                    min = 0x90;
+                } else if (lead == 0xf4) {
+                    // Past U+10FFFF.
+                    max = 0x8f;
+                }
+            } else {
+                return 0;
+            }
+            if (s.size() - i < length) {
+                return 0;
+            }
+            for (std::size_t j = 1; j < length; ++j) {
+                unsigned char c = static_cast<unsigned char>(s[i + j]);
+                if (c < min || c > max) {
+                    return 0;
+                }
+                min = 0x80;
+                max = 0xbf;
+            }
+            return length;
+        }
+    }
+
+    std::string JSONEncodeString(const std::string &s)
+    {
+        std::string out = "\"";
+        for (std::size_t i = 0; i < s.size(); ++i) {
+            char c = s[i];
+            switch (c) {
+                case '"':
+                    out += "\\\"";
+                    break;
+                case '\\':
+                    out += "\\\\";
+                    break;
+                case '\n':
+                    out += "\\n";
+                    break;
+                case '\t':
+                    out += "\\t";
+                    break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20) {
+                        char buffer[8];
+                        std::snprintf(buffer, sizeof(buffer), "\\u%04x",
+                                      static_cast<unsigned>(c));
+                        out += buffer;
+                    } else if (static_cast<unsigned char>(c) < 0x80) {
+                        out += c;
+                    } else if (std::size_t length =
+                                   UTF8SequenceLength(s, i)) {
+                        out.append(s, i, length);
+                        i += length - 1;
+                    } else {
+                        // File names need not be UTF-8, but JSON must be.
+                        out += "\\ufffd";
+                    }
+                    break;
+            }
+        }
+        out += '"';
+        return out;
+    }
+}
+}
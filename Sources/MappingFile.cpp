@@ -0,0 +1,342 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#include <APPX/File.h>
+#include <APPX/MappingFile.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+#include <vector>
+
+namespace osinside {
+namespace appx {
+    namespace {
+        const char kBinaryMagic[8] = {'A', 'P', 'P', 'X', 'M', 'A', 'P', '1'};
+
+        bool IsWhitespace(char c)
+        {
+            return c == ' ' || c == '\t' || c == '\r';
+        }
+
+        // Parses the policies of a mapping file, remembering the last one,
+        // since a build system typically gives the same few for many files.
+        class PolicyParser
+        {
+        public:
+            explicit PolicyParser(int defaultLevel) : defaultLevel(defaultLevel)
+            {
+            }
+
+            // Returns false if spec is not a valid policy.
+            bool Parse(const char *begin, const char *end,
+                       CompressionPolicy &policy)
+            {
+                if (!this->hasLast ||
+                    this->lastSpec.compare(0, std::string::npos, begin,
+                                           end - begin) != 0) {
+                    this->lastSpec.assign(begin, end);
+                    try {
+                        this->lastPolicy = ParseCompressionPolicy(
+                            this->lastSpec, this->defaultLevel);
+                    } catch (std::invalid_argument &) {
+                        this->hasLast = false;
+                        return false;
+                    }
+                    this->hasLast = true;
+                }
+                policy = this->lastPolicy;
+                return true;
+            }
+
+        private:
+            int defaultLevel;
+            bool hasLast = false;
+            std::string lastSpec;
+            CompressionPolicy lastPolicy = CompressionPolicy::Store();
+        };
+
+        // Parses a quoted, non-empty string from cursor, and moves cursor
+        // past it. Returns false if it is malformed.
+        bool ParseQuotedString(const char *&cursor, const char *end,
+                               std::string &out)
+        {
+            if (cursor == end || *cursor != '"') {
+                return false;
+            }
+            ++cursor;
+            out.clear();
+            for (;;) {
+                const char *quote = static_cast<const char *>(
+                    std::memchr(cursor, '"', end - cursor));
+                if (!quote) {
+                    return false;
+                }
+                out.append(cursor, quote);
+                cursor = quote + 1;
+                if (cursor == end || *cursor != '"') {
+                    return !out.empty();
+                }
+                // A quote written twice.
+                out += '"';
+                ++cursor;
+            }
+        }
+
+        // Parses a line of the form "localPath""archiveName", neither of
+        // which contains a quote. Before quotes could be written twice, this
+        // was the local path and archive name, not a local path with a quote
+        // in it and no archive name. Returns false if line is not of this
+        // form.
+        bool ParseAdjacentFields(const char *first, const char *last,
+                                 std::string &localPath,
+                                 std::string &archiveName)
+        {
+            if (last - first < 6 || *first != '"' || last[-1] != '"') {
+                return false;
+            }
+            const char *localPathEnd = static_cast<const char *>(
+                std::memchr(first + 1, '"', last - first - 1));
+            const char *archiveNameBegin = localPathEnd + 2;
+            const char *archiveNameEnd = last - 1;
+            if (localPathEnd == first + 1 ||
+                archiveNameBegin >= archiveNameEnd ||
+                localPathEnd[1] != '"' ||
+                std::memchr(archiveNameBegin, '"',
+                            archiveNameEnd - archiveNameBegin)) {
+                return false;
+            }
+            localPath.assign(first + 1, localPathEnd);
+            archiveName.assign(archiveNameBegin, archiveNameEnd);
+            return true;
+        }
+
+        void ParseTextMappingFile(
+            const char *data, const char *end, PolicyParser &policyParser,
+            std::unordered_map<std::string, LocalFile> &fileNames)
+        {
+            fileNames.reserve(fileNames.size() +
+                              static_cast<std::size_t>(
+                                  std::count(data, end, '\n')) +
+                              1);
+            bool didReadHeader = false;
+            off_t lineNumber = 0;
+            const char *lineBegin = data;
+            while (lineBegin != end) {
+                ++lineNumber;
+                const char *newline = static_cast<const char *>(
+                    std::memchr(lineBegin, '\n', end - lineBegin));
+                const char *lineEnd = newline ? newline : end;
+                const char *first = lineBegin;
+                const char *last = lineEnd;
+                lineBegin = newline ? newline + 1 : end;
+
+                // Trim leading and trailing whitespace and ignore blank
+                // lines.
+                while (first != last && IsWhitespace(*first)) {
+                    ++first;
+                }
+                while (last != first && IsWhitespace(last[-1])) {
+                    --last;
+                }
+                if (first == last) {
+                    continue;
+                }
+                if (!didReadHeader) {
+                    static const char kHeader[] = "[Files]";
+                    if (static_cast<std::size_t>(last - first) !=
+                            sizeof(kHeader) - 1 ||
+                        std::memcmp(first, kHeader, sizeof(kHeader) - 1) != 0) {
+                        throw MalformedMappingFileError(lineNumber);
+                    }
+                    didReadHeader = true;
+                    continue;
+                }
+
+                // Parse the following, with an optional policy:
+                //
+                //     "localPath" "archiveName" policy
+                std::string localPath;
+                std::string archiveName;
+                const char *cursor = first;
+                if (!ParseQuotedString(cursor, last, localPath)) {
+                    throw MalformedMappingFileError(lineNumber);
+                }
+                if (cursor == last &&
+                    ParseAdjacentFields(first, last, localPath,
+                                        archiveName)) {
+                    fileNames.emplace(std::move(archiveName),
+                                      LocalFile(std::move(localPath)));
+                    continue;
+                }
+                const char *separator = cursor;
+                while (cursor != last && IsWhitespace(*cursor)) {
+                    ++cursor;
+                }
+                if (cursor == separator ||
+                    !ParseQuotedString(cursor, last, archiveName)) {
+                    throw MalformedMappingFileError(lineNumber);
+                }
+                LocalFile localFile(std::move(localPath));
+                if (cursor != last) {
+                    separator = cursor;
+                    while (cursor != last && IsWhitespace(*cursor)) {
+                        ++cursor;
+                    }
+                    if (cursor == separator ||
+                        !policyParser.Parse(cursor, last,
+                                            localFile.compressionPolicy)) {
+                        throw MalformedMappingFileError(lineNumber);
+                    }
+                    localFile.hasCompressionPolicy = true;
+                }
+                fileNames.emplace(std::move(archiveName),
+                                  std::move(localFile));
+            }
+        }
+
+        // Parses a length-prefixed string of a binary mapping file from
+        // cursor, and moves cursor past it. Returns false if it is truncated.
+        bool ParseBinaryString(const char *&cursor, const char *end,
+                               const char *&begin, const char *&stringEnd)
+        {
+            if (end - cursor < 4) {
+                return false;
+            }
+            const std::uint8_t *bytes =
+                reinterpret_cast<const std::uint8_t *>(cursor);
+            std::uint32_t length =
+                std::uint32_t(bytes[0]) | std::uint32_t(bytes[1]) << 8 |
+                std::uint32_t(bytes[2]) << 16 | std::uint32_t(bytes[3]) << 24;
+            cursor += 4;
+            if (static_cast<std::size_t>(end - cursor) < length) {
+                return false;
+            }
+            begin = cursor;
+            stringEnd = cursor + length;
+            cursor = stringEnd;
+            return true;
+        }
+
+        void ParseBinaryMappingFile(
+            const char *data, const char *end, PolicyParser &policyParser,
+            std::unordered_map<std::string, LocalFile> &fileNames)
+        {
+            data += sizeof(kBinaryMagic);
+            const char *begin, *stringEnd;
+            // Count the files first, so fileNames is not rehashed as it
+            // grows.
+            std::size_t recordCount = 0;
+            for (const char *cursor = data;
+                 ParseBinaryString(cursor, end, begin, stringEnd);) {
+                ++recordCount;
+            }
+            fileNames.reserve(fileNames.size() + recordCount / 3);
+
+            off_t recordNumber = 0;
+            const char *cursor = data;
+            while (cursor != end) {
+                ++recordNumber;
+                const char *localPath, *localPathEnd;
+                const char *archiveName, *archiveNameEnd;
+                const char *policy, *policyEnd;
+                if (!ParseBinaryString(cursor, end, localPath, localPathEnd) ||
+                    !ParseBinaryString(cursor, end, archiveName,
+                                       archiveNameEnd) ||
+                    !ParseBinaryString(cursor, end, policy, policyEnd) ||
+                    localPath == localPathEnd ||
+                    archiveName == archiveNameEnd) {
+                    throw MalformedMappingFileError(recordNumber);
+                }
+                LocalFile localFile(std::string(localPath, localPathEnd));
+                if (policy != policyEnd) {
+                    if (!policyParser.Parse(policy, policyEnd,
+                                            localFile.compressionPolicy)) {
+                        throw MalformedMappingFileError(recordNumber);
+                    }
+                    localFile.hasCompressionPolicy = true;
+                }
+                fileNames.emplace(std::string(archiveName, archiveNameEnd),
+                                  std::move(localFile));
+            }
+        }
+    }
+
+    MalformedMappingFileError::MalformedMappingFileError(off_t lineNumber)
+        : lineNumber(lineNumber)
+    {
+        this->SetFileName(nullptr);
+    }
+
+    void MalformedMappingFileError::SetFileName(const char *fileName)
+    {
+        if (!fileName || strcmp(fileName, "") == 0) {
+            fileName = "(unknown)";
+        }
+        std::ostringstream ss;
+        ss << "Malformed mapping file: " << fileName << ":" << this->lineNumber;
+        this->message = ss.str();
+    }
+
+    void ParseMappingFile(const char *data, std::size_t size,
+                          int defaultLevel,
+                          std::unordered_map<std::string, LocalFile> &fileNames)
+    {
+        PolicyParser policyParser(defaultLevel);
+        if (size >= sizeof(kBinaryMagic) &&
+            std::memcmp(data, kBinaryMagic, sizeof(kBinaryMagic)) == 0) {
+            ParseBinaryMappingFile(data, data + size, policyParser, fileNames);
+        } else {
+            ParseTextMappingFile(data, data + size, policyParser, fileNames);
+        }
+    }
+
+    void ReadMappingFile(const std::string &path, int defaultLevel,
+                         std::unordered_map<std::string, LocalFile> &fileNames)
+    {
+        bool isStandardInput = path == "-";
+        FilePtr file;
+        if (isStandardInput) {
+            file.reset(fdopen(dup(STDIN_FILENO), "rb"));
+            if (!file) {
+                throw ErrnoException();
+            }
+        } else {
+            file = Open(path, "rb");
+        }
+        MappedFile mapping(file);
+        std::vector<char> buffer;
+        const char *data;
+        std::size_t size;
+        if (mapping.IsMapped()) {
+            data = reinterpret_cast<const char *>(mapping.Data());
+            size = mapping.Size();
+        } else {
+            // E.g. a pipe.
+            char chunk[65536];
+            while (std::size_t read = Read(file, sizeof(chunk), chunk)) {
+                buffer.insert(buffer.end(), chunk, chunk + read);
+            }
+            data = buffer.data();
+            size = buffer.size();
+        }
+        try {
+            ParseMappingFile(data, size, defaultLevel, fileNames);
+        } catch (MalformedMappingFileError &e) {
+            if (!isStandardInput) {
+                e.SetFileName(path.c_str());
+            }
+            throw;
+        }
+    }
+}
+}
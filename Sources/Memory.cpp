@@ -0,0 +1,234 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#include <APPX/Memory.h>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <openssl/crypto.h>
+#include <sys/resource.h>
+
+namespace osinside {
+namespace appx {
+    namespace {
+        struct Counter
+        {
+            std::atomic<std::size_t> live;
+            std::atomic<std::size_t> peak;
+        };
+
+        Counter counters[kMemoryComponentCount];
+        Counter total;
+        std::atomic<std::size_t> stagePeak;
+
+        thread_local MemoryComponent scopeComponent =
+            MemoryComponent::Hashing;
+
+        void RaisePeak(std::atomic<std::size_t> &peak, std::size_t live)
+        {
+            std::size_t old = peak.load(std::memory_order_relaxed);
+            while (old < live &&
+                   !peak.compare_exchange_weak(old, live,
+                                               std::memory_order_relaxed)) {
+            }
+        }
+
+        // Hooked allocations are prefixed with a header recording what to
+        // uncount when they are freed. Its size keeps the allocation aligned
+        // like malloc's.
+        struct alignas(alignof(std::max_align_t)) AllocationHeader
+        {
+            std::size_t size;
+            MemoryComponent component;
+        };
+
+        void *CountedAllocate(MemoryComponent component, std::size_t size)
+        {
+            void *block = std::malloc(sizeof(AllocationHeader) + size);
+            if (!block) {
+                return nullptr;
+            }
+            AllocationHeader *header = static_cast<AllocationHeader *>(block);
+            header->size = size;
+            header->component = component;
+            AddMemoryUsage(component, size);
+            return header + 1;
+        }
+
+        void CountedFree(void *pointer)
+        {
+            if (!pointer) {
+                return;
+            }
+            AllocationHeader *header =
+                static_cast<AllocationHeader *>(pointer) - 1;
+            RemoveMemoryUsage(header->component, header->size);
+            std::free(header);
+        }
+
+        void *CountedReallocate(void *pointer, std::size_t size)
+        {
+            if (!pointer) {
+                return CountedAllocate(scopeComponent, size);
+            }
+            AllocationHeader *header =
+                static_cast<AllocationHeader *>(pointer) - 1;
+            AllocationHeader old = *header;
+            void *block =
+                std::realloc(header, sizeof(AllocationHeader) + size);
+            if (!block) {
+                return nullptr;
+            }
+            header = static_cast<AllocationHeader *>(block);
+            header->size = size;
+            RemoveMemoryUsage(old.component, old.size);
+            AddMemoryUsage(old.component, size);
+            return header + 1;
+        }
+
+        voidpf ZlibAllocate(voidpf, uInt items, uInt size)
+        {
+            return CountedAllocate(MemoryComponent::Zlib,
+                                   static_cast<std::size_t>(items) * size);
+        }
+
+        void ZlibFree(voidpf, voidpf pointer)
+        {
+            CountedFree(pointer);
+        }
+
+        void *OpenSSLAllocate(std::size_t size, const char *, int)
+        {
+            return CountedAllocate(scopeComponent, size);
+        }
+
+        void *OpenSSLReallocate(void *pointer, std::size_t size, const char *,
+                                int)
+        {
+            return CountedReallocate(pointer, size);
+        }
+
+        void OpenSSLFree(void *pointer, const char *, int)
+        {
+            CountedFree(pointer);
+        }
+
+        double Megabytes(std::size_t bytes)
+        {
+            return static_cast<double>(bytes) / 1e6;
+        }
+    }
+
+    const char *MemoryComponentName(MemoryComponent component)
+    {
+        switch (component) {
+            case MemoryComponent::EntryBuffers:
+                return "entry-buffers";
+            case MemoryComponent::EntryMetadata:
+                return "entry-metadata";
+            case MemoryComponent::XML:
+                return "xml";
+            case MemoryComponent::Zlib:
+                return "zlib";
+            case MemoryComponent::Hashing:
+                return "hashing";
+            case MemoryComponent::Signing:
+                return "signing";
+        }
+        return "unknown";
+    }
+
+    void AddMemoryUsage(MemoryComponent component, std::size_t size)
+    {
+        Counter &counter = counters[static_cast<int>(component)];
+        RaisePeak(counter.peak,
+                  counter.live.fetch_add(size, std::memory_order_relaxed) +
+                      size);
+        std::size_t live =
+            total.live.fetch_add(size, std::memory_order_relaxed) + size;
+        RaisePeak(total.peak, live);
+        RaisePeak(stagePeak, live);
+    }
+
+    void RemoveMemoryUsage(MemoryComponent component, std::size_t size)
+    {
+        counters[static_cast<int>(component)].live.fetch_sub(
+            size, std::memory_order_relaxed);
+        total.live.fetch_sub(size, std::memory_order_relaxed);
+    }
+
+    MemoryUsage GetMemoryUsage(MemoryComponent component)
+    {
+        const Counter &counter = counters[static_cast<int>(component)];
+        return MemoryUsage{counter.live.load(std::memory_order_relaxed),
+                           counter.peak.load(std::memory_order_relaxed)};
+    }
+
+    MemoryUsage GetTotalMemoryUsage()
+    {
+        return MemoryUsage{total.live.load(std::memory_order_relaxed),
+                           total.peak.load(std::memory_order_relaxed)};
+    }
+
+    std::size_t ResetStagePeakMemoryUsage()
+    {
+        return stagePeak.exchange(total.live.load(std::memory_order_relaxed),
+                                  std::memory_order_relaxed);
+    }
+
+    MemoryScope::MemoryScope(MemoryComponent component)
+        : previous(scopeComponent)
+    {
+        scopeComponent = component;
+    }
+
+    MemoryScope::~MemoryScope()
+    {
+        scopeComponent = this->previous;
+    }
+
+    void CountZlibAllocations(z_stream &stream)
+    {
+        stream.zalloc = ZlibAllocate;
+        stream.zfree = ZlibFree;
+        stream.opaque = nullptr;
+    }
+
+    bool CountOpenSSLAllocations()
+    {
+        return CRYPTO_set_mem_functions(OpenSSLAllocate, OpenSSLReallocate,
+                                        OpenSSLFree) == 1;
+    }
+
+    void WriteMemorySummary(std::FILE *out)
+    {
+        std::fprintf(out, "%-28s %11s %11s\n", "memory", "live MB",
+                     "peak MB");
+        for (int i = 0; i < kMemoryComponentCount; ++i) {
+            MemoryComponent component = static_cast<MemoryComponent>(i);
+            MemoryUsage usage = GetMemoryUsage(component);
+            std::fprintf(out, "%-28s %11.1f %11.1f\n",
+                         MemoryComponentName(component), Megabytes(usage.live),
+                         Megabytes(usage.peak));
+        }
+        MemoryUsage usage = GetTotalMemoryUsage();
+        std::fprintf(out, "%-28s %11.1f %11.1f\n", "total",
+                     Megabytes(usage.live), Megabytes(usage.peak));
+        struct rusage resources;
+        if (getrusage(RUSAGE_SELF, &resources) == 0) {
+            // ru_maxrss is in kilobytes.
+            std::fprintf(out, "%-28s %11s %11.1f\n", "resident", "",
+                         Megabytes(static_cast<std::size_t>(
+                                       resources.ru_maxrss) *
+                                   1024));
+        }
+    }
+}
+}
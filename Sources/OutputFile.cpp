@@ -0,0 +1,574 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#include <APPX/IOUring.h>
+#include <APPX/OutputFile.h>
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace osinside {
+namespace appx {
+    namespace {
+        // sendfile transfers at most this many bytes per call anyway.
+        const std::size_t kMaxSendfileSize = 0x7ffff000;
+
+        // Writes all bytes at offset, or at the file position if the file is
+        // not seekable.
+        void WriteAll(int fd, bool isSeekable, off_t offset, std::size_t size,
+                      const std::uint8_t *bytes)
+        {
+            while (size > 0) {
+                ssize_t written = isSeekable ? pwrite(fd, bytes, size, offset)
+                                             : write(fd, bytes, size);
+                if (written < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw ErrnoException();
+                }
+                bytes += written;
+                offset += written;
+                size -= written;
+            }
+        }
+
+        void ReadAll(int fd, off_t offset, std::size_t size,
+                     std::uint8_t *bytes)
+        {
+            while (size > 0) {
+                ssize_t read = pread(fd, bytes, size, offset);
+                if (read < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw ErrnoException();
+                }
+                if (read == 0) {
+                    throw std::runtime_error("Unexpected end of file");
+                }
+                bytes += read;
+                offset += read;
+                size -= read;
+            }
+        }
+
+        struct FileCloser
+        {
+            ~FileCloser()
+            {
+                if (this->fd != -1) {
+                    close(this->fd);
+                }
+            }
+
+            int fd;
+        };
+    }
+
+    void OutputFile::BufferDeleter::operator()(std::uint8_t *data)
+    {
+        std::free(data);
+    }
+
+    OutputFile::OutputFile(const std::string &path,
+                           const OutputOptions &options)
+        : options(options), fd(-1), directFD(-1)
+    {
+        assert(options.bufferSize % kDirectAlignment == 0);
+        assert(options.bufferCount >= 2);
+        this->fd =
+            open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (this->fd == -1) {
+            throw ErrnoException(path);
+        }
+        FileCloser closer{this->fd};
+        struct stat status;
+        if (fstat(this->fd, &status) != 0) {
+            throw ErrnoException(path);
+        }
+        this->isRegular = S_ISREG(status.st_mode);
+        this->isSeekable = lseek(this->fd, 0, SEEK_CUR) != -1;
+
+        if (options.direct && this->isRegular) {
+            // A second descriptor, so unaligned writes (e.g. header patches
+            // and the end of the file) can still go through the page cache.
+            // Fails with EINVAL if the file system does not support O_DIRECT.
+            this->directFD = open(path.c_str(), O_WRONLY | O_DIRECT | O_CLOEXEC);
+        }
+        if (options.backend == OutputOptions::Backend::IOUring &&
+            this->isSeekable) {
+            try {
+                this->ring.reset(
+                    new IOUring(static_cast<unsigned>(options.bufferCount)));
+            } catch (const ErrnoException &) {
+                // Use pwrite instead.
+            }
+            if (this->ring &&
+                !this->ring->Supports(IOUring::Operation::Write)) {
+                // Linux 5.1 to 5.5 have io_uring, but no IORING_OP_WRITE.
+                this->ring.reset();
+            }
+        }
+
+        for (std::size_t i = 0; i < options.bufferCount; ++i) {
+            void *data;
+            int rc = posix_memalign(&data, kDirectAlignment, options.bufferSize);
+            if (rc != 0) {
+                if (this->directFD != -1) {
+                    close(this->directFD);
+                }
+                throw ErrnoException(rc);
+            }
+            this->storage.emplace_back(static_cast<std::uint8_t *>(data));
+            this->buffers.push_back(
+                Buffer{static_cast<std::uint8_t *>(data), 0, 0, 0});
+        }
+        this->current = &this->buffers[0];
+        this->StartBuffer(this->current, 0);
+        for (std::size_t i = 1; i < this->buffers.size(); ++i) {
+            this->freeBuffers.push_back(&this->buffers[i]);
+        }
+        closer.fd = -1;
+        this->writer = std::thread(&OutputFile::Work, this);
+    }
+
+    OutputFile::~OutputFile()
+    {
+        if (this->writer.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->stopping = true;
+            }
+            this->changed.notify_all();
+            this->writer.join();
+        }
+        if (this->directFD != -1) {
+            close(this->directFD);
+        }
+        if (this->fd != -1) {
+            close(this->fd);
+        }
+    }
+
+    void OutputFile::Write(std::size_t size, const std::uint8_t *bytes)
+    {
+        while (size > 0) {
+            Buffer &buffer = *this->current;
+            std::size_t toCopy = std::min(size, buffer.capacity - buffer.size);
+            std::memcpy(buffer.data + buffer.size, bytes, toCopy);
+            buffer.size += toCopy;
+            bytes += toCopy;
+            size -= toCopy;
+            if (buffer.size == buffer.capacity) {
+                this->SubmitCurrentBuffer();
+            }
+        }
+    }
+
+    void OutputFile::WriteAt(off_t offset, std::size_t size, const void *bytes)
+    {
+        assert(offset + static_cast<off_t>(size) <= this->Offset());
+        if (!this->isSeekable) {
+            throw ErrnoException(ESPIPE);
+        }
+        const std::uint8_t *data = static_cast<const std::uint8_t *>(bytes);
+        // Bytes in the current buffer are patched there, so it stays
+        // aligned.
+        off_t bufferOffset = this->current->offset;
+        off_t end = offset + static_cast<off_t>(size);
+        if (end > bufferOffset) {
+            off_t start = std::max(offset, bufferOffset);
+            std::memcpy(this->current->data + (start - bufferOffset),
+                        data + (start - offset),
+                        static_cast<std::size_t>(end - start));
+            size = static_cast<std::size_t>(std::max(off_t(0),
+                                                     bufferOffset - offset));
+        }
+        if (size == 0) {
+            return;
+        }
+        // The rest are queued for the writer thread, which writes them after
+        // the buffers before them, instead of waiting for it here.
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->ThrowIfFailed();
+            this->patches.push_back(
+                Patch{offset, std::vector<std::uint8_t>(data, data + size)});
+        }
+        this->changed.notify_all();
+    }
+
+    void OutputFile::ReadAt(off_t offset, std::size_t size, void *bytes)
+    {
+        assert(offset + static_cast<off_t>(size) <= this->Offset());
+        if (!this->isSeekable) {
+            throw ErrnoException(ESPIPE);
+        }
+        std::uint8_t *data = static_cast<std::uint8_t *>(bytes);
+        off_t end = offset + static_cast<off_t>(size);
+        off_t bufferOffset = this->current->offset;
+        if (end > bufferOffset) {
+            off_t start = std::max(offset, bufferOffset);
+            std::memcpy(data + (start - offset),
+                        this->current->data + (start - bufferOffset),
+                        static_cast<std::size_t>(end - start));
+            end = start;
+        }
+        if (end == offset) {
+            return;
+        }
+        // Copy bytes still in buffers the writer thread has not finished, and
+        // the patches to apply over everything. The buffers follow each other
+        // up to the current one, so the bytes before them are in the file.
+        std::vector<Patch> patches;
+        off_t fileEnd = end;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->ThrowIfFailed();
+            auto copyFromBuffer = [&](const Buffer *buffer) {
+                off_t start = std::max(offset, buffer->offset);
+                off_t stop = std::min(
+                    end, buffer->offset + static_cast<off_t>(buffer->size));
+                if (start < stop) {
+                    std::memcpy(data + (start - offset),
+                                buffer->data + (start - buffer->offset),
+                                static_cast<std::size_t>(stop - start));
+                }
+                fileEnd = std::max(offset, std::min(fileEnd, buffer->offset));
+            };
+            for (const Buffer *buffer : this->writing) {
+                copyFromBuffer(buffer);
+            }
+            for (const Buffer *buffer : this->queued) {
+                copyFromBuffer(buffer);
+            }
+            for (const Patch &patch : this->patches) {
+                if (patch.offset < end &&
+                    patch.offset + static_cast<off_t>(patch.bytes.size()) >
+                        offset) {
+                    patches.push_back(patch);
+                }
+            }
+        }
+        // Only the writer thread's patches change these bytes, and a patch
+        // leaves this->patches after it is written, so applying the copies
+        // gives the final bytes either way.
+        if (fileEnd > offset) {
+            ReadAll(this->fd, offset,
+                    static_cast<std::size_t>(fileEnd - offset), data);
+        }
+        for (const Patch &patch : patches) {
+            off_t start = std::max(offset, patch.offset);
+            off_t stop = std::min(
+                end, patch.offset + static_cast<off_t>(patch.bytes.size()));
+            std::memcpy(data + (start - offset),
+                        patch.bytes.data() + (start - patch.offset),
+                        static_cast<std::size_t>(stop - start));
+        }
+    }
+
+    void OutputFile::CopyFrom(const FilePtr &from, off_t offset, off_t size)
+    {
+        if (this->current->size > 0) {
+            this->SubmitCurrentBuffer();
+        }
+        this->Drain();
+        int fromFD = fileno(from.get());
+        off_t toOffset = this->current->offset;
+        if (this->isSeekable) {
+            while (size > 0) {
+                ssize_t copied = copy_file_range(fromFD, &offset, this->fd,
+                                                 &toOffset, size, 0);
+                if (copied < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (copied <= 0) {
+                    // E.g. EXDEV or ENOSYS on older kernels. Try sendfile
+                    // below.
+                    break;
+                }
+                size -= copied;
+            }
+            // sendfile writes at the descriptor's position, which
+            // copy_file_range did not move.
+            if (size > 0 && lseek(this->fd, toOffset, SEEK_SET) == -1) {
+                throw ErrnoException();
+            }
+        }
+        while (size > 0) {
+            ssize_t sent = sendfile(
+                this->fd, fromFD, &offset,
+                static_cast<std::size_t>(std::min(
+                    size, static_cast<off_t>(kMaxSendfileSize))));
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent <= 0) {
+                // E.g. EINVAL if from cannot be mapped. Copy the rest below.
+                break;
+            }
+            toOffset += sent;
+            size -= sent;
+        }
+        this->StartBuffer(this->current, toOffset);
+        appx::CopyRange(from, offset, size, *this);
+    }
+
+    void OutputFile::Close()
+    {
+        if (this->current->size > 0) {
+            this->SubmitCurrentBuffer();
+        }
+        this->Drain();
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->changed.notify_all();
+        this->writer.join();
+
+        if (this->isRegular &&
+            (this->options.syncPolicy != OutputOptions::SyncPolicy::None ||
+             this->options.dropCache)) {
+            if (fdatasync(this->fd) != 0) {
+                throw ErrnoException();
+            }
+        }
+        if (this->isRegular && this->options.dropCache) {
+            // Only a hint, so failure does not matter.
+            posix_fadvise(this->fd, 0, 0, POSIX_FADV_DONTNEED);
+        }
+        if (this->directFD != -1) {
+            close(this->directFD);
+            this->directFD = -1;
+        }
+        int fd = this->fd;
+        this->fd = -1;
+        if (close(fd) != 0) {
+            throw ErrnoException();
+        }
+    }
+
+    void OutputFile::StartBuffer(Buffer *buffer, off_t offset)
+    {
+        std::size_t bufferSize = this->options.bufferSize;
+        buffer->offset = offset;
+        buffer->size = 0;
+        buffer->capacity = bufferSize - static_cast<std::size_t>(
+                                            offset % static_cast<off_t>(
+                                                         bufferSize));
+    }
+
+    void OutputFile::SubmitCurrentBuffer()
+    {
+        off_t end = this->Offset();
+        Buffer *next;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->ThrowIfFailed();
+            this->queued.push_back(this->current);
+            this->changed.notify_all();
+            this->changed.wait(lock, [this]() {
+                return !this->freeBuffers.empty() || this->error;
+            });
+            this->ThrowIfFailed();
+            next = this->freeBuffers.back();
+            this->freeBuffers.pop_back();
+        }
+        this->StartBuffer(next, end);
+        this->current = next;
+    }
+
+    void OutputFile::Drain()
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->changed.wait(lock, [this]() {
+            return (this->queued.empty() && this->writing.empty() &&
+                    this->patches.empty()) ||
+                   this->error;
+        });
+        this->ThrowIfFailed();
+    }
+
+    void OutputFile::ThrowIfFailed()
+    {
+        if (this->error) {
+            std::rethrow_exception(this->error);
+        }
+    }
+
+    void OutputFile::Work()
+    {
+        for (;;) {
+            std::vector<Buffer *> batch;
+            // Patches may be for bytes in the batch, so they are written
+            // after it. Later patches wait for the next round.
+            std::vector<Patch> patches;
+            bool hasFailed;
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->changed.wait(lock, [this]() {
+                    return this->stopping || !this->queued.empty() ||
+                           !this->patches.empty();
+                });
+                if (this->queued.empty() && this->patches.empty()) {
+                    return;
+                }
+                batch.assign(this->queued.begin(), this->queued.end());
+                this->queued.clear();
+                this->writing = batch;
+                patches.assign(this->patches.begin(), this->patches.end());
+                hasFailed = static_cast<bool>(this->error);
+            }
+            std::exception_ptr error;
+            if (!hasFailed) {
+                try {
+                    if (!batch.empty()) {
+                        this->WriteBuffers(batch);
+                    }
+                    for (const Patch &patch : patches) {
+                        WriteAll(this->fd, true, patch.offset,
+                                 patch.bytes.size(), patch.bytes.data());
+                    }
+                } catch (...) {
+                    error = std::current_exception();
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                if (error && !this->error) {
+                    this->error = error;
+                }
+                this->freeBuffers.insert(this->freeBuffers.end(),
+                                         batch.begin(), batch.end());
+                this->writing.clear();
+                this->patches.erase(this->patches.begin(),
+                                    this->patches.begin() + patches.size());
+            }
+            this->changed.notify_all();
+        }
+    }
+
+    void OutputFile::WriteBuffers(const std::vector<Buffer *> &batch)
+    {
+        if (!this->ring) {
+            for (const Buffer *buffer : batch) {
+                this->WriteBuffer(*buffer);
+                this->AfterWrite(buffer->offset + buffer->size);
+            }
+            return;
+        }
+
+        // Put the whole batch in flight at once.
+        std::vector<int> results(batch.size(), 0);
+        for (std::size_t i = 0; i < batch.size(); ++i) {
+            const Buffer &buffer = *batch[i];
+            bool isDirect = this->directFD != -1 &&
+                            buffer.size == this->options.bufferSize;
+            bool queued = this->ring->PrepareWrite(
+                isDirect ? this->directFD : this->fd, buffer.data,
+                buffer.size, buffer.offset, i);
+            assert(queued);
+            static_cast<void>(queued);
+        }
+        this->ring->Submit(static_cast<unsigned>(batch.size()));
+        std::size_t completedCount = 0;
+        while (completedCount < batch.size()) {
+            std::uint64_t index;
+            int result;
+            if (!this->ring->PopCompletion(index, result)) {
+                this->ring->Submit(
+                    static_cast<unsigned>(batch.size() - completedCount));
+                continue;
+            }
+            results[index] = result;
+            ++completedCount;
+        }
+        for (std::size_t i = 0; i < batch.size(); ++i) {
+            const Buffer &buffer = *batch[i];
+            bool isDirect = this->directFD != -1 &&
+                            buffer.size == this->options.bufferSize;
+            if (results[i] == -EINVAL || results[i] == -EOPNOTSUPP ||
+                (results[i] < 0 && isDirect)) {
+                // The kernel or file system refused the write (e.g.
+                // O_DIRECT on a file system without it), so retry the way
+                // pwrite would, including its page cache fallback.
+                this->WriteBuffer(buffer);
+                this->AfterWrite(buffer.offset + buffer.size);
+                continue;
+            }
+            if (results[i] < 0) {
+                throw ErrnoException(-results[i]);
+            }
+            // Finish short writes synchronously.
+            std::size_t written = static_cast<std::size_t>(results[i]);
+            WriteAll(this->fd, true, buffer.offset + written,
+                     buffer.size - written, buffer.data + written);
+            this->AfterWrite(buffer.offset + buffer.size);
+        }
+    }
+
+    void OutputFile::WriteBuffer(const Buffer &buffer)
+    {
+        // Only whole buffers are aligned well enough for O_DIRECT.
+        if (this->directFD != -1 && buffer.size == this->options.bufferSize) {
+            ssize_t written = pwrite(this->directFD, buffer.data, buffer.size,
+                                     buffer.offset);
+            if (written == static_cast<ssize_t>(buffer.size)) {
+                return;
+            }
+            // Retry whatever is left (e.g. after EINTR) through the page
+            // cache.
+            std::size_t done = written > 0 ? written : 0;
+            WriteAll(this->fd, true, buffer.offset + done, buffer.size - done,
+                     buffer.data + done);
+            return;
+        }
+        WriteAll(this->fd, this->isSeekable, buffer.offset, buffer.size,
+                 buffer.data);
+    }
+
+    void OutputFile::AfterWrite(off_t end)
+    {
+        bool syncsIntervals =
+            this->options.syncPolicy == OutputOptions::SyncPolicy::Interval ||
+            this->options.dropCache;
+        if (!this->isRegular || !syncsIntervals ||
+            end - this->syncedEnd < this->options.syncInterval) {
+            return;
+        }
+        // Start writing back this interval, then wait for the previous one,
+        // which has had a whole interval to reach storage. These are hints,
+        // so errors are left for fdatasync in Close to report.
+        sync_file_range(this->fd, this->syncedEnd, end - this->syncedEnd,
+                        SYNC_FILE_RANGE_WRITE);
+        if (this->syncedEnd > this->previousSyncedEnd) {
+            off_t previousSize = this->syncedEnd - this->previousSyncedEnd;
+            sync_file_range(this->fd, this->previousSyncedEnd, previousSize,
+                            SYNC_FILE_RANGE_WAIT_BEFORE |
+                                SYNC_FILE_RANGE_WRITE |
+                                SYNC_FILE_RANGE_WAIT_AFTER);
+            if (this->options.dropCache) {
+                posix_fadvise(this->fd, this->previousSyncedEnd, previousSize,
+                              POSIX_FADV_DONTNEED);
+            }
+        }
+        this->previousSyncedEnd = this->syncedEnd;
+        this->syncedEnd = end;
+    }
+}
+}
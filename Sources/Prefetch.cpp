@@ -0,0 +1,135 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#include <APPX/Prefetch.h>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace osinside {
+namespace appx {
+    namespace {
+        // Archived files are dropped from the page cache this many at a
+        // time, so the thread does not wake for every entry.
+        const std::size_t kDropBatchSize = 64;
+
+        void Advise(const std::string &path, off_t size, int advice)
+        {
+            // O_NONBLOCK, so a file which became a FIFO does not block.
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+            if (fd == -1) {
+                return;
+            }
+            posix_fadvise(fd, 0, size, advice);
+            close(fd);
+        }
+    }
+
+    InputPrefetcher::InputPrefetcher(std::vector<Input> inputs,
+                                     off_t windowSize, bool dropArchived)
+        : inputs(std::move(inputs)),
+          windowSize(windowSize),
+          dropArchived(dropArchived),
+          windowOffsets(this->inputs.size() + 1, 0)
+    {
+        for (std::size_t i = 0; i < this->inputs.size(); ++i) {
+            const Input &input = this->inputs[i];
+            off_t bytes = input.prefetch && input.size > 0
+                              ? std::min(input.size, this->windowSize)
+                              : off_t(0);
+            this->windowOffsets[i + 1] = this->windowOffsets[i] + bytes;
+        }
+        this->thread = std::thread(&InputPrefetcher::Run, this);
+    }
+
+    InputPrefetcher::~InputPrefetcher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->changed.notify_all();
+        this->thread.join();
+    }
+
+    void InputPrefetcher::Reached(std::size_t index)
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (index <= this->reached) {
+                return;
+            }
+            this->reached = index;
+            if (index < this->wakeIndex) {
+                return;
+            }
+        }
+        this->changed.notify_all();
+    }
+
+    void InputPrefetcher::Run()
+    {
+        std::size_t reached = 0;
+        std::size_t nextAdvised = 0;
+        std::size_t nextDropped = 0;
+        bool stopping = false;
+        for (;;) {
+            if (this->dropArchived) {
+                for (; nextDropped < reached; ++nextDropped) {
+                    const Input &input = this->inputs[nextDropped];
+                    if (input.size > 0) {
+                        Advise(*input.path, 0, POSIX_FADV_DONTNEED);
+                    }
+                }
+            }
+            if (stopping) {
+                return;
+            }
+
+            nextAdvised = std::max(nextAdvised, reached);
+            off_t windowEnd = this->windowOffsets[reached] + this->windowSize;
+            while (nextAdvised < this->inputs.size() &&
+                   this->windowOffsets[nextAdvised] < windowEnd) {
+                off_t bytes = this->windowOffsets[nextAdvised + 1] -
+                              this->windowOffsets[nextAdvised];
+                if (bytes > 0) {
+                    Advise(*this->inputs[nextAdvised].path, bytes,
+                           POSIX_FADV_WILLNEED);
+                }
+                ++nextAdvised;
+            }
+
+            // Sleep until half the window was archived, rather than waking
+            // for every entry.
+            std::size_t wakeIndex = std::size_t(-1);
+            if (nextAdvised < this->inputs.size()) {
+                auto begin = this->windowOffsets.begin();
+                wakeIndex = std::lower_bound(
+                                begin + reached, begin + nextAdvised,
+                                this->windowOffsets[reached] +
+                                    this->windowSize / 2) -
+                            begin;
+                wakeIndex = std::max(wakeIndex, reached + 1);
+            }
+            if (this->dropArchived) {
+                wakeIndex = std::min(wakeIndex, nextDropped + kDropBatchSize);
+            }
+
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->wakeIndex = wakeIndex;
+            this->changed.wait(lock, [this]() {
+                return this->stopping || this->reached >= this->wakeIndex;
+            });
+            reached = this->reached;
+            stopping = this->stopping;
+        }
+    }
+}
+}
@@ -0,0 +1,191 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#include <APPX/JSON.h>
+#include <APPX/Progress.h>
+#include <cerrno>
+#include <cstdio>
+#include <unistd.h>
+
+namespace osinside {
+namespace appx {
+    namespace {
+        std::atomic<Progress *> currentProgress(nullptr);
+
+        double Seconds(std::chrono::steady_clock::duration duration)
+        {
+            return std::chrono::duration<double>(duration).count();
+        }
+
+        std::string FormatNumber(double value)
+        {
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), "%.3f", value);
+            return buffer;
+        }
+    }
+
+    Progress::Progress(int fd, std::chrono::milliseconds interval)
+        : fd(fd),
+          interval(interval),
+          start(Clock::now()),
+          entryCount(0),
+          totalBytes(0),
+          entriesDone(0),
+          bytesRead(0),
+          bytesWritten(0),
+          uncompressedBytes(0),
+          compressedBytes(0),
+          lastReport(start),
+          lastBytesRead(0),
+          stopping(false)
+    {
+        this->reporter = std::thread([this]() { this->Run(); });
+    }
+
+    Progress::~Progress()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->stopRequested.notify_all();
+        this->reporter.join();
+        this->WriteProgress();
+    }
+
+    void Progress::Begin(std::size_t entryCount, off_t totalBytes)
+    {
+        this->entryCount.store(entryCount, std::memory_order_relaxed);
+        this->totalBytes.store(static_cast<std::uint64_t>(totalBytes),
+                               std::memory_order_relaxed);
+        this->WriteEvent("{\"event\": \"begin\", \"entries\": " +
+                         std::to_string(entryCount) +
+                         ", \"total_bytes\": " + std::to_string(totalBytes) +
+                         "}");
+    }
+
+    void Progress::StartEntry(const std::string &archiveName, off_t size)
+    {
+        this->WriteEvent("{\"event\": \"entry_start\", \"name\": " +
+                         JSONEncodeString(archiveName) +
+                         ", \"size\": " + std::to_string(size) + "}");
+    }
+
+    void Progress::FinishEntry(const std::string &archiveName,
+                               off_t uncompressedSize, off_t compressedSize,
+                               off_t outputOffset)
+    {
+        this->entriesDone.fetch_add(1, std::memory_order_relaxed);
+        this->uncompressedBytes.fetch_add(uncompressedSize,
+                                          std::memory_order_relaxed);
+        this->compressedBytes.fetch_add(compressedSize,
+                                        std::memory_order_relaxed);
+        this->bytesWritten.store(outputOffset, std::memory_order_relaxed);
+        std::string json = "{\"event\": \"entry_finish\", \"name\": " +
+                           JSONEncodeString(archiveName) +
+                           ", \"input_bytes\": " +
+                           std::to_string(uncompressedSize) +
+                           ", \"output_bytes\": " +
+                           std::to_string(compressedSize);
+        if (uncompressedSize > 0) {
+            json += ", \"ratio\": " +
+                    FormatNumber(static_cast<double>(compressedSize) /
+                                 static_cast<double>(uncompressedSize));
+        }
+        this->WriteEvent(json + "}");
+    }
+
+    void Progress::Run()
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        while (!this->stopRequested.wait_for(
+            lock, this->interval, [this]() { return this->stopping; })) {
+            lock.unlock();
+            this->WriteProgress();
+            lock.lock();
+        }
+    }
+
+    void Progress::WriteProgress()
+    {
+        Clock::time_point now = Clock::now();
+        std::uint64_t read = this->bytesRead.load(std::memory_order_relaxed);
+        std::uint64_t total = this->totalBytes.load(std::memory_order_relaxed);
+        std::uint64_t uncompressed =
+            this->uncompressedBytes.load(std::memory_order_relaxed);
+        double elapsed = Seconds(now - this->start);
+        double sinceLastReport = Seconds(now - this->lastReport);
+        // Throughput since the previous report, so a stall shows up at once.
+        double megabytesPerSecond =
+            sinceLastReport > 0
+                ? static_cast<double>(read - this->lastBytesRead) / 1e6 /
+                      sinceLastReport
+                : 0;
+        this->lastReport = now;
+        this->lastBytesRead = read;
+
+        std::string json =
+            "{\"event\": \"progress\", \"elapsed_s\": " +
+            FormatNumber(elapsed) + ", \"entries_done\": " +
+            std::to_string(this->entriesDone.load(std::memory_order_relaxed)) +
+            ", \"entries\": " +
+            std::to_string(this->entryCount.load(std::memory_order_relaxed)) +
+            ", \"bytes_read\": " + std::to_string(read) +
+            ", \"total_bytes\": " + std::to_string(total) +
+            ", \"bytes_written\": " +
+            std::to_string(this->bytesWritten.load(std::memory_order_relaxed)) +
+            ", \"mb_per_s\": " + FormatNumber(megabytesPerSecond);
+        if (uncompressed > 0) {
+            json += ", \"ratio\": " +
+                    FormatNumber(static_cast<double>(this->compressedBytes.load(
+                                     std::memory_order_relaxed)) /
+                                 static_cast<double>(uncompressed));
+        }
+        // The estimate uses the average throughput, which is steadier than
+        // the current one.
+        if (read > 0 && total >= read) {
+            json += ", \"eta_s\": " +
+                    FormatNumber(elapsed * static_cast<double>(total - read) /
+                                 static_cast<double>(read));
+        }
+        this->WriteEvent(json + "}");
+    }
+
+    void Progress::WriteEvent(const std::string &json)
+    {
+        std::string line = json + "\n";
+        std::lock_guard<std::mutex> lock(this->writeMutex);
+        const char *data = line.data();
+        std::size_t size = line.size();
+        while (size > 0) {
+            ssize_t written = write(this->fd, data, size);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            data += written;
+            size -= static_cast<std::size_t>(written);
+        }
+    }
+
+    void SetProgress(Progress *progress)
+    {
+        currentProgress.store(progress, std::memory_order_release);
+    }
+
+    Progress *GetProgress()
+    {
+        return currentProgress.load(std::memory_order_acquire);
+    }
+}
+}
@@ -0,0 +1,64 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#include <APPX/OpenSSL.h>
+#include <APPX/SHA256.h>
+#include <APPX/Sink.h>
+
+namespace osinside {
+namespace appx {
+    const EVP_MD *SHA256Digest()
+    {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        static const EVP_MD *digest = EVP_MD_fetch(nullptr, "SHA256", nullptr);
+#else
+        static const EVP_MD *digest = EVP_sha256();
+#endif
+        if (!digest) {
+            throw OpenSSLException();
+        }
+        return digest;
+    }
+
+    SHA256Hash DigestSHA256(std::size_t size, const std::uint8_t *bytes)
+    {
+        thread_local EVP_MD_CTXPtr context(EVP_MD_CTX_new());
+        std::uint8_t hash[SHA256_DIGEST_LENGTH];
+        if (!context ||
+            !EVP_DigestInit_ex(context.get(), SHA256Digest(), nullptr) ||
+            !EVP_DigestUpdate(context.get(), bytes, size) ||
+            !EVP_DigestFinal_ex(context.get(), hash, nullptr)) {
+            throw OpenSSLException();
+        }
+        return SHA256Hash(hash);
+    }
+
+    SHA256Sink::SHA256Sink() : context(EVP_MD_CTX_new())
+    {
+        if (!this->context ||
+            !EVP_DigestInit_ex(this->context.get(), SHA256Digest(), nullptr)) {
+            throw OpenSSLException();
+        }
+    }
+
+    SHA256Hash SHA256Sink::SHA256() const
+    {
+        // Finishing consumes the context, so finish a copy. The copy's
+        // context is reused rather than allocated for every digest.
+        thread_local EVP_MD_CTXPtr copy(EVP_MD_CTX_new());
+        std::uint8_t hash[SHA256_DIGEST_LENGTH];
+        if (!copy || !EVP_MD_CTX_copy_ex(copy.get(), this->context.get()) ||
+            !EVP_DigestFinal_ex(copy.get(), hash, nullptr)) {
+            throw OpenSSLException();
+        }
+        return SHA256Hash(hash);
+    }
+}
+}
@@ -0,0 +1,472 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#include <APPX/File.h>
+#include <APPX/IOUring.h>
+#include <APPX/SmallFileReader.h>
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if APPX_HAVE_IO_URING && !APPX_HAVE_STATX
+// glibc before 2.28 does not declare statx, but kernel headers recent
+// enough for io_uring do.
+#include <linux/stat.h>
+#ifndef AT_STATX_SYNC_AS_STAT
+#define AT_STATX_SYNC_AS_STAT 0x0000
+#endif
+#endif
+
+namespace osinside {
+namespace appx {
+    namespace {
+        enum
+        {
+            // Files in flight on io_uring. Each has at most two operations
+            // queued at a time, plus the close of a finished file.
+            kRingFileCount = 256,
+            kRingEntries = 1024,
+            // Threads reading files if io_uring is unavailable, per CPU and
+            // at most. More threads hide more latency, but on a local file
+            // system they only take turns with the compressing threads.
+            kThreadsPerCPU = 2,
+            kMaxThreadCount = 8,
+        };
+
+        // What a completion is for: the operation is in the low bits of its
+        // user data, and the index of the file's slot in the rest.
+        enum Operation : std::uint64_t
+        {
+            kOpen,
+            kStatx,
+            kRead,
+            kClose,
+            kOperationCount,
+        };
+
+        // Queues an operation with prepare, which returns false if the queue
+        // is full, submitting the queue to make room if needed.
+        template <typename TPrepare>
+        void Queue(IOUring &ring, TPrepare &&prepare)
+        {
+            while (!prepare()) {
+                ring.Submit(0);
+            }
+        }
+    }
+
+#if APPX_HAVE_IO_URING
+    struct SmallFileReader::RingSlot
+    {
+        File *file;
+        // Results of openat and statx, once doneCount is 2.
+        int openResult;
+        int statxResult;
+        int doneCount;
+        // -1 until openat completes.
+        int fd;
+        struct statx status;
+        // The size statx reported.
+        std::size_t size;
+        std::size_t readSize;
+    };
+#else
+    struct SmallFileReader::RingSlot
+    {
+    };
+#endif
+
+    SmallFileReader::SmallFileReader(std::vector<const std::string *> paths,
+                                     std::size_t maxSize,
+                                     std::size_t readAhead)
+        : paths(std::move(paths)),
+          maxSize(maxSize),
+          readAhead(std::max(readAhead, std::size_t(1)))
+    {
+        if (IOUring::IsCompiledIn()) {
+            try {
+                this->ring.reset(new IOUring(kRingEntries));
+            } catch (const ErrnoException &) {
+                // Read with threads instead.
+            }
+            // Linux 5.1 to 5.5 have io_uring, but not these operations.
+            if (this->ring &&
+                !(this->ring->Supports(IOUring::Operation::OpenAt) &&
+                  this->ring->Supports(IOUring::Operation::Statx) &&
+                  this->ring->Supports(IOUring::Operation::Read) &&
+                  this->ring->Supports(IOUring::Operation::Close))) {
+                this->ring.reset();
+            }
+        }
+        if (this->ring) {
+            this->threads.emplace_back(&SmallFileReader::RunRing, this);
+        } else {
+            unsigned threadCount = std::min(
+                std::max(std::thread::hardware_concurrency(), 1U) *
+                    kThreadsPerCPU,
+                unsigned(kMaxThreadCount));
+            for (unsigned i = 0; i < threadCount; ++i) {
+                this->threads.emplace_back(&SmallFileReader::RunThread, this);
+            }
+        }
+    }
+
+    SmallFileReader::~SmallFileReader()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->canStartFile.notify_all();
+        for (std::thread &thread : this->threads) {
+            thread.join();
+        }
+    }
+
+    bool SmallFileReader::Take(std::size_t index,
+                               std::vector<std::uint8_t> &data)
+    {
+        State state;
+        int error;
+        bool wakeReader = false;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            auto isDone = [this, index]() {
+                return index < this->nextFile &&
+                       this->files[index - this->firstFile].state !=
+                           State::Reading;
+            };
+            if (!isDone()) {
+                if (index >= this->nextFile) {
+                    this->wantedFile = std::max(this->wantedFile, index);
+                    if (this->readersWaiting > 0) {
+                        this->canStartFile.notify_all();
+                    }
+                }
+                ++this->takersWaiting;
+                this->fileRead.wait(lock, isDone);
+                --this->takersWaiting;
+            }
+            File &file = this->files[index - this->firstFile];
+            state = file.state;
+            error = file.error;
+            data = std::move(file.data);
+            file.data = std::vector<std::uint8_t>();
+            file.memory.Set(0);
+            file.state = State::Taken;
+            while (!this->files.empty() &&
+                   this->files.front().state == State::Taken) {
+                this->files.pop_front();
+                ++this->firstFile;
+            }
+            wakeReader = this->readersWaiting > 0 && this->ShouldResume();
+        }
+        if (wakeReader) {
+            this->canStartFile.notify_all();
+        }
+        if (state == State::Failed) {
+            throw ErrnoException(*this->paths[index], error);
+        }
+        return state == State::Read;
+    }
+
+    bool SmallFileReader::StartFile(std::unique_lock<std::mutex> &lock,
+                                    bool wait, std::size_t &index,
+                                    File *&file)
+    {
+        if (wait) {
+            ++this->readersWaiting;
+            this->canStartFile.wait(lock, [this]() {
+                return this->stopping ||
+                       this->nextFile == this->paths.size() ||
+                       this->ShouldResume();
+            });
+            --this->readersWaiting;
+        }
+        if (this->stopping || !this->CanStartFile()) {
+            return false;
+        }
+        index = this->nextFile++;
+        this->files.emplace_back();
+        file = &this->files.back();
+        return true;
+    }
+
+    void SmallFileReader::FinishFile(File &file, State state, int error)
+    {
+        bool wakeTakers;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            file.state = state;
+            file.error = error;
+            file.memory.Set(file.data.capacity());
+            wakeTakers = this->takersWaiting > 0;
+        }
+        if (wakeTakers) {
+            this->fileRead.notify_all();
+        }
+    }
+
+#if APPX_HAVE_IO_URING
+    void SmallFileReader::RunRing()
+    {
+        IOUring &ring = *this->ring;
+        this->ringSlots.reset(new RingSlot[kRingFileCount]());
+        RingSlot *slots = this->ringSlots.get();
+        std::vector<std::uint64_t> freeSlots;
+        for (std::uint64_t i = kRingFileCount; i > 0; --i) {
+            freeSlots.push_back(i - 1);
+        }
+        // Operations queued or submitted which did not complete yet.
+        std::size_t inFlightCount = 0;
+        try {
+            for (;;) {
+                {
+                    std::unique_lock<std::mutex> lock(this->mutex);
+                    std::size_t index;
+                    File *file;
+                    while (!freeSlots.empty() &&
+                           this->StartFile(lock, inFlightCount == 0, index,
+                                           file)) {
+                        std::uint64_t slotIndex = freeSlots.back();
+                        freeSlots.pop_back();
+                        RingSlot &slot = slots[slotIndex];
+                        slot = RingSlot();
+                        slot.file = file;
+                        slot.fd = -1;
+                        const char *path = this->paths[index]->c_str();
+                        std::uint64_t userData = slotIndex * kOperationCount;
+                        Queue(ring, [&]() {
+                            return ring.PrepareOpenAt(AT_FDCWD, path,
+                                                      O_RDONLY | O_CLOEXEC,
+                                                      userData + kOpen);
+                        });
+                        ++inFlightCount;
+                        Queue(ring, [&]() {
+                            return ring.PrepareStatx(
+                                AT_FDCWD, path, AT_STATX_SYNC_AS_STAT,
+                                STATX_TYPE | STATX_SIZE, &slot.status,
+                                userData + kStatx);
+                        });
+                        ++inFlightCount;
+                    }
+                }
+                if (inFlightCount == 0) {
+                    return;
+                }
+                ring.Submit(1);
+
+                std::uint64_t userData;
+                int result;
+                while (ring.PopCompletion(userData, result)) {
+                    --inFlightCount;
+                    std::uint64_t operation = userData % kOperationCount;
+                    std::uint64_t slotIndex = userData / kOperationCount;
+                    if (operation == kClose) {
+                        continue;
+                    }
+                    RingSlot &slot = slots[slotIndex];
+                    State state = State::Reading;
+                    int error = 0;
+                    if (operation == kOpen || operation == kStatx) {
+                        if (result == -EINVAL || result == -EOPNOTSUPP) {
+                            // The kernel cannot open or stat files this
+                            // way, which the probe did not catch.
+                            throw ErrnoException(-result);
+                        }
+                        if (operation == kOpen && result >= 0) {
+                            slot.fd = result;
+                        }
+                        (operation == kOpen ? slot.openResult
+                                            : slot.statxResult) = result;
+                        if (++slot.doneCount < 2) {
+                            continue;
+                        }
+                        if (slot.openResult < 0) {
+                            state = State::Failed;
+                            error = -slot.openResult;
+                        } else if (slot.statxResult < 0) {
+                            state = State::Failed;
+                            error = -slot.statxResult;
+                        } else if (!S_ISREG(slot.status.stx_mode) ||
+                                   slot.status.stx_size > this->maxSize) {
+                            state = State::Unsuitable;
+                        } else {
+                            slot.size =
+                                static_cast<std::size_t>(slot.status.stx_size);
+                            // One byte more than the file, to tell whether
+                            // it grew.
+                            slot.file->data.resize(slot.size + 1);
+                            slot.readSize = 0;
+                        }
+                    } else if (result == -EINTR || result == -EAGAIN) {
+                        // Read again.
+                    } else if (result < 0) {
+                        state = State::Failed;
+                        error = -result;
+                    } else {
+                        slot.readSize += static_cast<std::size_t>(result);
+                        if (slot.readSize > slot.size) {
+                            state = State::Unsuitable;
+                        } else if (result == 0 || slot.readSize == slot.size) {
+                            slot.file->data.resize(slot.readSize);
+                            state = State::Read;
+                        }
+                    }
+
+                    if (state == State::Reading) {
+                        std::vector<std::uint8_t> &data = slot.file->data;
+                        Queue(ring, [&]() {
+                            return ring.PrepareRead(
+                                slot.fd, data.data() + slot.readSize,
+                                data.size() - slot.readSize,
+                                static_cast<off_t>(slot.readSize),
+                                slotIndex * kOperationCount + kRead);
+                        });
+                        ++inFlightCount;
+                        continue;
+                    }
+                    if (slot.fd != -1) {
+                        Queue(ring, [&]() {
+                            return ring.PrepareClose(
+                                slot.fd, slotIndex * kOperationCount + kClose);
+                        });
+                        ++inFlightCount;
+                    }
+                    if (state != State::Read) {
+                        slot.file->data = std::vector<std::uint8_t>();
+                    }
+                    this->FinishFile(*slot.file, state, error);
+                    slot.file = nullptr;
+                    freeSlots.push_back(slotIndex);
+                }
+            }
+        } catch (const ErrnoException &) {
+            // The ring broke, or cannot open or stat files. Read the rest
+            // with threads.
+            this->AbandonRing(inFlightCount);
+            this->RunThread();
+        }
+    }
+
+    void SmallFileReader::AbandonRing(std::size_t inFlightCount)
+    {
+        for (std::size_t i = 0; i < kRingFileCount; ++i) {
+            RingSlot &slot = this->ringSlots[i];
+            if (!slot.file) {
+                continue;
+            }
+            // The kernel may still read into the buffer, so it is kept until
+            // the operations in flight complete, or the ring is torn down.
+            this->abandonedBuffers.push_back(std::move(slot.file->data));
+            slot.file->data = std::vector<std::uint8_t>();
+            this->FinishFile(*slot.file, State::Unsuitable, 0);
+            slot.file = nullptr;
+            if (slot.fd != -1) {
+                close(slot.fd);
+            }
+        }
+
+        // Close the files which openat operations still in flight open.
+        IOUring &ring = *this->ring;
+        try {
+            while (inFlightCount > 0) {
+                ring.Submit(1);
+                std::uint64_t userData;
+                int result;
+                while (ring.PopCompletion(userData, result)) {
+                    --inFlightCount;
+                    if (userData % kOperationCount == kOpen && result >= 0) {
+                        close(result);
+                    }
+                }
+            }
+        } catch (const ErrnoException &) {
+            // Nothing more can be done until the ring is torn down.
+            return;
+        }
+        this->abandonedBuffers.clear();
+    }
+#else
+    // Without io_uring, the ring is never created.
+    void SmallFileReader::RunRing()
+    {
+    }
+
+    void SmallFileReader::AbandonRing(std::size_t)
+    {
+    }
+#endif
+
+    void SmallFileReader::RunThread()
+    {
+        for (;;) {
+            std::size_t index;
+            File *file;
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                if (!this->StartFile(lock, true, index, file)) {
+                    return;
+                }
+            }
+            const std::string &path = *this->paths[index];
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1) {
+                this->FinishFile(*file, State::Failed, errno);
+                continue;
+            }
+            State state = State::Read;
+            int error = 0;
+            struct stat status;
+            if (fstat(fd, &status) != 0) {
+                state = State::Failed;
+                error = errno;
+            } else if (!S_ISREG(status.st_mode) ||
+                       static_cast<std::size_t>(status.st_size) >
+                           this->maxSize) {
+                state = State::Unsuitable;
+            } else {
+                std::vector<std::uint8_t> &data = file->data;
+                // One byte more than the file, to tell whether it grew.
+                data.resize(static_cast<std::size_t>(status.st_size) + 1);
+                std::size_t total = 0;
+                while (total < data.size()) {
+                    ssize_t read =
+                        ::read(fd, data.data() + total, data.size() - total);
+                    if (read < 0) {
+                        if (errno == EINTR) {
+                            continue;
+                        }
+                        state = State::Failed;
+                        error = errno;
+                        break;
+                    }
+                    if (read == 0) {
+                        break;
+                    }
+                    total += read;
+                }
+                if (state == State::Read && total == data.size()) {
+                    state = State::Unsuitable;
+                }
+                if (state == State::Read) {
+                    data.resize(total);
+                } else {
+                    data = std::vector<std::uint8_t>();
+                }
+            }
+            close(fd);
+            this->FinishFile(*file, state, error);
+        }
+    }
+}
+}
@@ -0,0 +1,91 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#include <APPX/ThreadPool.h>
+#include <cassert>
+#include <utility>
+
+namespace osinside {
+namespace appx {
+    ThreadPool::ThreadPool(unsigned threadCount)
+    {
+        assert(threadCount >= 1);
+        this->threads.reserve(threadCount);
+        for (unsigned i = 0; i < threadCount; ++i) {
+            this->threads.emplace_back(&ThreadPool::Work, this);
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->taskAvailable.notify_all();
+        for (std::thread &thread : this->threads) {
+            thread.join();
+        }
+    }
+
+    void ThreadPool::Submit(std::function<void()> task, std::uint64_t priority)
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->tasks.push(
+                Task{std::move(task), priority, this->nextSequence++});
+        }
+        this->taskAvailable.notify_one();
+    }
+
+    bool ThreadPool::RunQueuedTask(std::uint64_t minimumPriority)
+    {
+        std::function<void()> task;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (this->tasks.empty() ||
+                this->tasks.top().priority < minimumPriority) {
+                return false;
+            }
+            task = this->tasks.top().function;
+            this->tasks.pop();
+        }
+        task();
+        return true;
+    }
+
+    void ThreadPool::Work()
+    {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->taskAvailable.wait(lock, [this]() {
+                    return this->stopping || !this->tasks.empty();
+                });
+                if (this->stopping) {
+                    return;
+                }
+                // priority_queue::top is const, so the function must be
+                // copied rather than moved out.
+                task = this->tasks.top().function;
+                this->tasks.pop();
+            }
+            task();
+        }
+    }
+
+    unsigned DefaultJobCount()
+    {
+        unsigned count = std::thread::hardware_concurrency();
+        return count == 0 ? 1 : count;
+    }
+}
+}
@@ -0,0 +1,212 @@
+//
+// Copyright (c) 2016-2017, Facebook, Inc.
+// Copyright (c) 2021, Neal Gompa
+// All rights reserved.
+//
+// This source code is licensed under the Mozilla Public License, version 2.0.
+// For details, see the LICENSE file in the root directory of this source tree.
+// Portions of this code was previously licensed under a BSD-style license.
+// See the LICENSE-BSD file in the root directory of this source tree for details.
+
+#include <APPX/File.h>
+#include <APPX/JSON.h>
+#include <APPX/Memory.h>
+#include <APPX/Trace.h>
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace osinside {
+namespace appx {
+    namespace {
+        std::atomic<Tracer *> currentTracer(nullptr);
+
+        long CurrentThreadID()
+        {
+            thread_local long id = syscall(SYS_gettid);
+            return id;
+        }
+
+        double Microseconds(Tracer::Clock::duration duration)
+        {
+            return std::chrono::duration<double, std::micro>(duration)
+                .count();
+        }
+    }
+
+    Tracer::Tracer() : start(Clock::now()), mainThreadID(CurrentThreadID())
+    {
+    }
+
+    void Tracer::Add(Span span)
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->spans.push_back(std::move(span));
+    }
+
+    void Tracer::WriteChromeTrace(const std::string &path) const
+    {
+        std::ostringstream json;
+        json.precision(3);
+        json << std::fixed;
+        json << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        long pid = static_cast<long>(getpid());
+        json << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid
+             << ", \"tid\": " << this->mainThreadID
+             << ", \"args\": {\"name\": \"main\"}}";
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for (const Span &span : this->spans) {
+            json << ",\n{\"name\": " << JSONEncodeString(span.name)
+                 << ", \"cat\": \"" << span.category
+                 << "\", \"ph\": \"X\", \"ts\": "
+                 << Microseconds(span.start - this->start)
+                 << ", \"dur\": " << Microseconds(span.end - span.start)
+                 << ", \"pid\": " << pid << ", \"tid\": " << span.threadID;
+            if (!span.arguments.empty()) {
+                json << ", \"args\": {";
+                for (std::size_t i = 0; i < span.arguments.size(); ++i) {
+                    json << (i == 0 ? "" : ", ") << "\""
+                         << span.arguments[i].first
+                         << "\": " << span.arguments[i].second;
+                }
+                json << "}";
+            }
+            json << "}";
+        }
+        json << "\n]}\n";
+        std::string text = json.str();
+        FilePtr file = Open(path, "wb");
+        Write(file, text.size(), text.data());
+        if (std::fclose(file.release()) != 0) {
+            throw ErrnoException(path);
+        }
+    }
+
+    void Tracer::WriteSummary(std::FILE *out) const
+    {
+        struct Total
+        {
+            std::size_t count = 0;
+            Clock::duration time = Clock::duration::zero();
+            Clock::duration longest = Clock::duration::zero();
+            std::int64_t inputBytes = 0;
+            std::int64_t outputBytes = 0;
+            std::int64_t peakMemory = -1;
+        };
+        // Per-entry spans are named after the entry, so they are summed by
+        // category instead.
+        std::map<std::string, Total> totals;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            for (const Span &span : this->spans) {
+                std::string key = span.category;
+                if (key == "phase") {
+                    key += ":" + span.name;
+                }
+                Total &total = totals[key];
+                Clock::duration time = span.end - span.start;
+                total.count += 1;
+                total.time += time;
+                total.longest = std::max(total.longest, time);
+                total.inputBytes += span.inputBytes;
+                total.outputBytes += span.outputBytes;
+                total.peakMemory =
+                    std::max(total.peakMemory, span.peakMemory);
+            }
+        }
+        std::fprintf(out, "%-28s %8s %11s %11s %11s %11s %11s\n", "span",
+                     "count", "total ms", "max ms", "in MB", "out MB",
+                     "peak MB");
+        for (const auto &pair : totals) {
+            const Total &total = pair.second;
+            std::fprintf(out, "%-28s %8zu %11.1f %11.1f %11.1f %11.1f",
+                         pair.first.c_str(), total.count,
+                         Microseconds(total.time) / 1e3,
+                         Microseconds(total.longest) / 1e3,
+                         static_cast<double>(total.inputBytes) / 1e6,
+                         static_cast<double>(total.outputBytes) / 1e6);
+            if (total.peakMemory >= 0) {
+                std::fprintf(out, " %11.1f\n",
+                             static_cast<double>(total.peakMemory) / 1e6);
+            } else {
+                std::fprintf(out, " %11s\n", "-");
+            }
+        }
+        std::fprintf(out, "%-28s %8s %11.1f\n", "wall", "",
+                     Microseconds(Clock::now() - this->start) / 1e3);
+    }
+
+    void SetTracer(Tracer *tracer)
+    {
+        currentTracer.store(tracer, std::memory_order_release);
+    }
+
+    Tracer *GetTracer()
+    {
+        return currentTracer.load(std::memory_order_acquire);
+    }
+
+    void TraceSpan::Begin(const char *category, const char *name)
+    {
+        this->span.category = category;
+        this->span.name = name;
+        this->span.threadID = CurrentThreadID();
+        this->span.inputBytes = 0;
+        this->span.outputBytes = 0;
+        this->span.peakMemory = -1;
+        if (std::strcmp(category, "phase") == 0) {
+            ResetStagePeakMemoryUsage();
+        }
+        this->span.start = Tracer::Clock::now();
+    }
+
+    void TraceSpan::End()
+    {
+        this->span.end = Tracer::Clock::now();
+        if (std::strcmp(this->span.category, "phase") == 0) {
+            this->span.peakMemory =
+                static_cast<std::int64_t>(ResetStagePeakMemoryUsage());
+            this->AddArgument("peak_memory_bytes", this->span.peakMemory);
+        }
+        this->tracer->Add(std::move(this->span));
+    }
+
+    void TraceSpan::AddArgument(const char *key, const std::string &value)
+    {
+        if (this->tracer) {
+            this->span.arguments.emplace_back(key, JSONEncodeString(value));
+        }
+    }
+
+    void TraceSpan::AddArgument(const char *key, std::int64_t value)
+    {
+        if (this->tracer) {
+            this->span.arguments.emplace_back(key, std::to_string(value));
+        }
+    }
+
+    void TraceSpan::AddArgument(const char *key, double value)
+    {
+        if (this->tracer) {
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), "%.4g", value);
+            this->span.arguments.emplace_back(key, buffer);
+        }
+    }
+
+    void TraceSpan::SetBytes(std::int64_t inputBytes, std::int64_t outputBytes)
+    {
+        if (this->tracer) {
+            this->span.inputBytes = inputBytes;
+            this->span.outputBytes = outputBytes;
+            this->AddArgument("input_bytes", inputBytes);
+            this->AddArgument("output_bytes", outputBytes);
+        }
+    }
+}
+}
@@ -9,6 +9,7 @@
 // See the LICENSE-BSD file in the root directory of this source tree for details.
 
 #include <APPX/XML.h>
+#include <cstdlib>
 #include <unordered_map>
 
 namespace osinside {
@@ -32,5 +33,48 @@ namespace appx {
         }
         return encoded;
     }
+
+    std::string XMLDecodeString(const std::string &s)
+    {
+        static const std::unordered_map<std::string, char> sDecodeMap = {
+            {"quot", '"'}, {"amp", '&'}, {"apos", '\''},
+            {"lt", '<'},   {"gt", '>'},
+        };
+
+        std::string decoded;
+        decoded.reserve(s.size());
+        std::string::size_type i = 0;
+        while (i < s.size()) {
+            std::string::size_type semicolon = s.find(';', i);
+            if (s[i] != '&' || semicolon == std::string::npos) {
+                decoded += s[i];
+                i += 1;
+                continue;
+            }
+            std::string name = s.substr(i + 1, semicolon - i - 1);
+            auto it = sDecodeMap.find(name);
+            if (it != sDecodeMap.end()) {
+                decoded += it->second;
+                i = semicolon + 1;
+                continue;
+            }
+            if (name.size() > 1 && name[0] == '#') {
+                // Only ASCII references are expected in archive names
+                // written by this tool.
+                char *end;
+                bool isHex = name[1] == 'x';
+                long value = std::strtol(name.c_str() + (isHex ? 2 : 1), &end,
+                                         isHex ? 16 : 10);
+                if (*end == '\0' && value > 0 && value < 0x80) {
+                    decoded += static_cast<char>(value);
+                    i = semicolon + 1;
+                    continue;
+                }
+            }
+            decoded += s[i];
+            i += 1;
+        }
+        return decoded;
+    }
 }
 }
@@ -8,7 +8,9 @@
 // Portions of this code was previously licensed under a BSD-style license.
 // See the LICENSE-BSD file in the root directory of this source tree for details.
 
+#include <APPX/Trace.h>
 #include <APPX/ZIP.h>
+#include <cassert>
 #include <cstdio>
 #include <cstring>
 #include <string>
@@ -45,5 +47,68 @@ namespace appx {
         }
         return s;
     }
+
+    ZIPFileEntry CompressSmallZIPFileEntry(
+        std::vector<std::uint8_t> &data, const std::string &archiveFileName,
+        const CompressionPolicy &compressionPolicy, BlockCache *blockCache,
+        std::size_t size, const std::uint8_t *bytes)
+    {
+        assert(size <= ZIPBlock::kSize);
+        // An empty file has no blocks and a CRC32 of 0.
+        BlockDigest digest = BlockDigest();
+        if (size > 0) {
+            TraceSpan span("digest", "DigestBlocks");
+            DigestBlocks(size, bytes, size, &digest);
+            span.SetBytes(static_cast<std::int64_t>(size), 0);
+        }
+        int level = compressionPolicy.level;
+        int strategy = compressionPolicy.strategy;
+        bool isStored =
+            compressionPolicy.method == CompressionPolicy::Method::Store ||
+            _IsAPPXFile(archiveFileName);
+        bool isCached = false;
+        if (!isStored && size > 0) {
+            // This is also the Auto policy's sample, so the file is
+            // compressed once either way.
+            isCached = blockCache &&
+                       blockCache->Find(digest.sha256, level, strategy, data);
+            if (!isCached) {
+                TraceSpan span("deflate", "DeflateBlock");
+                DeflateBlock(level, strategy, size, bytes, data);
+                span.SetBytes(static_cast<std::int64_t>(size),
+                              static_cast<std::int64_t>(data.size()));
+            }
+        }
+        if (compressionPolicy.method == CompressionPolicy::Method::Auto &&
+            IsIncompressibleSample(static_cast<off_t>(size),
+                                   static_cast<off_t>(data.size()))) {
+            isStored = true;
+        }
+
+        std::vector<ZIPBlock> blocks;
+        if (isStored) {
+            data.assign(bytes, bytes + size);
+            if (size > 0) {
+                blocks.push_back(ZIPBlock(digest.sha256));
+            }
+            return ZIPFileEntry(archiveFileName, static_cast<off_t>(size),
+                                static_cast<off_t>(size),
+                                ZIPCompressionType::Store, 0, digest.crc32,
+                                blocks, SHA256Hash());
+        }
+        if (size > 0) {
+            if (blockCache && !isCached) {
+                blockCache->Insert(digest.sha256, level, strategy,
+                                   data.size(), data.data());
+            }
+            blocks.push_back(
+                ZIPBlock(digest.sha256, static_cast<off_t>(data.size())));
+        }
+        DeflateFinish(level, strategy, data);
+        return ZIPFileEntry(archiveFileName, static_cast<off_t>(data.size()),
+                            static_cast<off_t>(size),
+                            ZIPCompressionType::Deflate, 0, digest.crc32,
+                            blocks, SHA256Hash());
+    }
 }
 }
@@ -9,244 +9,84 @@
 // See the LICENSE-BSD file in the root directory of this source tree for details.
 
 #include <APPX/APPX.h>
+#include <APPX/BasePackage.h>
+#include <APPX/BlockCache.h>
+#include <APPX/Compression.h>
+#include <APPX/Deflate.h>
+#include <APPX/DirectoryWalker.h>
 #include <APPX/File.h>
-#include <cassert>
+#include <APPX/MappingFile.h>
+#include <APPX/Memory.h>
+#include <APPX/OutputFile.h>
+#include <APPX/Progress.h>
+#include <APPX/ThreadPool.h>
+#include <APPX/Trace.h>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
 #include <exception>
-#include <fstream>
-#include <fts.h>
-#include <iostream>
+#include <fcntl.h>
+#include <getopt.h>
 #include <memory>
-#include <sstream>
 #include <unistd.h>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 using namespace osinside::appx;
 
 namespace {
-struct FTSDeleter
-{
-    void operator()(FTS *fs)
-    {
-        if (fs) {
-            int rc = fts_close(fs);
-            if (rc != 0) {
-                throw ErrnoException();
-            }
-        }
-    }
-};
-
-// Get the archive name (i.e. the path excluding the top level directory) of
-// an fts traversal entry.
-std::string GetArchiveName(FTSENT *ent)
-{
-    std::vector<const char *> components;
-    components.reserve(ent->fts_level);
-    size_t namesLength = 0;
-    // Use do-while to allow files with fts_level == 0.
-    do {
-        components.push_back(ent->fts_name);
-        namesLength += ent->fts_namelen;
-        ent = ent->fts_parent;
-    } while (ent && ent->fts_level > 0);
-    size_t expectedLength =
-        (components.size() == 0 ? 0 : components.size() - 1) + namesLength;
-    std::string archiveName;
-    archiveName.reserve(expectedLength);
-    bool insertSlash = false;
-    for (auto i = components.rbegin(); i != components.rend(); ++i) {
-        if (insertSlash) {
-            archiveName += "/";
-        }
-        archiveName += *i;
-        insertSlash = true;
-    }
-    assert(archiveName.size() == expectedLength);
-    return archiveName;
-}
-
 // Given the path to a file or directory, add files to a mapping from archive
-// names to local filesystem paths.
+// names to local files.
 void GetArchiveFileList(const char *path,
-                        std::unordered_map<std::string, std::string> &fileNames)
+                        std::unordered_map<std::string, LocalFile> &fileNames)
 {
-    char *const paths[] = {const_cast<char *>(path), nullptr};
-    std::unique_ptr<FTS, FTSDeleter> fs(
-        fts_open(paths, FTS_NOSTAT | FTS_PHYSICAL, nullptr));
-    if (!fs) {
-        throw ErrnoException();
-    }
-    while (FTSENT *ent = fts_read(fs.get())) {
-        switch (ent->fts_info) {
-            case FTS_ERR:
-            case FTS_DNR:
-                throw ErrnoException(ent->fts_path, ent->fts_errno);
-
-            case FTS_D:
-            case FTS_DOT:
-            case FTS_DP:
-                // Ignore directories.
-                break;
-
-            case FTS_DEFAULT:
-            case FTS_F:
-            case FTS_NS:
-            case FTS_NSOK:
-            case FTS_SL:
-            case FTS_SLNONE:
-                fileNames.insert(std::make_pair(GetArchiveName(ent),
-                                                std::string(ent->fts_path)));
-                break;
-
-            default:
-                throw std::runtime_error("Unknown FTS info");
+    std::vector<WalkedFile> files;
+    WalkDirectory(path, files);
+    fileNames.reserve(fileNames.size() + files.size());
+    for (WalkedFile &file : files) {
+        if (file.hasStatus) {
+            fileNames.emplace(std::move(file.archiveName),
+                              LocalFile(std::move(file.path), file.status));
+        } else {
+            fileNames.emplace(std::move(file.archiveName),
+                              LocalFile(std::move(file.path)));
         }
     }
 }
 
-class MalformedMappingFileError : public std::exception
-{
-public:
-    explicit MalformedMappingFileError(off_t lineNumber)
-        : lineNumber(lineNumber)
-    {
-        this->SetFileName(nullptr);
-    }
-
-    const char *what() const noexcept override
-    {
-        return this->message.c_str();
-    }
-
-    void SetFileName(const char *fileName)
-    {
-        if (!fileName || strcmp(fileName, "") == 0) {
-            fileName = "(unknown)";
-        }
-        std::ostringstream ss;
-        ss << "Malformed mapping file: " << fileName << ":" << this->lineNumber;
-        this->message = ss.str();
-    }
-
-private:
-    std::string message;
-    off_t lineNumber;
-};
 
-bool GetLine(std::istream &file, std::string &out, char delimiter)
+// Parses a size in bytes with an optional K, M, or G suffix. Returns false if
+// text is malformed.
+bool ParseSize(const char *text, off_t &out)
 {
-    try {
-        std::getline(file, out, delimiter);
-    } catch (std::ios_base::failure &e) {
-        if (file.fail() || file.eof()) {
-            // Handled below.
-        } else {
-            throw;
-        }
-    }
-    if (file.bad()) {
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (errno != 0 || end == text || text[0] == '-') {
         return false;
     }
-    if (file.eof()) {
-        if (file.fail() && out.empty()) {
-            // Don't treat starting at EOF as a failure.
-            file.clear(file.rdstate() & ~std::istream::failbit);
-            return false;
-        } else {
-            // We parsed something and reached EOF. Process the line.
-            return true;
-        }
-    }
-    return true;
-}
-
-void GetArchiveFileListFromMappingFile(
-    std::istream &mappingFile,
-    std::unordered_map<std::string, std::string> &fileNames)
-{
-    static const char kWhitespace[] = " \t";
-    // TODO(strager): Make this parser more accepting. This parser is way too
-    // strict.
-    bool didReadHeader = false;
-    off_t lineNumber = 1;
-    for (;;) {
-        std::string line;
-        if (!GetLine(mappingFile, line, '\n')) {
+    int shift = 0;
+    switch (*end) {
+        case 'K':
+            shift = 10;
+            ++end;
+            break;
+        case 'M':
+            shift = 20;
+            ++end;
+            break;
+        case 'G':
+            shift = 30;
+            ++end;
             break;
-        }
-        if (mappingFile.fail()) {
-            // The line is too long.
-            throw MalformedMappingFileError(lineNumber);
-        }
-
-        // Trim leading and trailing whitespace and ignore blank lines.
-        {
-            auto first = line.find_first_not_of(kWhitespace);
-            if (first == std::string::npos) {
-                // Blank line.
-                continue;
-            }
-            auto last = line.find_last_not_of(kWhitespace);
-            assert(last != std::string::npos);
-            line.erase(last + 1, std::string::npos);
-            line.erase(0, first);
-        }
-        if (didReadHeader) {
-            // Parse the following:
-            //
-            //     "localPath" "archiveName"
-            //
-            // TODO(strager): Parse escaped quotes and other characters.
-            std::string::size_type quote1 = 0;
-            if (line[quote1] != '"') {
-                // Garbage before the first quote.
-                throw MalformedMappingFileError(lineNumber);
-            }
-            auto quote2 = line.find('"', quote1 + 1);
-            if (quote2 == std::string::npos) {
-                // Missing the second quote.
-                throw MalformedMappingFileError(lineNumber);
-            }
-            if (quote2 == quote1 + 1) {
-                // Empty local path.
-                throw MalformedMappingFileError(lineNumber);
-            }
-            auto quote3 = line.find_first_not_of(kWhitespace, quote2 + 1);
-            if (quote3 == std::string::npos) {
-                // Missing the archive name.
-                throw MalformedMappingFileError(lineNumber);
-            }
-            if (line[quote3] != '"') {
-                // Garbage between the second and third quotes.
-                throw MalformedMappingFileError(lineNumber);
-            }
-            auto quote4 = line.find('"', quote3 + 1);
-            if (quote4 == std::string::npos) {
-                // Missing the fourth quote.
-                throw MalformedMappingFileError(lineNumber);
-            }
-            if (quote4 == quote3 + 1) {
-                // Empty archive path.
-                throw MalformedMappingFileError(lineNumber);
-            }
-            if (quote4 != line.size() - 1) {
-                // Garbage after the fourth quote.
-                throw MalformedMappingFileError(lineNumber);
-            }
-            std::string localPath =
-                line.substr(quote1 + 1, quote2 - quote1 - 1);
-            std::string archiveName =
-                line.substr(quote3 + 1, quote4 - quote3 - 1);
-            fileNames.emplace(std::move(archiveName), std::move(localPath));
-        } else {
-            if (line != "[Files]") {
-                throw MalformedMappingFileError(lineNumber);
-            }
-            didReadHeader = true;
-        }
-        lineNumber += 1;
     }
+    if (*end != '\0' || value > (ULLONG_MAX >> 1 >> shift)) {
+        return false;
+    }
+    out = static_cast<off_t>(value << shift);
+    return true;
 }
 
 void PrintUsage(const char *programName)
@@ -261,12 +101,49 @@ void PrintUsage(const char *programName)
             "  -f -            specify a mapping file through standard input\n"
             "  -h              show this usage text and exit\n"
             "  -b              produce APPXBUNDLE instead of APPX\n"
+            "  --base old-appx copy unchanged files from old-appx instead of\n"
+            "                  compressing them again (old-appx must not be\n"
+            "                  the output file)\n"
+            "  --block-cache DIR\n"
+            "                  reuse compressed blocks from previous runs,\n"
+            "                  caching them in DIR\n"
+            "  --block-cache-size SIZE\n"
+            "                  limit the block cache to SIZE bytes (K, M, and G\n"
+            "                  suffixes are accepted; default: 1G)\n"
+            "  --deflate-backend NAME\n"
+            "                  compress with zlib, zlib-ng, or isal (if built\n"
+            "                  in; default: %s); see DEFLATE backends below\n"
+            "  --direct-io     write the output with O_DIRECT, bypassing the\n"
+            "                  page cache\n"
+            "  --drop-cache    drop the output from the page cache once it is\n"
+            "                  written, and each input once it is archived, so\n"
+            "                  they do not evict other files\n"
+            "  --fsync POLICY  none (the default), close (sync the output once\n"
+            "                  it is written), or a SIZE (also write back every\n"
+            "                  SIZE bytes)\n"
+            "  --io-uring      write the output with io_uring\n"
+            "  -j jobs         compress files using jobs threads (0 means one\n"
+            "                  per CPU); the output does not depend on jobs\n"
             "  -o output-file  write the APPX (or APPXBUNDLE if -b is specified)\n"
             "                  to the output-file (required)\n"
             "  -0, -1, -2, -3, -4, -5, -6, -7, -8, -9\n"
             "                  ZIP compression level\n"
             "  -0              no ZIP compression (store files)\n"
             "  -9              best ZIP compression\n"
+            "  --order ORDER   write files ordered by name (the default),\n"
+            "                  directory (each directory's files, then its\n"
+            "                  subdirectories), or physical (where the files\n"
+            "                  are on disk, for spinning disks)\n"
+            "  --policy PATTERN=POLICY\n"
+            "                  compress files matching PATTERN with POLICY\n"
+            "                  instead of the -0 to -9 level; may be repeated,\n"
+            "                  and the first matching PATTERN wins\n"
+            "  --progress=fd:N write progress events as JSON lines to file\n"
+            "                  descriptor N; see Progress below\n"
+            "  --stats         print the time spent in each phase and the memory\n"
+            "                  used by each part of appx to stderr\n"
+            "  --trace FILE    write a trace of each phase and file to FILE, for\n"
+            "                  chrome://tracing or https://ui.perfetto.dev\n"
             "\n"
             "An input is either:\n"
             "  A directory, indicating that all files and subdirectories \n"
@@ -279,11 +156,44 @@ void PrintUsage(const char *programName)
             "\n"
             "  [Files]\n"
             "  \"/path/to/local/file.exe\" \"appx_file.exe\"\n"
+            "  \"/path/to/local/image.png\" \"Assets/image.png\" store\n"
+            "\n"
+            "A quote within a path is written twice (\"\"), except that\n"
+            "\"a\"\"b\" alone on a line is still the local path a and the\n"
+            "archive name b. A POLICY after the archive name overrides\n"
+            "--policy for that file. A binary mapping file starts with\n"
+            "APPXMAP1, then has the local path, archive name, and POLICY (or\n"
+            "nothing) of each file, each preceded by its length as 4 bytes\n"
+            "(little endian).\n"
+            "\n"
+            "A PATTERN is a comma-separated list of extensions (e.g. .png,.ogg,\n"
+            "ignoring case) or wildcards matched against archive names (e.g.\n"
+            "Assets/*). A POLICY is one of:\n"
+            "  store           no compression\n"
+            "  deflate[:LEVEL] compression with the given level (default: the\n"
+            "                  -1 to -9 level, or 6)\n"
+            "  filtered[:LEVEL]\n"
+            "                  compression tuned for binaries such as DLLs\n"
+            "  huffman, rle    fast compression with the Huffman-only or RLE\n"
+            "                  strategies\n"
+            "  auto[:LEVEL]    compression, or no compression if a sample of\n"
+            "                  the file does not compress\n"
+            "For example: --policy .png,.ogg,.zip=store --policy .dll=filtered\n"
+            "\n"
+            "DEFLATE backends produce different (but equally valid) compressed\n"
+            "data. isal is the fastest, but has only three levels: -1 to -3,\n"
+            "-4 to -6, and -7 to -9, and ignores the filtered, huffman, and rle\n"
+            "strategies.\n"
+            "\n"
+            "Progress events are JSON objects, one per line, whose \"event\" is\n"
+            "\"begin\", \"entry_start\", \"entry_finish\", or \"progress\". A\n"
+            "\"progress\" event is written every second with the bytes read and\n"
+            "written, the current MB/s, the compression ratio, and an ETA.\n"
             "\n"
             "Supported target systems:\n"
             "  Windows 10 (UAP)\n"
             "  Windows 10 Mobile\n",
-            programName);
+            programName, DeflateBackendName(GetDeflateBackend()));
 }
 }
 
@@ -292,9 +202,57 @@ int main(int argc, char **argv) try {
     const char *certPath = NULL;
     const char *appxPath = NULL;
     int compressionLevel = Z_NO_COMPRESSION;
+    unsigned jobs = 1;
     bool isBundle = false;
-    std::unordered_map<std::string, std::string> fileNames;
-    while (int c = getopt(argc, argv, "0123456789bc:f:ho:")) {
+    // PATTERN=POLICY arguments, parsed once the compression level is known.
+    std::vector<std::string> policyArgs;
+    const char *blockCachePath = nullptr;
+    const char *basePath = nullptr;
+    off_t blockCacheSize = off_t(1) << 30;
+    OutputOptions outputOptions;
+    std::unordered_map<std::string, LocalFile> fileNames;
+    // Mapping files, read once tracing is set up.
+    std::vector<const char *> mappingFilePaths;
+    const char *tracePath = nullptr;
+    bool printStats = false;
+    int progressFD = -1;
+    EntryOrder order = EntryOrder::Name;
+    enum
+    {
+        kPolicyOption = 256,
+        kBlockCacheOption,
+        kBlockCacheSizeOption,
+        kBaseOption,
+        kDeflateBackendOption,
+        kDirectIOOption,
+        kDropCacheOption,
+        kFsyncOption,
+        kIOUringOption,
+        kOrderOption,
+        kProgressOption,
+        kStatsOption,
+        kTraceOption,
+    };
+    static const struct option longOptions[] = {
+        {"base", required_argument, nullptr, kBaseOption},
+        {"policy", required_argument, nullptr, kPolicyOption},
+        {"block-cache", required_argument, nullptr, kBlockCacheOption},
+        {"block-cache-size", required_argument, nullptr,
+         kBlockCacheSizeOption},
+        {"deflate-backend", required_argument, nullptr,
+         kDeflateBackendOption},
+        {"direct-io", no_argument, nullptr, kDirectIOOption},
+        {"drop-cache", no_argument, nullptr, kDropCacheOption},
+        {"fsync", required_argument, nullptr, kFsyncOption},
+        {"io-uring", no_argument, nullptr, kIOUringOption},
+        {"order", required_argument, nullptr, kOrderOption},
+        {"progress", required_argument, nullptr, kProgressOption},
+        {"stats", no_argument, nullptr, kStatsOption},
+        {"trace", required_argument, nullptr, kTraceOption},
+        {nullptr, 0, nullptr, 0},
+    };
+    while (int c = getopt_long(argc, argv, "0123456789bc:f:hj:o:",
+                               longOptions, nullptr)) {
         if (c == -1) {
             break;
         }
@@ -318,26 +276,107 @@ int main(int argc, char **argv) try {
                 certPath = optarg;
                 break;
             case 'f':
-                if (strcmp(optarg, "-") == 0) {
-                    std::cin.exceptions(std::istream::badbit |
-                                        std::istream::failbit);
-                    GetArchiveFileListFromMappingFile(std::cin, fileNames);
-                } else {
-                    std::ifstream file;
-                    file.exceptions(std::ifstream::badbit |
-                                    std::ifstream::failbit);
-                    file.open(optarg);
-                    try {
-                        GetArchiveFileListFromMappingFile(file, fileNames);
-                    } catch (MalformedMappingFileError &e) {
-                        e.SetFileName(optarg);
-                        throw;
-                    }
+                mappingFilePaths.push_back(optarg);
+                break;
+            case 'j': {
+                char *end;
+                errno = 0;
+                unsigned long value = strtoul(optarg, &end, 10);
+                if (errno != 0 || end == optarg || *end != '\0' ||
+                    value > UINT_MAX || optarg[0] == '-') {
+                    fprintf(stderr, "Invalid job count: %s\n", optarg);
+                    PrintUsage(programName);
+                    return 1;
                 }
+                jobs = value == 0 ? DefaultJobCount()
+                                  : static_cast<unsigned>(value);
                 break;
+            }
             case 'o':
                 appxPath = optarg;
                 break;
+            case kPolicyOption:
+                policyArgs.push_back(optarg);
+                break;
+            case kBaseOption:
+                basePath = optarg;
+                break;
+            case kBlockCacheOption:
+                blockCachePath = optarg;
+                break;
+            case kBlockCacheSizeOption:
+                if (!ParseSize(optarg, blockCacheSize)) {
+                    fprintf(stderr, "Invalid block cache size: %s\n", optarg);
+                    PrintUsage(programName);
+                    return 1;
+                }
+                break;
+            case kDeflateBackendOption:
+                try {
+                    SetDeflateBackend(ParseDeflateBackend(optarg));
+                } catch (std::invalid_argument &e) {
+                    fprintf(stderr, "Invalid --deflate-backend: %s\n",
+                            e.what());
+                    PrintUsage(programName);
+                    return 1;
+                }
+                break;
+            case kDirectIOOption:
+                outputOptions.direct = true;
+                break;
+            case kDropCacheOption:
+                outputOptions.dropCache = true;
+                break;
+            case kFsyncOption:
+                if (strcmp(optarg, "none") == 0) {
+                    outputOptions.syncPolicy = OutputOptions::SyncPolicy::None;
+                } else if (strcmp(optarg, "close") == 0) {
+                    outputOptions.syncPolicy =
+                        OutputOptions::SyncPolicy::Close;
+                } else if (ParseSize(optarg, outputOptions.syncInterval) &&
+                           outputOptions.syncInterval > 0) {
+                    outputOptions.syncPolicy =
+                        OutputOptions::SyncPolicy::Interval;
+                } else {
+                    fprintf(stderr, "Invalid --fsync policy: %s\n", optarg);
+                    PrintUsage(programName);
+                    return 1;
+                }
+                break;
+            case kIOUringOption:
+                outputOptions.backend = OutputOptions::Backend::IOUring;
+                break;
+            case kOrderOption:
+                try {
+                    order = ParseEntryOrder(optarg);
+                } catch (std::invalid_argument &e) {
+                    fprintf(stderr, "Invalid --order: %s\n", e.what());
+                    PrintUsage(programName);
+                    return 1;
+                }
+                break;
+            case kProgressOption: {
+                char *end;
+                errno = 0;
+                long fd = strncmp(optarg, "fd:", 3) == 0
+                              ? strtol(optarg + 3, &end, 10)
+                              : -1;
+                if (fd < 0 || fd > INT_MAX || errno != 0 ||
+                    end == optarg + 3 || *end != '\0' ||
+                    fcntl(static_cast<int>(fd), F_GETFD) == -1) {
+                    fprintf(stderr, "Invalid --progress: %s\n", optarg);
+                    PrintUsage(programName);
+                    return 1;
+                }
+                progressFD = static_cast<int>(fd);
+                break;
+            }
+            case kStatsOption:
+                printStats = true;
+                break;
+            case kTraceOption:
+                tracePath = optarg;
+                break;
             case '?':
                 fprintf(stderr, "Unknown option: %c\n", optopt);
                 PrintUsage(programName);
@@ -352,19 +391,43 @@ int main(int argc, char **argv) try {
         PrintUsage(programName);
         return 1;
     }
+    if (printStats && !CountOpenSSLAllocations()) {
+        fprintf(stderr, "warning: OpenSSL memory use will not be counted\n");
+    }
+    std::unique_ptr<Tracer> tracer;
+    if (tracePath || printStats) {
+        tracer.reset(new Tracer());
+        SetTracer(tracer.get());
+    }
+    std::unique_ptr<Progress> progress;
+    if (progressFD != -1) {
+        progress.reset(new Progress(progressFD, std::chrono::seconds(1)));
+        SetProgress(progress.get());
+    }
     argc -= optind;
     argv += optind;
-    for (char *const *i = argv; i != argv + argc; ++i) {
-        const char *arg = *i;
-        const char *equalSeparator = strchr(arg, '=');
-        if (equalSeparator) {
-            // ArchivePath=LocalPath specified.
-            fileNames.insert(std::make_pair(std::string(arg, equalSeparator),
-                                            std::string(equalSeparator + 1)));
-        } else {
-            // Local path specified. Infer archive path.
-            GetArchiveFileList(arg, fileNames);
+    // The level of policies which do not give one (e.g. deflate).
+    int policyLevel = compressionLevel == Z_NO_COMPRESSION
+                          ? Z_DEFAULT_COMPRESSION
+                          : compressionLevel;
+    {
+        TraceSpan span("phase", "walk");
+        for (const char *path : mappingFilePaths) {
+            ReadMappingFile(path, policyLevel, fileNames);
         }
+        for (char *const *i = argv; i != argv + argc; ++i) {
+            const char *arg = *i;
+            const char *equalSeparator = strchr(arg, '=');
+            if (equalSeparator) {
+                // ArchivePath=LocalPath specified.
+                fileNames.emplace(std::string(arg, equalSeparator),
+                                  LocalFile(std::string(equalSeparator + 1)));
+            } else {
+                // Local path specified. Infer archive path.
+                GetArchiveFileList(arg, fileNames);
+            }
+        }
+        span.AddArgument("count", static_cast<std::int64_t>(fileNames.size()));
     }
     if (fileNames.empty()) {
         fprintf(stderr, "Missing inputs\n");
@@ -375,10 +438,74 @@ int main(int argc, char **argv) try {
         fprintf(stderr, "You need to provide AppxBundleManifest.xml!\n");
         return 1;
     }
+    CompressionPolicies compressionPolicies(
+        CompressionPolicy::FromLevel(compressionLevel));
+    {
+        for (const std::string &arg : policyArgs) {
+            std::string::size_type equalSeparator = arg.rfind('=');
+            try {
+                if (equalSeparator == std::string::npos) {
+                    throw std::invalid_argument("Missing =");
+                }
+                compressionPolicies.Add(
+                    arg.substr(0, equalSeparator),
+                    ParseCompressionPolicy(arg.substr(equalSeparator + 1),
+                                           policyLevel));
+            } catch (std::invalid_argument &e) {
+                fprintf(stderr, "Invalid --policy %s: %s\n", arg.c_str(),
+                        e.what());
+                PrintUsage(programName);
+                return 1;
+            }
+        }
+    }
+    std::unique_ptr<BlockCache> blockCache;
+    if (blockCachePath) {
+        blockCache.reset(new BlockCache(blockCachePath, blockCacheSize));
+    }
+    std::unique_ptr<BasePackage> base;
+    if (basePath) {
+        base.reset(new BasePackage(basePath));
+        if (base->IsSameFile(appxPath)) {
+            fprintf(stderr, "--base %s must not be the output\n", basePath);
+            return 1;
+        }
+    }
     std::string certPathString = certPath ?: "";
-    FilePtr appx = Open(appxPath, "wb");
+    OutputFile appx(appxPath, outputOptions);
+    if (outputOptions.backend == OutputOptions::Backend::IOUring &&
+        !appx.UsesIOUring()) {
+        fprintf(stderr, "warning: io_uring is unavailable; using pwrite\n");
+    }
+    if (outputOptions.direct && !appx.IsDirect()) {
+        fprintf(stderr, "warning: O_DIRECT is unavailable for %s\n",
+                appxPath);
+    }
     WriteAppx(appx, fileNames, certPath ? &certPathString : nullptr,
-              compressionLevel, isBundle);
+              compressionPolicies, jobs, blockCache.get(), base.get(),
+              isBundle, order, outputOptions.dropCache);
+    {
+        TraceSpan span("phase", "close");
+        appx.Close();
+    }
+    if (blockCache) {
+        TraceSpan span("phase", "trim-block-cache");
+        blockCache->Trim();
+    }
+    if (progress) {
+        SetProgress(nullptr);
+        progress.reset();
+    }
+    if (tracer) {
+        SetTracer(nullptr);
+        if (tracePath) {
+            tracer->WriteChromeTrace(tracePath);
+        }
+        if (printStats) {
+            tracer->WriteSummary(stderr);
+            WriteMemorySummary(stderr);
+        }
+    }
     return 0;
 } catch (std::exception &e) {
     fprintf(stderr, "%s\n", e.what());
@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2016-present, Facebook, Inc.
+# Copyright (c) 2021, Neal Gompa
+# All rights reserved.
+#
+# This source code is licensed under the Mozilla Public License, version 2.0.
+# For details, see the LICENSE file in the root directory of this source tree.
+# Portions of this code was previously licensed under a BSD-style license.
+# See the LICENSE-BSD file in the root directory of this source tree for details.
+
+import appx.util
+import os
+import random
+import re
+import struct
+import subprocess
+import unittest
+import zipfile
+
+class TestBase(unittest.TestCase):
+    '''
+    Ensures --base copies unchanged files from a previous APPX.
+    '''
+
+    def _make_tree(self, d):
+        rng = random.Random(42)
+        words = [b'alpha', b'beta', b'gamma', b'delta', b'epsilon', b'\n']
+        files = {
+            'empty.txt': 0,
+            'small.txt': 100,
+            'sub dir/a&b.txt': 70000,
+            'medium.txt': 300000,
+            # Streamed.
+            'large.txt': 3000000,
+            'changed.txt': 200000,
+            'deleted.txt': 1000,
+        }
+        return appx.util.make_tree(d, {
+            name: b' '.join(rng.choice(words) for _ in range(size // 5))[:size]
+            for name, size in files.items()
+        })
+
+    def _change_tree(self, source):
+        with open(os.path.join(source, 'changed.txt'), 'r+b') as f:
+            f.seek(100000)
+            f.write(b'CHANGED')
+        os.remove(os.path.join(source, 'deleted.txt'))
+        with open(os.path.join(source, 'added.txt'), 'wb') as f:
+            f.write(b'new file\n' * 1000)
+
+    def _package(self, d, name, source, *args):
+        return appx.util.package(d, source, *args, name=name)
+
+    def _read_raw(self, path, name):
+        with zipfile.ZipFile(path) as zip:
+            info = zip.getinfo(name)
+        with open(path, 'rb') as f:
+            f.seek(info.header_offset)
+            header = f.read(30)
+            (name_length, extra_length) = struct.unpack('<HH', header[26:])
+            f.seek(name_length + extra_length, os.SEEK_CUR)
+            return f.read(info.compress_size)
+
+    def _strip_block_sizes(self, block_map):
+        return re.sub(rb'(<Block Hash="[^"]*") Size="[0-9]+"', rb'\1',
+                      block_map)
+
+    def test_same_level_matches_full_build(self):
+        with appx.util.temp_dir() as d:
+            source = self._make_tree(d)
+            base = self._package(d, 'base.appx', source, '-6')
+            self._change_tree(source)
+            expected = appx.util.read_file(self._package(d, 'full.appx', source, '-6'))
+            for jobs in ['1', '3']:
+                incremental = self._package(d, 'incremental.appx', source,
+                                            '-6', '-j', jobs, '--base', base)
+                self.assertEqual(expected, appx.util.read_file(incremental))
+
+    def test_unchanged_files_are_copied(self):
+        with appx.util.temp_dir() as d:
+            source = self._make_tree(d)
+            base = self._package(d, 'base.appx', source, '-1', '-c',
+                                 appx.util.test_key_path())
+            self._change_tree(source)
+            full = self._package(d, 'full.appx', source, '-9')
+            for jobs in ['1', '3']:
+                incremental = self._package(d, 'incremental.appx', source,
+                                            '-9', '-j', jobs, '--base', base)
+                # Unchanged files keep their level 1 compressed data.
+                for name in ['small.txt', 'sub%20dir/a%26b.txt', 'medium.txt',
+                             'large.txt']:
+                    self.assertEqual(self._read_raw(base, name),
+                                     self._read_raw(incremental, name))
+                for name in ['changed.txt', 'added.txt']:
+                    self.assertEqual(self._read_raw(full, name),
+                                     self._read_raw(incremental, name))
+                with zipfile.ZipFile(incremental) as zip:
+                    self.assertNotIn('deleted.txt', zip.namelist())
+                    self.assertIsNone(zip.testzip())
+                    block_map = zip.read('AppxBlockMap.xml')
+                with zipfile.ZipFile(full) as zip:
+                    # Only compressed block sizes differ.
+                    self.assertEqual(
+                        self._strip_block_sizes(zip.read('AppxBlockMap.xml')),
+                        self._strip_block_sizes(block_map))
+
+    def test_compression_method_must_match(self):
+        with appx.util.temp_dir() as d:
+            source = self._make_tree(d)
+            base = self._package(d, 'base.appx', source, '-0')
+            incremental = self._package(d, 'incremental.appx', source, '-6',
+                                        '--base', base)
+            expected = self._package(d, 'full.appx', source, '-6')
+            self.assertEqual(appx.util.read_file(expected), appx.util.read_file(incremental))
+
+    def test_invalid_base(self):
+        with appx.util.temp_dir() as d:
+            source = self._make_tree(d)
+            base = os.path.join(d, 'base.appx')
+            with open(base, 'wb') as f:
+                f.write(b'not a zip file' * 10)
+            with self.assertRaises(subprocess.CalledProcessError):
+                self._package(d, 'incremental.appx', source, '--base', base)
+
+    def test_base_is_output(self):
+        with appx.util.temp_dir() as d:
+            source = self._make_tree(d)
+            base = self._package(d, 'base.appx', source, '-9')
+            expected = appx.util.read_file(base)
+            link = os.path.join(d, 'link.appx')
+            os.link(base, link)
+            self._change_tree(source)
+            for output in ['base.appx', 'link.appx']:
+                with self.assertRaises(subprocess.CalledProcessError):
+                    appx.util.package(d, source, '-9', '--base', base,
+                                      name=output, stderr=subprocess.DEVNULL)
+                self.assertEqual(expected, appx.util.read_file(base))
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2016-present, Facebook, Inc.
+# Copyright (c) 2021, Neal Gompa
+# All rights reserved.
+#
+# This source code is licensed under the Mozilla Public License, version 2.0.
+# For details, see the LICENSE file in the root directory of this source tree.
+# Portions of this code was previously licensed under a BSD-style license.
+# See the LICENSE-BSD file in the root directory of this source tree for details.
+
+import appx.util
+import hashlib
+import os
+import random
+import stat
+import struct
+import subprocess
+import unittest
+import zipfile
+import zlib
+
+class TestBlockCache(unittest.TestCase):
+    '''
+    Ensures --block-cache reuses compressed blocks without changing the
+    APPX.
+    '''
+
+    def _make_tree(self, d):
+        rng = random.Random(42)
+        words = [b'alpha', b'beta', b'gamma', b'delta', b'epsilon', b'\n']
+        return appx.util.make_tree(d, {
+            'file{}.txt'.format(i):
+                b' '.join(rng.choice(words) for _ in range(size // 5))[:size]
+            for i, size in enumerate([0, 100, 65536, 300000, 2000000])
+        })
+
+    def _package(self, d, source, *args):
+        return appx.util.read_file(appx.util.package(d, source, *args))
+
+    def _cache_files(self, cache):
+        return sorted(os.path.join(root, name)
+                      for (root, dirs, files) in os.walk(cache)
+                      for name in files)
+
+    def test_cache_does_not_change_output(self):
+        with appx.util.temp_dir() as d:
+            source = self._make_tree(d)
+            cache = os.path.join(d, 'cache')
+            expected = self._package(d, source, '-6')
+            self.assertEqual(expected, self._package(
+                d, source, '-6', '--block-cache', cache))
+            files = self._cache_files(cache)
+            self.assertGreater(len(files), 0)
+            for jobs in ['1', '3']:
+                self.assertEqual(expected, self._package(
+                    d, source, '-6', '-j', jobs, '--block-cache', cache))
+                self.assertEqual(files, self._cache_files(cache))
+
+    def test_corrupt_entries_are_ignored(self):
+        with appx.util.temp_dir() as d:
+            source = self._make_tree(d)
+            cache = os.path.join(d, 'cache')
+            expected = self._package(d, source, '-6', '--block-cache', cache)
+            for path in self._cache_files(cache):
+                with open(path, 'r+b') as f:
+                    data = bytearray(f.read())
+                    data[len(data) // 2] ^= 0xFF
+                    f.seek(0)
+                    f.write(data)
+            self.assertEqual(expected, self._package(
+                d, source, '-6', '--block-cache', cache))
+
+    def test_cached_blocks_are_reused(self):
+        with appx.util.temp_dir() as d:
+            block = b'hello world\n' * 5000
+            source = appx.util.make_tree(d, {'hello.txt': block})
+            # Plant a valid but uncompressed encoding of the block, keyed like
+            # a level 9 block.
+            key = hashlib.sha256(
+                hashlib.sha256(block).digest() +
+                struct.pack('<ii', 9, zlib.Z_DEFAULT_STRATEGY) +
+                zlib.ZLIB_RUNTIME_VERSION.encode('utf-8')).hexdigest()
+            compressor = zlib.compressobj(0, zlib.DEFLATED, -15)
+            planted = (compressor.compress(block) +
+                       compressor.flush(zlib.Z_FULL_FLUSH))
+            cache = os.path.join(d, 'cache')
+            os.makedirs(os.path.join(cache, key[:2]))
+            with open(os.path.join(cache, key[:2], key[2:]), 'wb') as f:
+                f.write(b'APPXBLK1')
+                f.write(struct.pack('<I', zlib.crc32(planted)))
+                f.write(planted)
+            self._package(d, source, '-9', '--block-cache', cache)
+            with zipfile.ZipFile(os.path.join(d, 'test.appx')) as zip:
+                info = zip.getinfo('hello.txt')
+                self.assertEqual(len(planted) + 2, info.compress_size)
+                self.assertEqual(block, zip.read('hello.txt'))
+
+    def test_cache_size_limit(self):
+        with appx.util.temp_dir() as d:
+            source = self._make_tree(d)
+            cache = os.path.join(d, 'cache')
+            self._package(d, source, '-6', '--block-cache', cache,
+                          '--block-cache-size', '20K')
+            files = self._cache_files(cache)
+            self.assertGreater(len(files), 0)
+            self.assertLessEqual(sum(os.path.getsize(f) for f in files),
+                                 20 * 1024)
+
+    def test_temporary_files_are_not_trimmed(self):
+        with appx.util.temp_dir() as d:
+            source = self._make_tree(d)
+            cache = os.path.join(d, 'cache')
+            # Stands for an entry another process is still writing.
+            temporary = os.path.join(cache, 'ab', 'cd' * 31 + '.tmpAbCdEf')
+            os.makedirs(os.path.dirname(temporary))
+            with open(temporary, 'wb') as f:
+                f.write(b'APPXBLK1' * 4096)
+            self._package(d, source, '-6', '--block-cache', cache,
+                          '--block-cache-size', '1K')
+            self.assertEqual([temporary], self._cache_files(cache))
+
+    def test_entries_follow_umask(self):
+        with appx.util.temp_dir() as d:
+            source = self._make_tree(d)
+            for mask in [0o022, 0o002, 0o077]:
+                cache = os.path.join(d, 'cache{:o}'.format(mask))
+                old_mask = os.umask(mask)
+                try:
+                    self._package(d, source, '-6', '--block-cache', cache)
+                finally:
+                    os.umask(old_mask)
+                files = self._cache_files(cache)
+                self.assertGreater(len(files), 0)
+                for path in files:
+                    self.assertEqual(0o666 & ~mask,
+                                     stat.S_IMODE(os.stat(path).st_mode))
+
+    def test_invalid_cache_size(self):
+        with appx.util.temp_dir() as d:
+            source = self._make_tree(d)
+            with self.assertRaises(subprocess.CalledProcessError):
+                self._package(d, source, '--block-cache',
+                              os.path.join(d, 'cache'),
+                              '--block-cache-size', '12X')
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2016-present, Facebook, Inc.
+# Copyright (c) 2021, Neal Gompa
+# All rights reserved.
+#
+# This source code is licensed under the Mozilla Public License, version 2.0.
+# For details, see the LICENSE file in the root directory of this source tree.
+# Portions of this code was previously licensed under a BSD-style license.
+# See the LICENSE-BSD file in the root directory of this source tree for details.
+
+import appx.util
+import base64
+import hashlib
+import os
+import unittest
+import xml.etree.ElementTree as ElementTree
+import zipfile
+
+BLOCK_SIZE = 65536
+BLOCK_MAP_NAMESPACE = '{http://schemas.microsoft.com/appx/2010/blockmap}'
+
+class TestBlockMap(unittest.TestCase):
+    '''
+    Ensures the block hashes in AppxBlockMap.xml are the SHA256 digests of
+    each 64 KiB block of each file.
+    '''
+
+    # Sizes around the SHA256 padding boundaries and the block size.
+    _sizes = [0, 1, 55, 56, 63, 64, 119, 120, BLOCK_SIZE - 1, BLOCK_SIZE,
+              BLOCK_SIZE + 1, 2 * BLOCK_SIZE, 3 * BLOCK_SIZE + 55,
+              5 * BLOCK_SIZE + 120, 2 * 1024 * 1024 + 3]
+
+    def _check_block_hashes(self, *args):
+        with appx.util.temp_dir() as d:
+            source = appx.util.make_tree(
+                d, {'f{}.bin'.format(size): os.urandom(size)
+                    for size in self._sizes})
+            output = appx.util.package(d, source, *args)
+            with zipfile.ZipFile(output) as zip:
+                block_map = ElementTree.fromstring(zip.read('AppxBlockMap.xml'))
+                files = block_map.findall(BLOCK_MAP_NAMESPACE + 'File')
+                self.assertEqual(len(self._sizes), len(files))
+                for file in files:
+                    data = zip.read(file.get('Name'))
+                    expected = [
+                        base64.b64encode(hashlib.sha256(
+                            data[i:i + BLOCK_SIZE]).digest()).decode('ascii')
+                        for i in range(0, len(data), BLOCK_SIZE)]
+                    actual = [block.get('Hash') for block in
+                              file.findall(BLOCK_MAP_NAMESPACE + 'Block')]
+                    self.assertEqual(expected, actual, file.get('Name'))
+
+    def test_stored(self):
+        self._check_block_hashes('-0')
+
+    def test_stored_parallel(self):
+        self._check_block_hashes('-0', '-j', '3')
+
+    def test_compressed(self):
+        self._check_block_hashes('-6')
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,54 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2016-present, Facebook, Inc.
+# Copyright (c) 2021, Neal Gompa
+# All rights reserved.
+#
+# This source code is licensed under the Mozilla Public License, version 2.0.
+# For details, see the LICENSE file in the root directory of this source tree.
+# Portions of this code was previously licensed under a BSD-style license.
+# See the LICENSE-BSD file in the root directory of this source tree for details.
+
+import appx.util
+import os
+import unittest
+import zipfile
+import zlib
+
+BLOCK_SIZE = 65536
+
+class TestCRC32(unittest.TestCase):
+    '''
+    Ensures the CRC32 of each file in the ZIP's central directory matches
+    zlib's, whether the file is stored or compressed in parallel blocks.
+    '''
+
+    # Sizes around the 16- and 64-byte folding granularities and the block
+    # size.
+    _sizes = [0, 1, 15, 16, 17, 63, 64, 65, 127, 128, 129, 1000,
+              BLOCK_SIZE - 1, BLOCK_SIZE, BLOCK_SIZE + 17, 3 * BLOCK_SIZE + 5,
+              3 * 1024 * 1024 + 7]
+
+    def _check_crcs(self, *args):
+        with appx.util.temp_dir() as d:
+            contents = {'f{}.bin'.format(size): os.urandom(size)
+                        for size in self._sizes}
+            source = appx.util.make_tree(d, contents)
+            output = appx.util.package(d, source, *args)
+            with zipfile.ZipFile(output) as zip:
+                self.assertIsNone(zip.testzip())
+                for name, data in contents.items():
+                    self.assertEqual(zlib.crc32(data),
+                                     zip.getinfo(name).CRC, name)
+
+    def test_stored(self):
+        self._check_crcs('-0')
+
+    def test_compressed(self):
+        self._check_crcs('-6')
+
+    def test_compressed_parallel(self):
+        self._check_crcs('-6', '-j', '4')
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2016-present, Facebook, Inc.
+# Copyright (c) 2021, Neal Gompa
+# All rights reserved.
+#
+# This source code is licensed under the Mozilla Public License, version 2.0.
+# For details, see the LICENSE file in the root directory of this source tree.
+# Portions of this code was previously licensed under a BSD-style license.
+# See the LICENSE-BSD file in the root directory of this source tree for details.
+
+import appx.util
+import os
+import random
+import struct
+import subprocess
+import unittest
+import zipfile
+import zlib
+
+class TestCompressionPolicy(unittest.TestCase):
+    '''
+    Ensures files are compressed with the requested level, and with the
+    policies given by --policy.
+    '''
+
+    def _make_tree(self, d):
+        rng = random.Random(42)
+        words = [b'alpha', b'beta', b'gamma', b'delta', b'epsilon', b'\n']
+        text = b' '.join(rng.choice(words) for _ in range(100000))
+        contents = {name: text
+                    for name in ['a.txt', 'b.dll', 'c.PNG', 'Assets/d.txt']}
+        contents['random.bin'] = appx.util.random_bytes(rng, 300000)
+        return appx.util.make_tree(d, contents)
+
+    def _package(self, d, source, *args):
+        return appx.util.package(d, source, *args)
+
+    def _read_raw(self, path, info):
+        with open(path, 'rb') as f:
+            f.seek(info.header_offset)
+            header = f.read(30)
+            (name_length, extra_length) = struct.unpack('<HH', header[26:])
+            f.seek(name_length + extra_length, os.SEEK_CUR)
+            return f.read(info.compress_size)
+
+    def _expected_deflate(self, data, level, strategy=zlib.Z_DEFAULT_STRATEGY):
+        # Every 64 KiB block is compressed independently and ends with a full
+        # flush.
+        out = b''
+        for i in range(0, len(data), 65536):
+            compressor = zlib.compressobj(level, zlib.DEFLATED, -15, 9,
+                                          strategy)
+            out += compressor.compress(data[i:i + 65536])
+            out += compressor.flush(zlib.Z_FULL_FLUSH)
+        return out + b'\x03\x00'
+
+    def _check_deflated(self, path, zip, name, level,
+                        strategy=zlib.Z_DEFAULT_STRATEGY):
+        info = zip.getinfo(name)
+        self.assertEqual(zipfile.ZIP_DEFLATED, info.compress_type)
+        self.assertEqual(
+            self._expected_deflate(zip.read(name), level, strategy),
+            self._read_raw(path, info))
+
+    def test_compression_level(self):
+        with appx.util.temp_dir() as d:
+            source = self._make_tree(d)
+            for level in [1, 5, 9]:
+                path = self._package(d, source, '-{}'.format(level))
+                with zipfile.ZipFile(path) as zip:
+                    self._check_deflated(path, zip, 'a.txt', level)
+
+    def test_policies(self):
+        with appx.util.temp_dir() as d:
+            source = self._make_tree(d)
+            path = self._package(d, source, '-9',
+                                 '--policy', '.png,.bin=store',
+                                 '--policy', '.dll=filtered:7',
+                                 '--policy', 'Assets/*=deflate:1',
+                                 '--policy', '*.txt=store')
+            with zipfile.ZipFile(path) as zip:
+                # Extensions ignore case.
+                self.assertEqual(zipfile.ZIP_STORED,
+                                 zip.getinfo('c.PNG').compress_type)
+                self.assertEqual(zipfile.ZIP_STORED,
+                                 zip.getinfo('random.bin').compress_type)
+                self._check_deflated(path, zip, 'b.dll', 7, zlib.Z_FILTERED)
+                # The first matching pattern wins.
+                self._check_deflated(path, zip, 'Assets/d.txt', 1)
+                self.assertEqual(zipfile.ZIP_STORED,
+                                 zip.getinfo('a.txt').compress_type)
+                self.assertIsNone(zip.testzip())
+
+    def test_policy_without_level_uses_compression_level(self):
+        with appx.util.temp_dir() as d:
+            source = self._make_tree(d)
+            path = self._package(d, source, '--policy', '.dll=deflate',
+                                 '-3', '--policy', '.txt=rle')
+            with zipfile.ZipFile(path) as zip:
+                self._check_deflated(path, zip, 'b.dll', 3)
+                self._check_deflated(path, zip, 'a.txt', 3, zlib.Z_RLE)
+
+    def test_auto_stores_incompressible_files(self):
+        with appx.util.temp_dir() as d:
+            source = self._make_tree(d)
+            for jobs in ['1', '4']:
+                path = self._package(d, source, '-j', jobs, '--policy',
+                                     '*=auto:6')
+                with zipfile.ZipFile(path) as zip:
+                    self.assertEqual(zipfile.ZIP_STORED,
+                                     zip.getinfo('random.bin').compress_type)
+                    self._check_deflated(path, zip, 'a.txt', 6)
+                    self.assertIsNone(zip.testzip())
+
+    def test_invalid_policy(self):
+        with appx.util.temp_dir() as d:
+            source = self._make_tree(d)
+            for policy in ['.png', '.png=shrink', '.png=deflate:10',
+                           ',=store']:
+                with self.assertRaises(subprocess.CalledProcessError):
+                    self._package(d, source, '--policy', policy)
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2016-present, Facebook, Inc.
+# Copyright (c) 2021, Neal Gompa
+# All rights reserved.
+#
+# This source code is licensed under the Mozilla Public License, version 2.0.
+# For details, see the LICENSE file in the root directory of this source tree.
+# Portions of this code was previously licensed under a BSD-style license.
+# See the LICENSE-BSD file in the root directory of this source tree for details.
+
+from appx.util import appx_exe
+import appx.util
+import os
+import struct
+import subprocess
+import unittest
+import xml.etree.ElementTree as ElementTree
+import zipfile
+import zlib
+
+BLOCK_SIZE = 65536
+BLOCK_MAP_NAMESPACE = '{http://schemas.microsoft.com/appx/2010/blockmap}'
+ALL_BACKENDS = ['zlib', 'zlib-ng', 'isal']
+
+def built_backends():
+    # Set by CMake from the backends it found; see appx_add_test.
+    return os.getenv('APPX_DEFLATE_BACKENDS', 'zlib').split(',')
+
+class TestDeflateBackends(unittest.TestCase):
+    '''
+    Ensures every DEFLATE backend built into appx produces data which stock
+    zlib inflates, with each block of the block map inflating on its own.
+    '''
+
+    def _contents(self):
+        text = b''.join(b'line %d of some compressible text\n' % i
+                        for i in range(20000))
+        # Repeats across every block boundary, so a backend which kept its
+        # window between blocks would emit references into the last block.
+        pattern = b'0123456789abcdef' * (BLOCK_SIZE // 16)
+        return {
+            'empty.txt': b'',
+            'small.txt': b'hello, world\n',
+            'text.txt': text,
+            'random.bin': os.urandom(3 * BLOCK_SIZE + 123),
+            'mixed.bin': text[:BLOCK_SIZE] + os.urandom(BLOCK_SIZE) + text,
+            'one-block.bin': pattern,
+            'one-block-plus-one.bin': pattern + b'0',
+            'repeated.bin': pattern * 4,
+            'zeros.bin': bytes(2 * BLOCK_SIZE + 1),
+        }
+
+    def _raw_data(self, path, info):
+        with open(path, 'rb') as f:
+            f.seek(info.header_offset)
+            header = f.read(30)
+            name_size, extra_size = struct.unpack('<HH', header[26:30])
+            f.seek(info.header_offset + 30 + name_size + extra_size)
+            return f.read(info.compress_size)
+
+    def _check_backend(self, backend, *args):
+        with appx.util.temp_dir() as d:
+            contents = self._contents()
+            source = appx.util.make_tree(d, contents)
+            output = appx.util.package(d, source, '--deflate-backend', backend,
+                                       *args)
+
+            with zipfile.ZipFile(output) as zip:
+                self.assertIsNone(zip.testzip())
+                block_map = ElementTree.fromstring(zip.read('AppxBlockMap.xml'))
+                for name, data in contents.items():
+                    info = zip.getinfo(name)
+                    self.assertEqual(zipfile.ZIP_DEFLATED, info.compress_type)
+                    raw = self._raw_data(output, info)
+                    inflater = zlib.decompressobj(-zlib.MAX_WBITS)
+                    self.assertEqual(data, inflater.decompress(raw), name)
+                    self.assertTrue(inflater.eof, name)
+                    self.assertEqual(b'', inflater.unused_data, name)
+
+                    # Each block starts on a byte boundary with an empty
+                    # dictionary, so it inflates without its predecessors,
+                    # and holds exactly its own part of the file.
+                    file = [f for f in block_map.findall(
+                                BLOCK_MAP_NAMESPACE + 'File')
+                            if f.get('Name') == name][0]
+                    blocks = file.findall(BLOCK_MAP_NAMESPACE + 'Block')
+                    self.assertEqual((len(data) + BLOCK_SIZE - 1) // BLOCK_SIZE,
+                                     len(blocks), name)
+                    offset = 0
+                    for i, block in enumerate(blocks):
+                        size = int(block.get('Size'))
+                        inflater = zlib.decompressobj(-zlib.MAX_WBITS)
+                        self.assertEqual(
+                            data[i * BLOCK_SIZE:(i + 1) * BLOCK_SIZE],
+                            inflater.decompress(raw[offset:offset + size]),
+                            '{} block {}'.format(name, i))
+                        if i < len(blocks) - 1:
+                            # Only the end of the file may end the stream.
+                            self.assertFalse(inflater.eof,
+                                             '{} block {}'.format(name, i))
+                        offset += size
+                    # The blocks may leave out only the end of the stream.
+                    self.assertLessEqual(offset, len(raw), name)
+
+    def _check_built_backends(self, *args):
+        for backend in built_backends():
+            with self.subTest(backend=backend):
+                self._check_backend(backend, *args)
+
+    def test_fast(self):
+        self._check_built_backends('-1')
+
+    def test_default(self):
+        self._check_built_backends('-6')
+
+    def test_best_parallel(self):
+        self._check_built_backends('-9', '-j', '3')
+
+    def test_filtered(self):
+        self._check_built_backends('--policy', '*=filtered:6')
+
+    def test_unavailable_backends(self):
+        for backend in ALL_BACKENDS:
+            if backend in built_backends():
+                continue
+            with self.subTest(backend=backend), appx.util.temp_dir() as d:
+                process = subprocess.run(
+                    [appx_exe(), '--deflate-backend', backend, '-o',
+                     os.path.join(d, 'test.appx'), d],
+                    stderr=subprocess.PIPE)
+                self.assertEqual(1, process.returncode)
+                self.assertIn(b'not available', process.stderr)
+
+    def test_unknown_backend(self):
+        with appx.util.temp_dir() as d:
+            process = subprocess.run(
+                [appx_exe(), '--deflate-backend', 'nonexistent', '-o',
+                 os.path.join(d, 'test.appx'), d],
+                stderr=subprocess.PIPE)
+            self.assertEqual(1, process.returncode)
+            self.assertIn(b'Unknown DEFLATE backend', process.stderr)
+
+if __name__ == '__main__':
+    unittest.main()
@@ -13,7 +13,9 @@ from appx.util import appx_exe
 import appx.util
 import errno
 import os
+import struct
 import subprocess
+import threading
 import unittest
 import zipfile
 
@@ -56,6 +58,36 @@ class TestInputs(unittest.TestCase):
                 self.assertNotIn('somedir/', zip.namelist())
                 self.assertNotIn('test.appx', zip.namelist())
 
+    def test_directory_tree(self):
+        # Enough directories for every walking thread, nested unevenly.
+        with appx.util.temp_dir() as d:
+            source = os.path.join(d, 'source')
+            contents = {}
+            for i in range(200):
+                parts = ['d{}'.format(i % 7)]
+                for depth in range(i % 5):
+                    parts.append('s{}'.format((i // 7 + depth) % 3))
+                parts.append('f{}.txt'.format(i))
+                name = '/'.join(parts)
+                contents[name] = 'file {}\n'.format(i).encode('utf-8')
+                path = os.path.join(source, *parts)
+                os.makedirs(os.path.dirname(path), exist_ok=True)
+                with open(path, 'wb') as f:
+                    f.write(contents[name])
+            os.makedirs(os.path.join(source, 'empty', 'dir'))
+            os.symlink('f0.txt', os.path.join(source, 'd0', 'link.txt'))
+            contents['d0/link.txt'] = contents['d0/f0.txt']
+            # A trailing slash does not change archive names.
+            for root in [source, source + '/']:
+                subprocess.check_call([appx_exe(), '-o',
+                                       os.path.join(d, 'test.appx'), root])
+                with zipfile.ZipFile(os.path.join(d, 'test.appx')) as zip:
+                    names = set(zip.namelist()) - {'AppxBlockMap.xml',
+                                                   '[Content_Types].xml'}
+                    self.assertEqual(names, set(contents))
+                    for name, data in contents.items():
+                        self.assertEqual(zip.read(name), data, name)
+
     def test_file_mapping(self):
         with appx.util.temp_dir() as d:
             with open(os.path.join(d, 'README.txt'), 'wb') as readme:
@@ -73,6 +105,26 @@ class TestInputs(unittest.TestCase):
                 self.assertNotIn('other_file.dll', zip.namelist())
                 self.assertIn('somedir/other_file.dll', zip.namelist())
 
+    def test_pipe(self):
+        data = b''.join(b'line %d\n' % i for i in range(30000))
+        for level in ['-0', '-9']:
+            with appx.util.temp_dir() as d:
+                fifo_path = os.path.join(d, 'fifo')
+                os.mkfifo(fifo_path)
+                def write_fifo():
+                    with open(fifo_path, 'wb') as fifo:
+                        fifo.write(data)
+                writer = threading.Thread(target=write_fifo)
+                writer.start()
+                try:
+                    subprocess.check_call([
+                        appx_exe(), '-o', os.path.join(d, 'test.appx'), level,
+                        'data.txt={}'.format(fifo_path)])
+                finally:
+                    writer.join()
+                with zipfile.ZipFile(os.path.join(d, 'test.appx')) as zip:
+                    self.assertEqual(data, zip.read('data.txt'))
+
     def test_mapping_file(self):
         with appx.util.temp_dir() as d:
             with open(os.path.join(d, 'README.txt'), 'wb') as readme:
@@ -142,6 +194,11 @@ class TestInputs(unittest.TestCase):
                     ' "{}" "README.txt"\t\n'
                     ' \n'.format(self.__quote_mapping_file_path(
                         os.path.join(d, 'README.txt')))),
+
+                # No whitespace between the fields, as older versions
+                # accepted before quotes could be written twice.
+                '[Files]\n"{}""README.txt"\n'.format(
+                    os.path.join(d, 'README.txt')),
             ]
             for mapping_file_test_case in mapping_file_test_cases:
                 with open(os.path.join(d, 'mapping.txt'), 'w') as mapping_file:
@@ -169,6 +226,9 @@ class TestInputs(unittest.TestCase):
                 '[Files]\n"{}" "README.txt" ""\n'.format(
                     self.__quote_mapping_file_path(
                         os.path.join(d, 'README.txt'))),
+                # Adjacent fields are only read as such alone on a line.
+                '[Files]\n"{}""README.txt" store\n'.format(
+                    os.path.join(d, 'README.txt')),
             ]
             for mapping_file_test_case in mapping_file_test_cases:
                 with open(os.path.join(d, 'mapping.txt'), 'w') as mapping_file:
@@ -217,10 +277,102 @@ class TestInputs(unittest.TestCase):
                 self.assertNotIn('other_file.dll', zip.namelist())
                 self.assertIn('somedir/other_file.dll', zip.namelist())
 
+    def test_mapping_file_quotes(self):
+        with appx.util.temp_dir() as d:
+            with open(os.path.join(d, 'say "hi".txt'), 'wb') as readme:
+                readme.write(b'hi\n')
+            with open(os.path.join(d, 'mapping.txt'), 'w') as mapping_file:
+                mapping_file.write('[Files]\n"{}" "{}"\n'.format(
+                    self.__quote_mapping_file_path(
+                        os.path.join(d, 'say "hi".txt')),
+                    self.__quote_mapping_file_path('Assets/"hi".txt')))
+            subprocess.check_call([
+                appx_exe(), '-o', os.path.join(d, 'test.appx'),
+                '-f', os.path.join(d, 'mapping.txt'),
+            ])
+            with zipfile.ZipFile(os.path.join(d, 'test.appx')) as zip:
+                # Quotes are percent-encoded in the package.
+                self.assertEqual(b'hi\n', zip.read('Assets/%22hi%22.txt'))
+
+    def test_mapping_file_policy(self):
+        with appx.util.temp_dir() as d:
+            data = b'compressible\n' * 1000
+            for name in ['a.txt', 'b.txt']:
+                with open(os.path.join(d, name), 'wb') as f:
+                    f.write(data)
+            with open(os.path.join(d, 'mapping.txt'), 'w') as mapping_file:
+                mapping_file.write(
+                    '[Files]\n'
+                    '"{}" "a.txt" store\n'
+                    '"{}" "b.txt"\n'.format(
+                        self.__quote_mapping_file_path(
+                            os.path.join(d, 'a.txt')),
+                        self.__quote_mapping_file_path(
+                            os.path.join(d, 'b.txt'))))
+            subprocess.check_call([
+                appx_exe(), '-o', os.path.join(d, 'test.appx'), '-9',
+                '-f', os.path.join(d, 'mapping.txt'),
+            ])
+            with zipfile.ZipFile(os.path.join(d, 'test.appx')) as zip:
+                self.assertEqual(zipfile.ZIP_STORED,
+                                 zip.getinfo('a.txt').compress_type)
+                self.assertEqual(zipfile.ZIP_DEFLATED,
+                                 zip.getinfo('b.txt').compress_type)
+                self.assertEqual(data, zip.read('a.txt'))
+                self.assertEqual(data, zip.read('b.txt'))
+
+    def test_binary_mapping_file(self):
+        with appx.util.temp_dir() as d:
+            with open(os.path.join(d, 'README.txt'), 'wb') as readme:
+                readme.write(b'This is a test file.\n')
+            with open(os.path.join(d, 'other_file.dll'), 'wb') as other_file:
+                other_file.write(b'MZ')
+            mapping = self.__binary_mapping_file([
+                (os.path.join(d, 'README.txt'), 'README.txt', ''),
+                (os.path.join(d, 'other_file.dll'), 'somedir/other_file.dll',
+                 'store'),
+            ])
+            with open(os.path.join(d, 'mapping.bin'), 'wb') as mapping_file:
+                mapping_file.write(mapping)
+            subprocess.check_call([
+                appx_exe(), '-o', os.path.join(d, 'test.appx'),
+                '-f', os.path.join(d, 'mapping.bin'),
+            ])
+            with zipfile.ZipFile(os.path.join(d, 'test.appx')) as zip:
+                self.assertIn('README.txt', zip.namelist())
+                self.assertNotIn('other_file.dll', zip.namelist())
+                self.assertEqual(
+                    zipfile.ZIP_STORED,
+                    zip.getinfo('somedir/other_file.dll').compress_type)
+
+            # Truncated, and missing an archive name.
+            for corrupt in [mapping[:-1],
+                            self.__binary_mapping_file([
+                                (os.path.join(d, 'README.txt'), '', '')])]:
+                with open(os.path.join(d, 'mapping.bin'), 'wb') \
+                    as mapping_file:
+                    mapping_file.write(corrupt)
+                process = subprocess.Popen([
+                    appx_exe(), '-o', os.path.join(d, 'test.appx'),
+                    '-f', os.path.join(d, 'mapping.bin'),
+                ], stderr=subprocess.PIPE)
+                (_, stderr) = process.communicate()
+                self.assertEqual(1, process.returncode)
+                self.assertIn('mapping.bin', stderr.decode('utf-8'))
+                self.assertIn('Malformed', stderr.decode('utf-8'))
+
+    @staticmethod
+    def __binary_mapping_file(files):
+        mapping = b'APPXMAP1'
+        for strings in files:
+            for string in strings:
+                data = string.encode('utf-8')
+                mapping += struct.pack('<I', len(data)) + data
+        return mapping
+
     @staticmethod
     def __quote_mapping_file_path(path):
-        # TODO(strager): Escape '"'.
-        return path
+        return path.replace('"', '""')
 
 if __name__ == '__main__':
     unittest.main()
@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2016-present, Facebook, Inc.
+# Copyright (c) 2021, Neal Gompa
+# All rights reserved.
+#
+# This source code is licensed under the Mozilla Public License, version 2.0.
+# For details, see the LICENSE file in the root directory of this source tree.
+# Portions of this code was previously licensed under a BSD-style license.
+# See the LICENSE-BSD file in the root directory of this source tree for details.
+
+from appx.util import appx_exe
+import appx.util
+import os
+import subprocess
+import unittest
+import zipfile
+
+METADATA_FILES = ['AppxBlockMap.xml', '[Content_Types].xml']
+
+class TestOrder(unittest.TestCase):
+    '''
+    Ensures files are written in the requested --order, and that the same
+    inputs always produce the same package.
+    '''
+
+    _names = ['z', 'top', 'a/b0', 'a/b.txt', 'a/b/d', 'a/b/c', 'a-b/y',
+              'A/upper'] + ['many/f{}'.format(i) for i in range(50)]
+
+    def _make_source(self, d, names):
+        # Files are created in the order of names.
+        return appx.util.make_tree(
+            d, {name: name.encode('utf-8') * 100 for name in names})
+
+    def _package(self, d, source, *args):
+        output = appx.util.package(d, source, *args)
+        with zipfile.ZipFile(output) as zip:
+            self.assertIsNone(zip.testzip())
+            names = [i.filename for i in zip.infolist()]
+        return names, appx.util.read_file(output)
+
+    def test_name_order(self):
+        with appx.util.temp_dir() as d:
+            source = self._make_source(d, self._names)
+            names, _ = self._package(d, source, '-6')
+            self.assertEqual(names, sorted(self._names) + METADATA_FILES)
+
+    def test_directory_order(self):
+        with appx.util.temp_dir() as d:
+            source = self._make_source(d, self._names)
+            names, _ = self._package(d, source, '--order', 'directory')
+            self.assertEqual(
+                names,
+                ['top', 'z', 'A/upper', 'a/b.txt', 'a/b0', 'a/b/c', 'a/b/d',
+                 'a-b/y'] +
+                sorted(n for n in self._names if n.startswith('many/')) +
+                METADATA_FILES)
+
+    def test_physical_order(self):
+        with appx.util.temp_dir() as d:
+            source = self._make_source(d, self._names)
+            names, _ = self._package(d, source, '--order', 'physical')
+            self.assertEqual(sorted(names[:-2]), sorted(self._names))
+            self.assertEqual(names[-2:], METADATA_FILES)
+
+    def test_identical_inputs_give_identical_output(self):
+        outputs = set()
+        for names, jobs in [(self._names, '1'),
+                            (list(reversed(self._names)), '1'),
+                            (list(reversed(self._names)), '4')]:
+            with appx.util.temp_dir() as d:
+                source = self._make_source(d, names)
+                _, data = self._package(d, source, '-6', '-j', jobs)
+                outputs.add(data)
+        self.assertEqual(len(outputs), 1)
+
+    def test_invalid_order(self):
+        with appx.util.temp_dir() as d:
+            process = subprocess.run(
+                [appx_exe(), '-o', os.path.join(d, 'test.appx'), '--order',
+                 'random', d],
+                stderr=subprocess.PIPE)
+            self.assertNotEqual(process.returncode, 0)
+            self.assertIn(b'Invalid --order', process.stderr)
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2016-present, Facebook, Inc.
+# Copyright (c) 2021, Neal Gompa
+# All rights reserved.
+#
+# This source code is licensed under the Mozilla Public License, version 2.0.
+# For details, see the LICENSE file in the root directory of this source tree.
+# Portions of this code was previously licensed under a BSD-style license.
+# See the LICENSE-BSD file in the root directory of this source tree for details.
+
+from appx.util import appx_exe
+import appx.util
+import os
+import subprocess
+import unittest
+import zipfile
+
+class TestOutput(unittest.TestCase):
+    '''
+    Ensures the output options change how the APPX is written, but not what
+    is written.
+    '''
+
+    def _make_inputs(self, d):
+        contents = {
+            # Bigger than the output buffers, so several are written and
+            # streamed headers are patched after their buffer was written.
+            'big.bin': os.urandom(9 * 1024 * 1024 + 7),
+            'text.txt': b'This is a test file.\n' * 400000,
+        }
+        # Neither small nor streamed, so read ahead into the page cache and
+        # mapped.
+        for i in range(20):
+            contents['medium%d.txt' % i] = \
+                b'medium file %d\n' % i * (10000 * (i + 1))
+        for i in range(100):
+            contents['small%d.txt' % i] = b'small file %d\n' % i
+        return appx.util.make_tree(d, contents)
+
+    def _build(self, d, input_dir, name, *args):
+        return appx.util.read_file(
+            appx.util.package(d, input_dir, *args, name=name))
+
+    def test_options_do_not_change_output(self):
+        for level in ['-0', '-6']:
+            with appx.util.temp_dir() as d:
+                input_dir = self._make_inputs(d)
+                expected = self._build(d, input_dir, 'default.appx', level)
+                for options in [['--io-uring'],
+                                ['--direct-io'],
+                                ['--drop-cache'],
+                                ['--fsync', 'close'],
+                                ['--fsync', '1M'],
+                                ['--io-uring', '--direct-io', '--drop-cache',
+                                 '--fsync', '2M', '-j', '2']]:
+                    actual = self._build(d, input_dir, 'test.appx', level,
+                                         *options)
+                    self.assertEqual(expected, actual, options)
+                with zipfile.ZipFile(os.path.join(d, 'test.appx')) as zip:
+                    self.assertIsNone(zip.testzip())
+
+    def test_pipe(self):
+        with appx.util.temp_dir() as d:
+            input_dir = self._make_inputs(d)
+            expected = self._build(d, input_dir, 'file.appx', '-6')
+            piped = subprocess.check_output(['sh', '-c', '"$@" | cat', 'sh',
+                                             appx_exe(), '-o', '/dev/stdout',
+                                             '-6', '--io-uring', '--direct-io',
+                                             input_dir])
+            self.assertEqual(expected, piped)
+
+    def test_invalid_fsync_policy(self):
+        with appx.util.temp_dir() as d:
+            with open(os.path.join(d, 'README.txt'), 'wb') as readme:
+                readme.write(b'This is a test file.\n')
+            process = subprocess.Popen([
+                appx_exe(), '-o', os.path.join(d, 'test.appx'),
+                '--fsync', 'sometimes', os.path.join(d, 'README.txt')],
+                stderr=subprocess.PIPE)
+            _, stderr = process.communicate()
+            self.assertNotEqual(0, process.returncode)
+            self.assertIn(b'Invalid --fsync policy', stderr)
+
+if __name__ == '__main__':
+    unittest.main()
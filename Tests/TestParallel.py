@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2016-present, Facebook, Inc.
+# Copyright (c) 2021, Neal Gompa
+# All rights reserved.
+#
+# This source code is licensed under the Mozilla Public License, version 2.0.
+# For details, see the LICENSE file in the root directory of this source tree.
+# Portions of this code was previously licensed under a BSD-style license.
+# See the LICENSE-BSD file in the root directory of this source tree for details.
+
+from appx.util import appx_exe
+import appx.util
+import os
+import random
+import subprocess
+import unittest
+import zipfile
+
+class TestParallel(unittest.TestCase):
+    '''
+    Ensures compressing with multiple jobs produces the same APPX as
+    compressing with a single job.
+    '''
+
+    def _make_tree(self, d):
+        rng = random.Random(42)
+        sizes = [0, 1, 100, 4096, 65535, 65536, 65537, 300000, 1000000]
+        contents = {}
+        for i, size in enumerate(sizes * 3):
+            # Mix compressible and incompressible data.
+            contents['dir{}/file{}.dat'.format(i % 4, i)] = (
+                (b'compressible ' * size)[:size // 2] +
+                appx.util.random_bytes(rng, size - size // 2))
+        return appx.util.make_tree(d, contents)
+
+    def _package(self, d, source, jobs, *args):
+        return appx.util.read_file(appx.util.package(
+            d, source, '-j', str(jobs), *args,
+            name='test-j{}.appx'.format(jobs)))
+
+    def test_parallel_output_matches_serial(self):
+        with appx.util.temp_dir() as d:
+            source = self._make_tree(d)
+            for level in ['-0', '-1', '-9']:
+                serial = self._package(d, source, 1, level)
+                parallel = self._package(d, source, 4, level)
+                self.assertEqual(serial, parallel)
+                with zipfile.ZipFile(
+                        os.path.join(d, 'test-j4.appx')) as zip:
+                    self.assertIsNone(zip.testzip())
+
+    def test_parallel_single_large_file(self):
+        with appx.util.temp_dir() as d:
+            rng = random.Random(7)
+            source = appx.util.make_tree(d, {
+                'assets.pak': b''.join(
+                    b'block %d ' % i * 5000 +
+                    appx.util.random_bytes(rng, 30000) for i in range(40)),
+            })
+            serial = self._package(d, source, 1, '-9')
+            parallel = self._package(d, source, 8, '-9')
+            self.assertEqual(serial, parallel)
+            with zipfile.ZipFile(os.path.join(d, 'test-j8.appx')) as zip:
+                self.assertIsNone(zip.testzip())
+
+    def test_parallel_signed_zip(self):
+        with appx.util.temp_dir() as d:
+            source = self._make_tree(d)
+            self._package(d, source, 3, '-9', '-c', appx.util.test_key_path())
+            with zipfile.ZipFile(os.path.join(d, 'test-j3.appx')) as zip:
+                self.assertIsNone(zip.testzip())
+
+    def test_invalid_job_count(self):
+        with appx.util.temp_dir() as d:
+            with open(os.path.join(d, 'README.txt'), 'wb') as readme:
+                readme.write(b'This is a test file.\n')
+            process = subprocess.Popen([
+                appx_exe(), '-o', os.path.join(d, 'test.appx'),
+                '-j', 'many', os.path.join(d, 'README.txt'),
+            ], stderr=subprocess.PIPE)
+            (_, stderr) = process.communicate()
+            self.assertEqual(1, process.returncode)
+            self.assertIn('Invalid job count', stderr.decode('utf-8'))
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2016-present, Facebook, Inc.
+# Copyright (c) 2021, Neal Gompa
+# All rights reserved.
+#
+# This source code is licensed under the Mozilla Public License, version 2.0.
+# For details, see the LICENSE file in the root directory of this source tree.
+# Portions of this code was previously licensed under a BSD-style license.
+# See the LICENSE-BSD file in the root directory of this source tree for details.
+
+from appx.util import appx_exe
+import appx.util
+import json
+import os
+import subprocess
+import unittest
+
+class TestProgress(unittest.TestCase):
+    '''
+    Ensures --progress=fd:N writes a JSON event for the start and finish of
+    each file, and a final progress event accounting for all input.
+    '''
+
+    _files = {
+        'small.txt': b'hello ' * 100,
+        'big.bin': os.urandom(3 * 1024 * 1024),
+        'stored.appx': os.urandom(100000),
+        'empty': b'',
+        'Assets/logo.png': os.urandom(5000),
+    }
+
+    def _package(self, d, *args):
+        source = appx.util.make_tree(d, self._files)
+        events_path = os.path.join(d, 'events.json')
+        with open(events_path, 'wb') as events:
+            appx.util.package(d, source,
+                              '--progress=fd:{}'.format(events.fileno()),
+                              *args, pass_fds=[events.fileno()])
+        lines = appx.util.read_file(events_path).decode('utf-8').splitlines()
+        return [json.loads(line) for line in lines]
+
+    def _check_progress(self, *args):
+        with appx.util.temp_dir() as d:
+            events = self._package(d, *args)
+            self.assertEqual(events[0]['event'], 'begin')
+            self.assertEqual(events[0]['entries'], len(self._files))
+            total = sum(len(data) for data in self._files.values())
+            self.assertEqual(events[0]['total_bytes'], total)
+
+            started = [e['name'] for e in events
+                       if e['event'] == 'entry_start']
+            finished = {e['name']: e for e in events
+                        if e['event'] == 'entry_finish'}
+            self.assertEqual(sorted(started), sorted(self._files))
+            self.assertEqual(set(finished), set(self._files))
+            for name, data in self._files.items():
+                self.assertEqual(finished[name]['input_bytes'], len(data))
+
+            last = events[-1]
+            self.assertEqual(last['event'], 'progress')
+            self.assertEqual(last['entries_done'], len(self._files))
+            self.assertEqual(last['bytes_read'], total)
+            # The block map and central directory follow the entries.
+            self.assertGreater(last['bytes_written'], 0)
+            self.assertLess(last['bytes_written'],
+                            os.path.getsize(os.path.join(d, 'test.appx')))
+            self.assertIn('mb_per_s', last)
+            self.assertEqual(last['eta_s'], 0)
+
+    def test_serial(self):
+        self._check_progress('-6')
+
+    def test_parallel(self):
+        self._check_progress('-6', '-j', '3')
+
+    def test_stored(self):
+        self._check_progress('-0')
+
+    def test_non_utf8_names(self):
+        with appx.util.temp_dir() as d:
+            source = appx.util.make_non_utf8_tree(d)
+            events_path = os.path.join(d, 'events.json')
+            with open(events_path, 'wb') as events:
+                appx.util.package(d, source,
+                                  '--progress=fd:{}'.format(events.fileno()),
+                                  pass_fds=[events.fileno()])
+            # Strictly UTF-8, or decode fails.
+            lines = appx.util.read_file(events_path).decode('utf-8')
+            events = [json.loads(line) for line in lines.splitlines()]
+            for kind in ['entry_start', 'entry_finish']:
+                names = [e['name'] for e in events if e['event'] == kind]
+                self.assertEqual(sorted(names),
+                                 sorted(appx.util.NON_UTF8_NAMES.values()))
+
+    def test_invalid_fd(self):
+        with appx.util.temp_dir() as d:
+            output = os.path.join(d, 'test.appx')
+            for arg in ['fd:', 'fd:x', '2', 'fd:-1', 'fd:99']:
+                process = subprocess.run(
+                    [appx_exe(), '-o', output, '--progress=' + arg, d],
+                    stderr=subprocess.PIPE)
+                self.assertNotEqual(process.returncode, 0, arg)
+                self.assertIn(b'Invalid --progress', process.stderr)
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2016-present, Facebook, Inc.
+# Copyright (c) 2021, Neal Gompa
+# All rights reserved.
+#
+# This source code is licensed under the Mozilla Public License, version 2.0.
+# For details, see the LICENSE file in the root directory of this source tree.
+# Portions of this code was previously licensed under a BSD-style license.
+# See the LICENSE-BSD file in the root directory of this source tree for details.
+
+from appx.util import appx_exe
+import appx.util
+import os
+import random
+import subprocess
+import unittest
+import zipfile
+
+class TestSmallFiles(unittest.TestCase):
+    '''
+    Ensures files of at most one block, which are read ahead and take a
+    faster path, are archived like bigger files, whether they are batched or
+    not.
+    '''
+
+    # Around the 64 KiB block size.
+    _sizes = [0, 1, 1000, 65535, 65536, 65537]
+
+    def _make_source(self, d):
+        rng = random.Random(0)
+        contents = {}
+        for size in self._sizes:
+            contents['text{}.txt'.format(size)] = \
+                (b'small file ' * (size // 11 + 1))[:size]
+            contents['random{}.bin'.format(size)] = \
+                bytes(rng.getrandbits(8) for _ in range(size))
+            contents['inner{}.appx'.format(size)] = \
+                (b'appx ' * (size // 5 + 1))[:size]
+        # Enough tiny files for several batches.
+        for i in range(300):
+            contents['many/f{}.res'.format(i)] = \
+                ('resource {}\n'.format(i) * (i % 40)).encode('utf-8')
+        return appx.util.make_tree(d, contents), contents
+
+    def _package(self, d, source, *args):
+        output = appx.util.package(d, source, *args)
+        return output, appx.util.read_file(output)
+
+    def _check_contents(self, output, contents):
+        with zipfile.ZipFile(output) as zip:
+            self.assertIsNone(zip.testzip())
+            for name, data in contents.items():
+                self.assertEqual(zip.read(name), data, name)
+            return {i.filename: i.compress_type for i in zip.infolist()}
+
+    def test_contents_and_compression(self):
+        with appx.util.temp_dir() as d:
+            source, contents = self._make_source(d)
+            output, _ = self._package(d, source, '-6', '--policy',
+                                      '*.bin=auto')
+            types = self._check_contents(output, contents)
+            for size in self._sizes:
+                self.assertEqual(types['inner{}.appx'.format(size)],
+                                 zipfile.ZIP_STORED)
+                self.assertEqual(types['text{}.txt'.format(size)],
+                                 zipfile.ZIP_DEFLATED)
+                # Random data does not compress, so Auto stores it.
+                self.assertEqual(types['random{}.bin'.format(size)],
+                                 zipfile.ZIP_STORED)
+
+    def test_store(self):
+        with appx.util.temp_dir() as d:
+            source, contents = self._make_source(d)
+            output, _ = self._package(d, source, '-0')
+            types = self._check_contents(output, contents)
+            self.assertEqual(set(types[name] for name in contents),
+                             {zipfile.ZIP_STORED})
+
+    def test_jobs_give_identical_output(self):
+        for args in [['-0'], ['-9'], ['-6', '--policy', '*=auto']]:
+            outputs = set()
+            with appx.util.temp_dir() as d:
+                source, _ = self._make_source(d)
+                for jobs in ['1', '2', '4']:
+                    _, data = self._package(d, source, '-j', jobs, *args)
+                    outputs.add(data)
+            self.assertEqual(len(outputs), 1, args)
+
+    def test_many_files(self):
+        # More files than are read ahead at once, so reading pauses and
+        # resumes.
+        with appx.util.temp_dir() as d:
+            contents = {
+                'd{}/f{}.res'.format(i % 7, i):
+                    'resource {}\n'.format(i).encode('utf-8')
+                for i in range(2000)
+            }
+            source = appx.util.make_tree(d, contents)
+            outputs = set()
+            for jobs in ['1', '4']:
+                output, data = self._package(d, source, '-j', jobs)
+                self._check_contents(output, contents)
+                outputs.add(data)
+            self.assertEqual(len(outputs), 1)
+
+    def test_missing_file(self):
+        with appx.util.temp_dir() as d:
+            source, _ = self._make_source(d)
+            mapping = os.path.join(d, 'mapping.txt')
+            missing = os.path.join(d, 'missing.txt')
+            with open(mapping, 'w') as f:
+                f.write('[Files]\n')
+                f.write('"{}" "a.txt"\n'.format(
+                    os.path.join(source, 'text1.txt')))
+                f.write('"{}" "b.txt"\n'.format(missing))
+            for jobs in ['1', '4']:
+                process = subprocess.run(
+                    [appx_exe(), '-j', jobs, '-o',
+                     os.path.join(d, 'test.appx'), '-f', mapping],
+                    stderr=subprocess.PIPE)
+                self.assertEqual(process.returncode, 1)
+                self.assertIn(missing.encode('utf-8'), process.stderr)
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2016-present, Facebook, Inc.
+# Copyright (c) 2021, Neal Gompa
+# All rights reserved.
+#
+# This source code is licensed under the Mozilla Public License, version 2.0.
+# For details, see the LICENSE file in the root directory of this source tree.
+# Portions of this code was previously licensed under a BSD-style license.
+# See the LICENSE-BSD file in the root directory of this source tree for details.
+
+from appx.util import appx_exe
+import appx.util
+import os
+import resource
+import subprocess
+import unittest
+import zipfile
+
+class TestStreaming(unittest.TestCase):
+    '''
+    Ensures big files are streamed into the APPX rather than held in memory.
+    '''
+
+    _file_size = 160 * 1024 * 1024
+    _memory_limit = 128 * 1024 * 1024
+
+    def _limit_memory(self):
+        resource.setrlimit(resource.RLIMIT_AS,
+                           (self._memory_limit, self._memory_limit))
+
+    def _check_streamed(self, *args):
+        with appx.util.temp_dir() as d:
+            big_file_path = os.path.join(d, 'big.bin')
+            with open(big_file_path, 'wb') as big_file:
+                # Incompressible, so the compressed data is as big as the
+                # file.
+                chunk_size = 1024 * 1024
+                for _ in range(self._file_size // chunk_size):
+                    big_file.write(os.urandom(chunk_size))
+            small_file_path = os.path.join(d, 'small.txt')
+            with open(small_file_path, 'wb') as small_file:
+                small_file.write(b'This is a test file.\n')
+            output_path = os.path.join(d, 'test.appx')
+            subprocess.check_call([appx_exe(), '-o', output_path] +
+                                  list(args) +
+                                  [big_file_path, small_file_path],
+                                  preexec_fn=self._limit_memory)
+            with zipfile.ZipFile(output_path) as zip:
+                self.assertEqual(self._file_size,
+                                 zip.getinfo('big.bin').file_size)
+                self.assertIsNone(zip.testzip())
+
+    def test_stored(self):
+        self._check_streamed('-0')
+
+    def test_compressed(self):
+        self._check_streamed('-1')
+
+    def test_compressed_parallel(self):
+        self._check_streamed('-1', '-j', '2')
+
+    def test_signed(self):
+        self._check_streamed('-1', '-c', appx.util.test_key_path())
+
+if __name__ == '__main__':
+    unittest.main()
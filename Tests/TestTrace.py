@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2016-present, Facebook, Inc.
+# Copyright (c) 2021, Neal Gompa
+# All rights reserved.
+#
+# This source code is licensed under the Mozilla Public License, version 2.0.
+# For details, see the LICENSE file in the root directory of this source tree.
+# Portions of this code was previously licensed under a BSD-style license.
+# See the LICENSE-BSD file in the root directory of this source tree for details.
+
+import appx.util
+import json
+import os
+import unittest
+
+class TestTrace(unittest.TestCase):
+    '''
+    Ensures --trace writes a Chrome trace with a span for each phase and each
+    file, and --stats prints a summary of time and memory use.
+    '''
+
+    _files = {
+        'small.txt': b'hello ' * 100,
+        'big"name.bin': os.urandom(2 * 1024 * 1024),
+        'Assets/logo.png': os.urandom(5000),
+    }
+
+    def _package(self, d, *args):
+        source = appx.util.make_tree(d, self._files)
+        stderr_path = os.path.join(d, 'stderr.txt')
+        with open(stderr_path, 'wb') as stderr:
+            appx.util.package(d, source, '-c', appx.util.test_key_path(),
+                              *args, stderr=stderr)
+        return appx.util.read_file(stderr_path).decode('utf-8')
+
+    def _check_trace(self, steps, *args):
+        with appx.util.temp_dir() as d:
+            trace_path = os.path.join(d, 'trace.json')
+            self._package(d, '--trace', trace_path, *args)
+            with open(trace_path) as f:
+                events = json.load(f)['traceEvents']
+            spans = [e for e in events if e['ph'] == 'X']
+            for span in spans:
+                self.assertGreaterEqual(span['dur'], 0)
+                self.assertIn('tid', span)
+            phases = {e['name'] for e in spans if e['cat'] == 'phase'}
+            for phase in ['walk', 'entries', 'block-map', 'content-types',
+                          'central-directory-hash', 'sign',
+                          'central-directory', 'close']:
+                self.assertIn(phase, phases)
+            writes = {e['name']: e for e in spans if e['cat'] == 'write'}
+            self.assertEqual(set(writes), set(self._files))
+            for name, data in self._files.items():
+                span_args = writes[name]['args']
+                self.assertEqual(span_args['archive_name'], name)
+                self.assertTrue(span_args['path'].endswith(name))
+                self.assertEqual(span_args['input_bytes'], len(data))
+                self.assertGreater(span_args['output_bytes'], 0)
+                self.assertIn('ratio', span_args)
+
+            # Reading, digesting and compressing are traced inside the spans
+            # of the entries.
+            for step in steps:
+                self.assertIn(step, {e['cat'] for e in spans})
+            parents = [e for e in spans if e['cat'] in ('compress', 'write')]
+            for span in spans:
+                if span['cat'] not in ('read', 'digest', 'deflate'):
+                    continue
+                self.assertIn('input_bytes', span['args'])
+                # With -j, blocks of large files are compressed on pool
+                # threads, outside any entry's span.
+                if '-j' in args and span['cat'] != 'read':
+                    continue
+                self.assertTrue(
+                    any(p['tid'] == span['tid'] and p['ts'] <= span['ts'] and
+                        span['ts'] + span['dur'] <= p['ts'] + p['dur'] + 1
+                        for p in parents),
+                    span)
+
+    def test_trace(self):
+        self._check_trace(['read', 'digest', 'deflate'], '-6')
+
+    def test_trace_parallel(self):
+        self._check_trace(['read', 'digest', 'deflate'], '-6', '-j', '3')
+
+    def test_trace_stored(self):
+        self._check_trace(['read', 'digest'], '-0')
+
+    def test_non_utf8_names(self):
+        with appx.util.temp_dir() as d:
+            source = appx.util.make_non_utf8_tree(d)
+            trace_path = os.path.join(d, 'trace.json')
+            appx.util.package(d, source, '--trace', trace_path)
+            # Strictly UTF-8, or decode fails.
+            text = appx.util.read_file(trace_path).decode('utf-8')
+            spans = json.loads(text)['traceEvents']
+            writes = {e['name']: e for e in spans if e.get('cat') == 'write'}
+            self.assertEqual(set(writes),
+                             set(appx.util.NON_UTF8_NAMES.values()))
+            for name, span in writes.items():
+                self.assertTrue(span['args']['path'].endswith('/' + name))
+
+    def test_stats(self):
+        with appx.util.temp_dir() as d:
+            stats = self._package(d, '--stats', '-6')
+            lines = stats.splitlines()
+            self.assertTrue(lines[0].startswith('span'))
+            names = {line.split()[0] for line in lines[1:]}
+            self.assertIn('phase:entries', names)
+            self.assertIn('write', names)
+            self.assertIn('digest', names)
+            self.assertIn('deflate', names)
+            self.assertIn('wall', names)
+
+    def test_memory_stats(self):
+        with appx.util.temp_dir() as d:
+            stats = self._package(d, '--stats', '-6')
+            self.assertNotIn('warning', stats)
+            lines = stats.splitlines()
+            memory = lines.index(next(l for l in lines
+                                      if l.startswith('memory')))
+            peaks = {}
+            for line in lines[memory + 1:]:
+                fields = line.split()
+                peaks[fields[0]] = float(fields[-1])
+            for component in ['entry-buffers', 'entry-metadata', 'xml',
+                              'zlib', 'hashing', 'signing', 'total',
+                              'resident']:
+                self.assertIn(component, peaks)
+            self.assertGreater(peaks['zlib'], 0)
+            self.assertGreater(peaks['signing'], 0)
+            self.assertGreaterEqual(peaks['total'], peaks['entry-buffers'])
+            self.assertGreaterEqual(peaks['resident'], peaks['total'])
+
+if __name__ == '__main__':
+    unittest.main()
@@ -65,5 +65,26 @@ class TestValidZIP(unittest.TestCase):
             with zipfile.ZipFile(os.path.join(d, 'test.appx')) as zip:
                 self.assertIsNone(zip.testzip())
 
+    def test_stored_zip_to_pipe(self):
+        # Stored files are copied by the kernel, which works differently for
+        # pipes than for regular files.
+        with appx.util.temp_dir() as d:
+            with open(os.path.join(d, 'README.txt'), 'wb') as readme:
+                readme.write(b'This is a test file.\n')
+            with open(os.path.join(d, 'big.bin'), 'wb') as big:
+                big.write(os.urandom(3 * 1024 * 1024 + 5))
+            inputs = [os.path.join(d, 'README.txt'),
+                      os.path.join(d, 'big.bin')]
+            subprocess.check_call([appx_exe(),
+                                   '-o', os.path.join(d, 'file.appx'),
+                                   '-0'] + inputs)
+            piped = subprocess.check_output(['sh', '-c', '"$@" | cat', 'sh',
+                                             appx_exe(), '-o', '/dev/stdout',
+                                             '-0'] + inputs)
+            with open(os.path.join(d, 'file.appx'), 'rb') as file:
+                self.assertEqual(file.read(), piped)
+            with zipfile.ZipFile(os.path.join(d, 'file.appx')) as zip:
+                self.assertIsNone(zip.testzip())
+
 if __name__ == '__main__':
     unittest.main()
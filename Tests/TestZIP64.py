@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2016-present, Facebook, Inc.
+# Copyright (c) 2021, Neal Gompa
+# All rights reserved.
+#
+# This source code is licensed under the Mozilla Public License, version 2.0.
+# For details, see the LICENSE file in the root directory of this source tree.
+# Portions of this code was previously licensed under a BSD-style license.
+# See the LICENSE-BSD file in the root directory of this source tree for details.
+
+import appx.util
+import os
+import struct
+import unittest
+import zipfile
+
+class TestZIP64(unittest.TestCase):
+    '''
+    Ensures files bigger than 4 GiB, and files stored after the first 4 GiB of
+    the APPX, get ZIP64 extra fields.
+    '''
+
+    _big_file_size = 2**32 + 17 * 2**20 + 3
+
+    def _package(self, d, *args):
+        source = appx.util.make_tree(d, {
+            'b{}.txt'.format(i): b'This is a test file.\n' for i in range(8)
+        })
+        # A sparse file, so the test doesn't need 4 GiB of input on disk.
+        with open(os.path.join(source, 'a_big.bin'), 'wb') as big_file:
+            big_file.write(b'start of a big file')
+            big_file.truncate(self._big_file_size)
+        return appx.util.package(d, source, *args)
+
+    def _read_local_header(self, path, info):
+        with open(path, 'rb') as f:
+            f.seek(info.header_offset)
+            header = f.read(30)
+            (signature, _, _, _, _, _, _, compressed_size, uncompressed_size,
+             name_length, extra_length) = struct.unpack('<IHHHHHIIIHH', header)
+            self.assertEqual(0x04034B50, signature)
+            f.seek(name_length, os.SEEK_CUR)
+            extra = f.read(extra_length)
+            return (compressed_size, uncompressed_size, extra)
+
+    def _check_big_file(self, path, zip):
+        info = zip.getinfo('a_big.bin')
+        self.assertEqual(self._big_file_size, info.file_size)
+        (compressed_size, uncompressed_size, extra) = \
+            self._read_local_header(path, info)
+        self.assertEqual(0xFFFFFFFF, compressed_size)
+        self.assertEqual(0xFFFFFFFF, uncompressed_size)
+        (tag, size, extra_uncompressed_size, extra_compressed_size) = \
+            struct.unpack('<HHQQ', extra)
+        self.assertEqual(0x0001, tag)
+        self.assertEqual(16, size)
+        self.assertEqual(info.file_size, extra_uncompressed_size)
+        self.assertEqual(info.compress_size, extra_compressed_size)
+
+    def test_stored_big_file(self):
+        with appx.util.temp_dir() as d:
+            path = self._package(d, '-0')
+            with zipfile.ZipFile(path) as zip:
+                self._check_big_file(path, zip)
+                # Entries after the big file need a 64-bit offset.
+                self.assertTrue(any(info.header_offset >= 2**32
+                                    for info in zip.infolist()))
+                for i in range(8):
+                    self.assertEqual(b'This is a test file.\n',
+                                     zip.read('b{}.txt'.format(i)))
+                self.assertIsNone(zip.testzip())
+
+    def test_compressed_big_file(self):
+        with appx.util.temp_dir() as d:
+            path = self._package(d, '-1', '-j', '2')
+            with zipfile.ZipFile(path) as zip:
+                self._check_big_file(path, zip)
+                info = zip.getinfo('a_big.bin')
+                self.assertLess(info.compress_size, 2**32)
+                block_map = zip.read('AppxBlockMap.xml').decode('utf-8')
+                # 30-byte header, the name, and a 20-byte ZIP64 extra field.
+                self.assertIn(
+                    'Name="a_big.bin" Size="{}" LfhSize="{}"'.format(
+                        info.file_size, 30 + len('a_big.bin') + 20),
+                    block_map)
+                self.assertIsNone(zip.testzip())
+
+if __name__ == '__main__':
+    unittest.main()
@@ -11,6 +11,7 @@
 import contextlib
 import os
 import shutil
+import subprocess
 import tempfile
 
 @contextlib.contextmanager
@@ -27,6 +28,66 @@ def appx_exe():
         raise Exception('APPX_EXE_PATH environment variable must be specified')
     return path
 
+def make_tree(d, contents):
+    '''
+    Writes a directory named source in d with the files in contents, a dict
+    from '/'-separated file names to their bytes. Returns the directory's path.
+    '''
+    source = os.path.join(d, 'source')
+    os.makedirs(source, exist_ok=True)
+    for name, data in contents.items():
+        path = os.path.join(source, *name.split('/'))
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        with open(path, 'wb') as f:
+            f.write(data)
+    return source
+
+def package(d, source, *args, name='test.appx', **kwargs):
+    '''
+    Runs appx with args to package source into d/name, and returns the
+    package's path. kwargs are passed to subprocess.run.
+    '''
+    output = os.path.join(d, name)
+    subprocess.run([appx_exe(), '-o', output] + list(args) + [source],
+                   check=True, **kwargs)
+    return output
+
+def random_bytes(rng, size):
+    '''
+    Returns size bytes from the random.Random rng. Unlike rng.randbytes,
+    this works on Python before 3.9.
+    '''
+    if size == 0:
+        return b''
+    return rng.getrandbits(8 * size).to_bytes(size, 'little')
+
+# File names which are not valid UTF-8 (Latin-1, overlong, a surrogate and
+# a cut off sequence) and one which is, each with the name it should have
+# in JSON output, where invalid bytes become U+FFFD.
+NON_UTF8_NAMES = {
+    b'caf\xe9.txt': 'caf\ufffd.txt',
+    b'slash\xc0\xaf.txt': 'slash\ufffd\ufffd.txt',
+    b'surrogate\xed\xa0\x80.txt': 'surrogate\ufffd\ufffd\ufffd.txt',
+    b'cut\xe2\x82': 'cut\ufffd\ufffd',
+    'caf\u00e9 \u20ac \U0001f600.txt'.encode('utf-8'):
+        'caf\u00e9 \u20ac \U0001f600.txt',
+}
+
+def make_non_utf8_tree(d):
+    '''
+    Writes a directory named source in d with a file for each of
+    NON_UTF8_NAMES. Returns the directory's path.
+    '''
+    source = make_tree(d, {})
+    for name in NON_UTF8_NAMES:
+        with open(os.path.join(os.fsencode(source), name), 'wb') as f:
+            f.write(name)
+    return source
+
+def read_file(path):
+    with open(path, 'rb') as f:
+        return f.read()
+
 def test_dir_path():
     return os.path.dirname(os.path.dirname(os.path.realpath(__file__)))
 